@@ -20,10 +20,14 @@
 #include "utils_disk.h"
 #include "tap.h"
 #include "regex.h"
+#include <fcntl.h>
+#include <utime.h>
+#include <sys/stat.h>
 
 void np_test_mount_entry_regex (struct mount_entry *dummy_mount_list,
 	       			char *regstr, int cflags, int expect,
 			       	char *desc);
+void np_test_du_walk (void);
 
 
 int
@@ -42,7 +46,7 @@ main (int argc, char **argv)
 	int cflags = REG_NOSUB | REG_EXTENDED;
 	int found = 0, count = 0;
 
-	plan_tests(33);
+	plan_tests(42);
 
 	ok( np_find_name(exclude_filesystem, "/var/log") == FALSE, "/var/log not in list");
 	np_add_name(&exclude_filesystem, "/var/log");
@@ -198,6 +202,8 @@ main (int argc, char **argv)
 	ok(found == 0, "last (/home) element successfully deleted");
 	ok(count == 2, "two elements remaining");
 
+	np_test_du_walk();
+
 
 	return exit_status();
 }
@@ -222,3 +228,86 @@ np_test_mount_entry_regex (struct mount_entry *dummy_mount_list, char *regstr, i
 		ok ( false, "regex '%s' not compilable", regstr);
 }
 
+
+
+static void
+make_file (const char *dir, const char *name, size_t size)
+{
+	char path[PATH_MAX], buf[4096];
+	int fd;
+
+	memset (buf, 'x', sizeof (buf));
+	snprintf (path, sizeof (path), "%s/%s", dir, name);
+	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	for (; size > sizeof (buf); size -= sizeof (buf))
+		write (fd, buf, sizeof (buf));
+	write (fd, buf, size);
+	close (fd);
+}
+
+void
+np_test_du_walk (void)
+{
+	char root[] = "/tmp/test_disk.XXXXXX", path[PATH_MAX], second[PATH_MAX];
+	struct du_tree tree, threaded, cached;
+	struct utimbuf old = { 1000, 1000 };
+	size_t i, walked = 0;
+	uintmax_t ab = 0;
+
+	if (mkdtemp (root) == NULL) {
+		skip (9, "cannot create a temporary directory");
+		return;
+	}
+	/* 11 inodes: the top, f0, a (a, big, f1, sub, sub/f3, sub/deep), b (b, f4) and c */
+	snprintf (path, sizeof (path), "%s/a", root);
+	mkdir (path, 0700);
+	snprintf (path, sizeof (path), "%s/a/sub", root);
+	mkdir (path, 0700);
+	snprintf (path, sizeof (path), "%s/a/sub/deep", root);
+	mkdir (path, 0700);
+	snprintf (path, sizeof (path), "%s/b", root);
+	mkdir (path, 0700);
+	snprintf (path, sizeof (path), "%s/c", root);
+	mkdir (path, 0700);
+	make_file (root, "f0", 100);
+	make_file (root, "a/big", 256 * 1024);
+	make_file (root, "a/f1", 100);
+	make_file (root, "a/sub/f3", 100);
+	make_file (root, "b/f4", 100);
+	snprintf (path, sizeof (path), "%s/a/f1", root);
+	snprintf (second, sizeof (second), "%s/b/f1", root);
+	link (path, second);
+	snprintf (path, sizeof (path), "%s/c", root);
+	utime (path, &old);
+
+	tree.path = root;
+	ok (np_du_walk (&tree, 1, NULL, 0) == OK, "du walk of a directory tree");
+	ok (tree.total.inodes == 11, "hard link counted once: %ju inodes", tree.total.inodes);
+	ok (tree.subdir_count == 3 && !strcmp (tree.subdirs[0].name, "a"), "subdirectories listed, largest first");
+	for (i = 0; i < tree.subdir_count; i++)
+		if (strcmp (tree.subdirs[i].name, "c"))
+			ab += tree.subdirs[i].usage.inodes;
+	ok (ab == 8, "usage split over the subdirectories");
+	ok (tree.errors == 0, "no errors");
+
+	threaded.path = root;
+	np_du_walk (&threaded, 4, NULL, 0);
+	ok (threaded.total.inodes == tree.total.inodes && threaded.total.bytes == tree.total.bytes,
+	    "same usage with 4 threads");
+
+	/* the cache is used for unchanged subdirectories only */
+	make_file (path, "new", 100);
+	cached.path = root;
+	np_du_walk (&cached, 2, tree.subdirs, tree.subdir_count);
+	for (i = 0; i < cached.subdir_count; i++)
+		if (!cached.subdirs[i].cached)
+			walked++;
+	ok (walked == 1 && cached.total.inodes == tree.total.inodes + 1, "changed subdirectory walked, others cached");
+
+	snprintf (path, sizeof (path), "%s/missing", root);
+	tree.path = path;
+	ok (np_du_walk (&tree, 1, NULL, 0) == ERROR && tree.error != NULL, "missing directory is an error");
+
+	snprintf (path, sizeof (path), "rm -rf %s", root);
+	ok (system (path) == 0, "removed test tree");
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_series.h"
+#include "tap.h"
+
+#include <math.h>
+
+extern monitoring_plugin *this_monitoring_plugin;
+
+#define close_to(a, b) (fabs ((a) - (b)) < 0.001)
+
+int
+main (int argc, char **argv)
+{
+	char state_dir[] = "/tmp/test_series.XXXXXX";
+	char command[96], line[64];
+	np_series_stats stats;
+	time_t now;
+	FILE *fp;
+	int i, rc;
+
+	plan_tests (22);
+
+	if (mkdtemp (state_dir) == NULL) {
+		diag ("Cannot create a state directory");
+		return exit_status ();
+	}
+	setenv ("MP_STATE_PATH", state_dir, 1);
+	np_init ("check_test", argc, argv);
+	np_enable_state ("own_state", 1);
+	time (&now);
+
+	ok (np_series_window ("load", 0, &stats) == 0 && stats.count == 0, "Empty series");
+
+	/* 1 to 10, ten seconds apart, the last one now */
+	rc = OK;
+	for (i = 1; i <= 10; i++)
+		if (np_series_append ("load", now - 100 + i * 10, i) != OK)
+			rc = ERROR;
+	ok (rc == OK, "Samples appended");
+	ok (!strcmp (this_monitoring_plugin->state->name, "own_state"), "Plugin state still enabled");
+
+	ok (np_series_window ("load", 0, &stats) == 10, "Whole series");
+	ok (stats.first == now - 90 && stats.last == now, "First and last time");
+	ok (stats.min == 1 && stats.max == 10, "Min and max");
+	ok (close_to (stats.mean, 5.5), "Mean");
+	ok (close_to (stats.stddev, 2.8723), "Standard deviation %f", stats.stddev);
+	ok (close_to (stats.p50, 5.5) && close_to (stats.p90, 9.1), "Percentiles %f %f", stats.p50, stats.p90);
+	ok (close_to (stats.p99, 9.91), "99th percentile %f", stats.p99);
+	ok (close_to (stats.slope, 0.1), "Slope %f", stats.slope);
+
+	ok (np_series_window ("load", 35, &stats) == 4, "Window of the last 35 seconds");
+	ok (stats.min == 7 && close_to (stats.mean, 8.5), "Statistics over the window");
+	ok (np_series_window ("load", 1000, &stats) == 10, "Window longer than the series");
+
+	ok (np_series_append ("load", now - 5, 99) == ERROR, "Sample older than the newest refused");
+	ok (np_series_window ("load", 0, &stats) == 10 && stats.max == 10, "Series left alone");
+
+	/* deltas and floats on one line */
+	sprintf (command, "find %s -name series_load -exec tail -1 {} +", state_dir);
+	fp = popen (command, "r");
+	ok (fp != NULL && fgets (line, sizeof (line), fp) != NULL, "Read the series file");
+	if (fp)
+		pclose (fp);
+	line[strcspn (line, "\n")] = '\0';
+	sprintf (command, "%lu 0:1 10:2 10:3 ", (unsigned long)(now - 90));
+	ok (!strncmp (line, command, strlen (command)), "Stored as deltas: %s", line);
+
+	for (i = 1; i <= NP_SERIES_CAPACITY + 44; i++)
+		np_series_append ("ring", now - 1000 + i, i + 0.25);
+	ok (np_series_window ("ring", 0, &stats) == NP_SERIES_CAPACITY, "Capacity kept");
+	ok (stats.min == 45.25 && stats.max == NP_SERIES_CAPACITY + 44.25, "Oldest samples dropped");
+
+	ok (np_series_append (NULL, 0, 1) == OK && np_series_window (NULL, 60, &stats) == 1,
+	    "Key from the arguments");
+	ok (stats.first >= now && stats.min == 1, "Time 0 is now");
+
+	sprintf (command, "rm -rf %s", state_dir);
+	rc = system (command);
+
+	np_cleanup ();
+	return exit_status ();
+}
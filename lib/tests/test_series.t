@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_series") {
+	plan skip_all => "./test_series not compiled - please enable libtap library to test";
+}
+exec "./test_series";
@@ -31,6 +31,11 @@ int
 main (int argc, char **argv)
 {
 	char state_path[1024];
+	char state_dir[] = "/tmp/test_utils.XXXXXX";
+	char plugin_dir[1024];
+	char command[1200];
+	char shard[6];
+	char long_string[5000];
 	range	*range;
 	double	temp;
 	thresholds *thresholds = NULL;
@@ -39,8 +44,13 @@ main (int argc, char **argv)
 	state_key *temp_state_key = NULL;
 	state_data *temp_state_data;
 	time_t	current_time;
+	struct stat stat_buf;
+	struct utimbuf times;
+	char	cursor[NP_STATE_GC_NAME];
+	int	batch, scan, passes, removed;
+	FILE	*fp;
 
-	plan_tests(185);
+	plan_tests(205);
 
 	ok( this_monitoring_plugin==NULL, "monitoring_plugin not initialised");
 
@@ -347,7 +357,7 @@ main (int argc, char **argv)
 
 	np_enable_state("allowedchars_in_keyname", 77);
 	temp_state_key = this_monitoring_plugin->state;
-	sprintf(state_path, "/usr/local/nagios/var/%lu/check_test/allowedchars_in_keyname", (unsigned long)geteuid());
+	sprintf(state_path, "/usr/local/nagios/var/%lu/check_test/75/bf/allowedchars_in_keyname", (unsigned long)geteuid());
 	ok( !strcmp(temp_state_key->plugin_name, "check_test"), "Got plugin name" );
 	ok( !strcmp(temp_state_key->name, "allowedchars_in_keyname"), "Got key name with valid chars" );
 	ok( !strcmp(temp_state_key->_filename, state_path), "Got internal filename" );
@@ -362,7 +372,7 @@ main (int argc, char **argv)
 
 	np_enable_state("funnykeyname", 54);
 	temp_state_key = this_monitoring_plugin->state;
-	sprintf(state_path, "/usr/local/nagios/var/%lu/check_test/funnykeyname", (unsigned long)geteuid());
+	sprintf(state_path, "/usr/local/nagios/var/%lu/check_test/2d/57/funnykeyname", (unsigned long)geteuid());
 	ok( !strcmp(temp_state_key->plugin_name, "check_test"), "Got plugin name" );
 	ok( !strcmp(temp_state_key->name, "funnykeyname"), "Got key name" );
 
@@ -446,6 +456,181 @@ main (int argc, char **argv)
 	/* Check time is set to current_time */
 	ok(system("cmp var/generated var/statefile > /dev/null")!=0, "Generated file should be different this time");
 	ok(this_monitoring_plugin->state->state_data->time-current_time<=1, "Has time generated from current time");
+
+	memset(long_string, 'x', sizeof(long_string) - 1);
+	long_string[sizeof(long_string) - 1] = '\0';
+	np_state_write_string(0, long_string);
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, long_string), "Data longer than 1024 bytes read back");
+
+	np_state_write_private_string(0, "Secret");
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "Secret"), "Private state read back");
+	ok(stat("var/generated", &stat_buf)==0 && (stat_buf.st_mode & 0777)==0600, "Private state only readable by the owner");
+
+	np_state_set_ttl(3600);
+	np_state_write_string(0, "Short lived");
+	ok(system("grep -qx '# ttl 3600' var/generated")==0, "TTL recorded in the header");
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "Short lived"), "State with a TTL read back");
+
+	/* sharding, migration and garbage collection in a directory of our own */
+	if (mkdtemp(state_dir) == NULL) {
+		diag("Cannot create a state directory");
+		return exit_status();
+	}
+	setenv("MP_STATE_PATH", state_dir, 1);
+	sprintf(plugin_dir, "%s/%lu/check_test", state_dir, (unsigned long)geteuid());
+
+	/* a file where releases before sharding left it */
+	np_enable_state("moved", 54);
+	ok(_np_state_mkdirs(this_monitoring_plugin->state->_legacy_filename, FALSE)==OK, "Created plugin directory");
+	sprintf(command, "cp var/statefile %s/moved", plugin_dir);
+	rc = system(command);
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "String to read"), "Unsharded state still read");
+	sprintf(state_path, "%s/moved", plugin_dir);
+	ok(access(state_path, F_OK)!=0, "Unsharded file moved away");
+	ok(access(this_monitoring_plugin->state->_filename, F_OK)==0, "into its shard");
+
+	times.actime = times.modtime = time(NULL) - NP_STATE_DEFAULT_TTL / 2;
+	utime(this_monitoring_plugin->state->_filename, &times);
+	np_state_read();
+	ok(stat(this_monitoring_plugin->state->_filename, &stat_buf)==0 && stat_buf.st_mtime > times.modtime,
+	   "Reading refreshes the access time");
+
+	/* expired state, expired temporary file, live state and a foreign file */
+	times.actime = times.modtime = time(NULL) - 7200;
+	sprintf(state_path, "%s/expired", plugin_dir);
+	fp = fopen(state_path, "w");
+	fprintf(fp, "# NP State file\n# ttl 60\n1\n1\n1234567890\nGone\n");
+	fclose(fp);
+	utime(state_path, &times);
+	sprintf(state_path, "%s/alive", plugin_dir);
+	sprintf(command, "cp var/statefile %s", state_path);
+	rc = system(command);
+	utime(state_path, &times);
+	sprintf(state_path, "%s/foreign", plugin_dir);
+	fp = fopen(state_path, "w");
+	fprintf(fp, "Not ours\n");
+	fclose(fp);
+	times.actime = times.modtime = time(NULL) - NP_STATE_DEFAULT_TTL - 1;
+	utime(state_path, &times);
+	sprintf(state_path, "%s/writer.Ab12Cd", plugin_dir);
+	fp = fopen(state_path, "w");
+	fclose(fp);
+	utime(state_path, &times);
+
+	np_enable_state("writer", 54);
+	np_state_write_string(0, "Collect");
+	sprintf(state_path, "%s/expired", plugin_dir);
+	ok(access(state_path, F_OK)!=0, "Expired state removed on write");
+	sprintf(state_path, "%s/writer.Ab12Cd", plugin_dir);
+	ok(access(state_path, F_OK)!=0, "Stale temporary file removed");
+	sprintf(state_path, "%s/foreign", plugin_dir);
+	ok(access(state_path, F_OK)==0, "File without state header left alone");
+	_np_state_shard("alive", shard);
+	sprintf(state_path, "%s/%s/alive", plugin_dir, shard);
+	ok(access(state_path, F_OK)==0, "Live state moved to its shard");
+
+	/* within a shard */
+	sprintf(state_path, "%s/00/00/old", plugin_dir);
+	_np_state_mkdirs(state_path, TRUE);
+	fp = fopen(state_path, "w");
+	fprintf(fp, "# NP State file\n# ttl 60\n1\n1\n1234567890\nGone\n");
+	fclose(fp);
+	times.actime = times.modtime = time(NULL) - 7200;
+	utime(state_path, &times);
+	sprintf(state_path, "%s/00/00", plugin_dir);
+	cursor[0] = '\0';
+	batch = NP_STATE_GC_BATCH;
+	scan = NP_STATE_GC_SCAN;
+	ok(_np_state_gc_dir(state_path, time(NULL), FALSE, cursor, &batch, &scan)==1, "Expired state removed from a shard");
+	np_state_set_ttl(0);
+	np_state_write_string(0, "Forever");
+	times.actime = times.modtime = 1;
+	utime(this_monitoring_plugin->state->_filename, &times);
+	strcpy(state_path, this_monitoring_plugin->state->_filename);
+	/* as seen by another key */
+	np_enable_state("other", 54);
+	_np_state_shard("writer", shard);
+	sprintf(command, "%s/%s", plugin_dir, shard);
+	cursor[0] = '\0';
+	batch = NP_STATE_GC_BATCH;
+	scan = NP_STATE_GC_SCAN;
+	_np_state_gc_dir(command, time(NULL), FALSE, cursor, &batch, &scan);
+	ok(access(state_path, F_OK)==0, "TTL 0 never expires");
+
+	/* many more live keys in a shard than are opened per pass */
+	times.actime = times.modtime = time(NULL) - 7200;
+	for (i = 0; i < 40; i++) {
+		sprintf(state_path, "%s/00/01/live%d", plugin_dir, i);
+		_np_state_mkdirs(state_path, TRUE);
+		sprintf(command, "cp var/statefile %s", state_path);
+		rc = system(command);
+		utime(state_path, &times);
+	}
+	sprintf(state_path, "%s/00/01/zz_expired", plugin_dir);
+	fp = fopen(state_path, "w");
+	fprintf(fp, "# NP State file\n# ttl 60\n1\n1\n1234567890\nGone\n");
+	fclose(fp);
+	utime(state_path, &times);
+	sprintf(command, "%s/00/01", plugin_dir);
+	cursor[0] = '\0';
+	removed = 0;
+	for (passes = 0; passes < 10 && !removed; passes++) {
+		batch = NP_STATE_GC_BATCH;
+		scan = NP_STATE_GC_SCAN;
+		removed = _np_state_gc_dir(command, time(NULL), FALSE, cursor, &batch, &scan);
+	}
+	ok(removed==1 && passes <= 6, "Cursor reaches expired state behind live keys in %d passes", passes);
+
+	/* recently written keys are passed over without being opened */
+	times.actime = times.modtime = time(NULL);
+	for (i = 0; i < 40; i++) {
+		sprintf(state_path, "%s/00/01/live%d", plugin_dir, i);
+		utime(state_path, &times);
+	}
+	cursor[0] = '\0';
+	batch = NP_STATE_GC_BATCH;
+	scan = NP_STATE_GC_SCAN;
+	_np_state_gc_dir(command, time(NULL), FALSE, cursor, &batch, &scan);
+	ok(batch==NP_STATE_GC_BATCH && cursor[0]=='\0', "Fresh keys cost no opens");
+
+	/* the cursor is a name, good across processes and with that file gone */
+	sprintf(state_path, "%s/00/01/zz_expired", plugin_dir);
+	fp = fopen(state_path, "w");
+	fprintf(fp, "# NP State file\n# ttl 60\n1\n1\n1234567890\nGone\n");
+	fclose(fp);
+	times.actime = times.modtime = time(NULL) - 7200;
+	utime(state_path, &times);
+	sprintf(state_path, "%s/00/01/live5", plugin_dir);
+	unlink(state_path);
+	strcpy(cursor, "live5");
+	batch = NP_STATE_GC_BATCH;
+	scan = 5;
+	ok(_np_state_gc_dir(command, time(NULL), FALSE, cursor, &batch, &scan)==1 && cursor[0]=='\0',
+	   "Cursor resumes after a removed name");
+
+	/* shard directories do not use up the scan of the plugin directory */
+	for (i = 0; i < 300; i++) {
+		sprintf(state_path, "%s/%02x/%02x/", plugin_dir, i & 0xff, (i >> 8) + 0x80);
+		_np_state_mkdirs(state_path, TRUE);
+	}
+	sprintf(state_path, "%s/zz_legacy", plugin_dir);
+	fp = fopen(state_path, "w");
+	fprintf(fp, "# NP State file\n# ttl 60\n1\n1\n1234567890\nGone\n");
+	fclose(fp);
+	times.actime = times.modtime = time(NULL) - 7200;
+	utime(state_path, &times);
+	cursor[0] = '\0';
+	batch = NP_STATE_GC_BATCH;
+	scan = NP_STATE_GC_SCAN;
+	ok(_np_state_gc_dir(plugin_dir, time(NULL), TRUE, cursor, &batch, &scan)==1,
+	   "Expired legacy file found past the shards");
+
+	sprintf(command, "rm -rf %s", state_dir);
+	rc = system(command);
 	
 
 	/* Don't know how to automatically test this. Need to be able to redefine die and catch the error */
@@ -32,12 +32,19 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <dirent.h>
+#include <utime.h>
 
 #define np_free(ptr) { if(ptr) { free(ptr); ptr = NULL; } }
 
 monitoring_plugin *this_monitoring_plugin=NULL;
 
 int _np_state_read_file(FILE *);
+void _np_state_write(time_t, char *, mode_t);
+void _np_state_shard(const char *, char *);
+int _np_state_mkdirs(char *, int);
+void _np_state_gc(void);
+int _np_state_gc_dir(char *, time_t, int, char *, int *, int *);
 
 void np_init( char *plugin_name, int argc, char **argv ) {
 	if (this_monitoring_plugin==NULL) {
@@ -446,6 +453,7 @@ void np_enable_state(char *keyname, int expected_data_version) {
 	char *temp_filename = NULL;
 	char *temp_keyname = NULL;
 	char *p=NULL;
+	char shard[6];
 	int ret;
 
 	if(this_monitoring_plugin==NULL)
@@ -474,39 +482,75 @@ void np_enable_state(char *keyname, int expected_data_version) {
 	this_state->name=temp_keyname;
 	this_state->plugin_name=this_monitoring_plugin->plugin_name;
 	this_state->data_version=expected_data_version;
+	this_state->ttl=NP_STATE_DEFAULT_TTL;
 	this_state->state_data=NULL;
 
 	/* Calculate filename */
-	ret = asprintf(&temp_filename, "%s/%lu/%s/%s",
+	ret = asprintf(&this_state->_directory, "%s/%lu/%s",
 	    _np_state_calculate_location_prefix(), (unsigned long)geteuid(),
-	    this_monitoring_plugin->plugin_name, this_state->name);
+	    this_monitoring_plugin->plugin_name);
 	if (ret < 0)
 		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
 		    strerror(errno));
+	_np_state_shard(this_state->name, shard);
+	if (asprintf(&temp_filename, "%s/%s/%s", this_state->_directory, shard, this_state->name) < 0 ||
+	    asprintf(&this_state->_legacy_filename, "%s/%s", this_state->_directory, this_state->name) < 0)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+		    strerror(errno));
 
 	this_state->_filename=temp_filename;
 
 	this_monitoring_plugin->state = this_state;
 }
 
+/*
+ * Shard of a key: "xx/yy" from the first two bytes of its sha1, into a
+ * buffer of at least 6 chars
+ */
+void _np_state_shard(const char *keyname, char *shard) {
+	unsigned char result[20];
+
+	sha1_buffer(keyname, strlen(keyname), result);
+	sprintf(shard, "%02x/%02x", result[0], result[1]);
+}
+
 /*
  * Will return NULL if no data is available (first run). If key currently
  * exists, read data. If state file format version is not expected, return
  * as if no data. Get state data version number and compares to expected.
  * If numerically lower, then return as no previous state. die with UNKNOWN
- * if exceptional error.
+ * if exceptional error. A file left in the unsharded place by an older
+ * release is moved to its shard first. Reading counts as access for the
+ * TTL, so state that is only read does not expire.
  */
 state_data *np_state_read() {
 	state_data *this_state_data=NULL;
+	state_key *this_state;
 	FILE *statefile;
+	struct stat st;
+	time_t current_time;
 	int rc = FALSE;
 
 	if(this_monitoring_plugin==NULL)
 		die(STATE_UNKNOWN, _("This requires np_init to be called"));
+	this_state = this_monitoring_plugin->state;
 
 	/* Open file. If this fails, no previous state found */
-	statefile = fopen( this_monitoring_plugin->state->_filename, "r" );
+	statefile = fopen( this_state->_filename, "r" );
+	if(statefile==NULL && errno==ENOENT && this_state->_legacy_filename!=NULL &&
+	   access(this_state->_legacy_filename, F_OK)==0) {
+		if(_np_state_mkdirs(this_state->_filename, FALSE)==OK &&
+		   rename(this_state->_legacy_filename, this_state->_filename)==0)
+			statefile = fopen( this_state->_filename, "r" );
+		else
+			statefile = fopen( this_state->_legacy_filename, "r" );
+	}
 	if(statefile!=NULL) {
+		/* the mtime is the last access, refreshed well before it runs out */
+		time(&current_time);
+		if(this_state->ttl > 0 && fstat(fileno(statefile), &st)==0 &&
+		   st.st_mtime < current_time - this_state->ttl / 4)
+			utime(this_state->_filename, NULL);
 
 		this_state_data = (state_data *) calloc(1, sizeof(state_data));
 		if(this_state_data==NULL)
@@ -533,7 +577,7 @@ state_data *np_state_read() {
  */
 int _np_state_read_file(FILE *f) {
 	int status=FALSE;
-	size_t pos;
+	size_t pos, line_size;
 	char *line;
 	int i;
 	int failure=0;
@@ -542,14 +586,25 @@ int _np_state_read_file(FILE *f) {
 
 	time(&current_time);
 
-	/* Note: This introduces a limit of 1024 bytes in the string data */
-	line = (char *) calloc(1, 1024);
+	/* The buffer grows for data lines longer than 1024 bytes */
+	line_size = 1024;
+	line = (char *) calloc(1, line_size);
 	if(line==NULL)
 		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
 		    strerror(errno));
 
-	while(!failure && (fgets(line,1024,f))!=NULL){
+	while(!failure && (fgets(line,line_size,f))!=NULL){
 		pos=strlen(line);
+		while(line[pos-1]!='\n' && pos==line_size-1) {
+			line_size *= 2;
+			line = (char *) realloc(line, line_size);
+			if(line==NULL)
+				die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+				    strerror(errno));
+			if(fgets(line+pos,line_size-pos,f)==NULL)
+				break;
+			pos+=strlen(line+pos);
+		}
 		if(line[pos-1]=='\n') {
 			line[pos-1]='\0';
 		}
@@ -605,12 +660,22 @@ int _np_state_read_file(FILE *f) {
  * Will die with UNKNOWN if errors
  */
 void np_state_write_string(time_t data_time, char *data_string) {
+	_np_state_write(data_time, data_string, S_IRUSR | S_IWUSR | S_IRGRP);
+}
+
+/*
+ * As np_state_write_string, but only the owner may read the file. For
+ * state that is as good as a password, such as derived keys.
+ */
+void np_state_write_private_string(time_t data_time, char *data_string) {
+	_np_state_write(data_time, data_string, S_IRUSR | S_IWUSR);
+}
+
+void _np_state_write(time_t data_time, char *data_string, mode_t mode) {
 	FILE *fp;
 	char *temp_file=NULL;
 	int fd=0, result=0;
 	time_t current_time;
-	char *directories=NULL;
-	char *p=NULL;
 
 	if(data_time==0)
 		time(&current_time);
@@ -618,25 +683,8 @@ void np_state_write_string(time_t data_time, char *data_string) {
 		current_time=data_time;
 	
 	/* If file doesn't currently exist, create directories */
-	if(access(this_monitoring_plugin->state->_filename,F_OK)!=0) {
-		result = asprintf(&directories, "%s", this_monitoring_plugin->state->_filename);
-		if(result < 0)
-			die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
-			    strerror(errno));
-
-		for(p=directories+1; *p; p++) {
-			if(*p=='/') {
-				*p='\0';
-				if((access(directories,F_OK)!=0) && (mkdir(directories, S_IRWXU)!=0)) {
-					/* Can't free this! Otherwise error message is wrong! */
-					/* np_free(directories); */
-					die(STATE_UNKNOWN, _("Cannot create directory: %s"), directories);
-				}
-				*p='/';
-			}
-		}
-		np_free(directories);
-	}
+	if(access(this_monitoring_plugin->state->_filename,F_OK)!=0)
+		_np_state_mkdirs(this_monitoring_plugin->state->_filename, TRUE);
 
 	result = asprintf(&temp_file,"%s.XXXXXX",this_monitoring_plugin->state->_filename);
 	if(result < 0)
@@ -657,12 +705,14 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	}
 	
 	fprintf(fp,"# NP State file\n");
+	/* a comment, so older releases still read the file */
+	fprintf(fp,"# ttl %d\n",this_monitoring_plugin->state->ttl);
 	fprintf(fp,"%d\n",NP_STATE_FORMAT_VERSION);
 	fprintf(fp,"%d\n",this_monitoring_plugin->state->data_version);
 	fprintf(fp,"%lu\n",current_time);
 	fprintf(fp,"%s\n",data_string);
 	
-	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP);
+	fchmod(fd, mode);
 	
 	fflush(fp);
 
@@ -683,5 +733,219 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	}
 
 	np_free(temp_file);
+
+	_np_state_gc();
+}
+
+/*
+ * Sets the TTL of the enabled state, in seconds, for the next write. 0
+ * keeps the file until it is removed by hand.
+ */
+void np_state_set_ttl(int ttl) {
+	if(this_monitoring_plugin==NULL || this_monitoring_plugin->state==NULL)
+		die(STATE_UNKNOWN, _("This requires np_enable_state to be called"));
+	this_monitoring_plugin->state->ttl = ttl < 0 ? 0 : ttl;
+}
+
+/*
+ * Creates the missing directories leading to a file. If one cannot be
+ * created, die with UNKNOWN if fatal, otherwise return ERROR.
+ */
+int _np_state_mkdirs(char *filename, int fatal) {
+	char *directories=NULL;
+	char *p=NULL;
+
+	directories = strdup(filename);
+	if(directories==NULL)
+		die(STATE_UNKNOWN, _("Cannot execute strdup: %s"), strerror(errno));
+
+	for(p=directories+1; *p; p++) {
+		if(*p=='/') {
+			*p='\0';
+			if((access(directories,F_OK)!=0) && (mkdir(directories, S_IRWXU)!=0)) {
+				if(!fatal) {
+					np_free(directories);
+					return ERROR;
+				}
+				/* Can't free this! Otherwise error message is wrong! */
+				/* np_free(directories); */
+				die(STATE_UNKNOWN, _("Cannot create directory: %s"), directories);
+			}
+			*p='/';
+		}
+	}
+	np_free(directories);
+	return OK;
+}
+
+/*
+ * Incremental garbage collection, run after each write. A cursor kept in
+ * <plugin>/.gc walks the shards in turn, and through the plugin directory
+ * itself, where files of older releases are either expired or moved to
+ * their shard. Each write only does a bounded amount of work and carries
+ * on where the previous one stopped. The cursor holds the shard and the
+ * last file name handled in it and in the plugin directory, or - for none.
+ */
+void _np_state_gc(void) {
+	char *directory=NULL, *cursor_file=NULL;
+	char shard_name[NP_STATE_GC_NAME]="", legacy_name[NP_STATE_GC_NAME]="";
+	unsigned int shard;
+	int batch=NP_STATE_GC_BATCH, scan=NP_STATE_GC_SCAN, i;
+	time_t current_time;
+	FILE *fp;
+
+	if(this_monitoring_plugin->state->_directory==NULL)
+		return;
+	time(&current_time);
+	if(asprintf(&cursor_file, "%s/.gc", this_monitoring_plugin->state->_directory) < 0)
+		return;
+
+	/* a lost cursor starts over at a random shard */
+	shard = ((unsigned int)current_time ^ (unsigned int)getpid()) * 2654435761U >> 16;
+	if((fp=fopen(cursor_file, "r"))!=NULL) {
+		if(fscanf(fp, "%u %255s %255s", &shard, shard_name, legacy_name)!=3)
+			shard_name[0]=legacy_name[0]='\0';
+		fclose(fp);
+		if(strcmp(shard_name, "-")==0)
+			shard_name[0]='\0';
+		if(strcmp(legacy_name, "-")==0)
+			legacy_name[0]='\0';
+	}
+
+	/* missing or finished shards cost little, so a few are visited */
+	for(i=0; i<NP_STATE_GC_SHARDS && batch > 0 && scan > 0; i++) {
+		shard &= 0xffff;
+		if(asprintf(&directory, "%s/%02x/%02x", this_monitoring_plugin->state->_directory,
+		            shard >> 8, shard & 0xff) < 0)
+			break;
+		_np_state_gc_dir(directory, current_time, FALSE, shard_name, &batch, &scan);
+		np_free(directory);
+		if(shard_name[0]!='\0')
+			break;
+		shard++;
+	}
+
+	batch=NP_STATE_GC_BATCH;
+	scan=NP_STATE_GC_SCAN;
+	_np_state_gc_dir(this_monitoring_plugin->state->_directory, current_time, TRUE,
+	                 legacy_name, &batch, &scan);
+
+	/* writers racing here at worst repeat or skip a few entries */
+	if((fp=fopen(cursor_file, "w"))!=NULL) {
+		fprintf(fp, "%u %s %s\n", shard & 0xffff, shard_name[0] ? shard_name : "-",
+		        legacy_name[0] ? legacy_name : "-");
+		fclose(fp);
+	}
+	np_free(cursor_file);
+}
+
+/*
+ * Removes the expired state files of a directory. The names are taken in
+ * sorted order, from the first one after cursor on, and cursor is set to
+ * the last one handled, or emptied at the end. Unlike a telldir() position
+ * a name stays valid across processes and changes to the directory. Regular
+ * files use up scan, those opened or removed batch as well; files changed
+ * within NP_STATE_GC_MIN_AGE are passed over unopened. Only files named
+ * like a key, with the state header, or temporary files of a key are
+ * touched. The TTL is the one of the header or the default, counted from
+ * the last change. With legacy, the files still alive are moved to their
+ * shard. Returns the number of files removed.
+ */
+int _np_state_gc_dir(char *directory, time_t current_time, int legacy, char *cursor,
+                     int *batch, int *scan) {
+	struct dirent **entries=NULL, *entry;
+	struct stat st;
+	FILE *fp;
+	char *path=NULL, *target=NULL, *p;
+	char line[64], shard[6];
+	int removed=0, ttl, temporary, count, i;
+
+	if((count=scandir(directory, &entries, NULL, alphasort)) < 0) {
+		cursor[0]='\0';
+		return 0;
+	}
+
+	for(i=0; i<count && *batch > 0 && *scan > 0; i++) {
+		entry=entries[i];
+		if(strcmp(entry->d_name, cursor) <= 0)
+			continue;
+		if(strlen(entry->d_name) < NP_STATE_GC_NAME)
+			strcpy(cursor, entry->d_name);
+		/* keys are alphanumerics or '_', temporary files add .XXXXXX */
+		for(p=entry->d_name; isalnum(*p) || *p=='_'; p++)
+			;
+		temporary = (*p=='.' && strlen(p)==7);
+		if(p==entry->d_name || (*p!='\0' && !temporary))
+			continue;
+#ifdef DT_DIR
+		/* the shards, in the plugin directory */
+		if(entry->d_type==DT_DIR)
+			continue;
+#endif
+
+		if(asprintf(&path, "%s/%s", directory, entry->d_name) < 0)
+			break;
+		if(strcmp(path, this_monitoring_plugin->state->_filename)==0 ||
+		   lstat(path, &st)!=0 || !S_ISREG(st.st_mode)) {
+			np_free(path);
+			continue;
+		}
+		(*scan)--;
+
+		if(temporary) {
+			if(st.st_mtime + NP_STATE_DEFAULT_TTL < current_time && unlink(path)==0) {
+				removed++;
+				(*batch)--;
+			}
+			np_free(path);
+			continue;
+		}
+		/* too recent to have expired, and older releases wrote none */
+		if(!legacy && st.st_mtime > current_time - NP_STATE_GC_MIN_AGE) {
+			np_free(path);
+			continue;
+		}
+
+		(*batch)--;
+		if((fp=fopen(path, "r"))==NULL) {
+			np_free(path);
+			continue;
+		}
+		ttl = NP_STATE_DEFAULT_TTL;
+		if(fgets(line, sizeof(line), fp)==NULL || strcmp(line, "# NP State file\n")!=0) {
+			fclose(fp);
+			np_free(path);
+			continue;
+		}
+		if(fgets(line, sizeof(line), fp)!=NULL)
+			sscanf(line, "# ttl %d", &ttl);
+		fclose(fp);
+
+		if(ttl > 0 && st.st_mtime + (time_t)ttl < current_time &&
+		   st.st_mtime <= current_time - NP_STATE_GC_MIN_AGE) {
+			if(unlink(path)==0)
+				removed++;
+		}
+		else if(legacy) {
+			_np_state_shard(entry->d_name, shard);
+			if(asprintf(&target, "%s/%s/%s", directory, shard, entry->d_name) >= 0) {
+				/* a newer file already in the shard wins */
+				if(access(target, F_OK)==0)
+					unlink(path);
+				else if(_np_state_mkdirs(target, FALSE)==OK)
+					rename(path, target);
+				np_free(target);
+			}
+		}
+		np_free(path);
+	}
+
+	/* all handled, the next pass starts over */
+	if(i==count)
+		cursor[0]='\0';
+	for(i=0; i<count; i++)
+		free(entries[i]);
+	free(entries);
+	return removed;
 }
 
@@ -32,6 +32,19 @@ typedef struct thresholds_struct {
 
 #define NP_STATE_FORMAT_VERSION 1
 
+/*
+ * State files live in <plugin>/<xx>/<yy>/<key>, xx and yy from a hash of the
+ * key. A file nobody read or wrote for its TTL is removed by the writes of
+ * other keys, a few files per write, but not within NP_STATE_GC_MIN_AGE of
+ * its last change.
+ */
+#define NP_STATE_DEFAULT_TTL 2592000 /* 30 days */
+#define NP_STATE_GC_BATCH 8          /* files opened per write */
+#define NP_STATE_GC_SCAN 256         /* files stat()ed per write */
+#define NP_STATE_GC_SHARDS 16        /* shards visited per write at most */
+#define NP_STATE_GC_MIN_AGE 3600     /* nothing younger is removed */
+#define NP_STATE_GC_NAME 256         /* room for a file name in the cursor */
+
 typedef struct state_data_struct {
 	time_t	time;
 	void	*data;
@@ -44,6 +57,9 @@ typedef struct state_key_struct {
 	char       *plugin_name;
 	int        data_version;
 	char       *_filename;
+	char       *_directory;        /* of the plugin, where the shards are */
+	char       *_legacy_filename;  /* unsharded name of older releases */
+	int        ttl;                /* seconds, 0 never expires */
 	state_data *state_data;
 	} state_key;
 
@@ -103,6 +119,8 @@ int mp_translate_state (char *);
 void np_enable_state(char *, int);
 state_data *np_state_read();
 void np_state_write_string(time_t, char *);
+void np_state_write_private_string(time_t, char *);
+void np_state_set_ttl(int);
 
 void np_init(char *, int argc, char **argv);
 void np_set_args(int argc, char **argv);
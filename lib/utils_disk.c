@@ -28,6 +28,15 @@
 
 #include "common.h"
 #include "utils_disk.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+# include <sys/syscall.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
 
 void
 np_add_name (struct name_list **list, const char *name)
@@ -56,6 +65,7 @@ np_add_parameter(struct parameter_list **list, const char *name)
   new_path->usedspace_units = NULL;
   new_path->usedspace_percent = NULL;
   new_path->usedinodes_percent = NULL;
+  new_path->usedinodes_count = NULL;
   new_path->freeinodes_percent = NULL;
   new_path->group = NULL;
   new_path->dfree_pct = -1;
@@ -195,3 +205,534 @@ np_regex_match_mount_entry (struct mount_entry* me, regex_t* re)
   }
 }
 
+
+
+/*
+ * Directory usage walker for check_disk --du.
+ *
+ * The top directory is read first by the calling thread; every subdirectory
+ * found below it becomes a work item. Workers own a deque of items: they
+ * push and pop at the bottom (depth first, keeps the working set small) and
+ * steal from the top of the other deques when their own runs dry. Entries
+ * are stat()ed with fstatat () relative to the directory being read, which
+ * is read with getdents64 and a large buffer on Linux. Files with more than
+ * one link go through a striped inode set so each is counted once.
+ */
+
+#ifdef HAVE_LIBPTHREAD
+typedef pthread_mutex_t du_lock_t;
+# define du_lock_init(l)	pthread_mutex_init ((l), NULL)
+# define du_lock(l)		pthread_mutex_lock (l)
+# define du_unlock(l)		pthread_mutex_unlock (l)
+#else
+typedef int du_lock_t;
+# define du_lock_init(l)	(*(l) = 0)
+# define du_lock(l)
+# define du_unlock(l)
+#endif
+
+#define DU_READ_BUFFER (256 * 1024)
+#define DU_INODE_STRIPES 64
+
+#if defined(__linux__) && defined(SYS_getdents64)
+# define DU_GETDENTS64
+struct du_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+struct du_work
+{
+  char *path;
+  size_t subdir;		/* index into tree->subdirs */
+};
+
+struct du_deque
+{
+  du_lock_t lock;
+  struct du_work *items;
+  size_t top, bottom, size;
+};
+
+struct du_inode_stripe
+{
+  du_lock_t lock;
+  ino_t *slots;			/* open addressing, 0 marks a free slot */
+  size_t size, used;
+};
+
+struct du_walk
+{
+  struct du_tree *tree;
+  dev_t dev;
+  int threads;
+  struct du_deque *deques;
+  du_lock_t state_lock;		/* protects queued and pending */
+#ifdef HAVE_LIBPTHREAD
+  pthread_cond_t idle;
+#endif
+  size_t queued;		/* items sitting in a deque */
+  size_t pending;		/* queued plus being read */
+  du_lock_t stats_lock;		/* protects the usage in tree */
+  struct du_inode_stripe stripes[DU_INODE_STRIPES];
+};
+
+struct du_worker
+{
+  struct du_walk *walk;
+  int id;
+};
+
+/* Open directory read with getdents64 where available, readdir otherwise */
+struct du_dir
+{
+  int fd;
+#ifdef DU_GETDENTS64
+  char *buf;
+  long len, pos;
+#else
+  DIR *dir;
+#endif
+};
+
+static const char *
+du_next_name (struct du_dir *d)
+{
+#ifdef DU_GETDENTS64
+  struct du_dirent64 *entry;
+
+  if (d->pos >= d->len) {
+    d->len = syscall (SYS_getdents64, d->fd, d->buf, DU_READ_BUFFER);
+    d->pos = 0;
+    if (d->len <= 0)
+      return NULL;
+  }
+  entry = (struct du_dirent64 *) (d->buf + d->pos);
+  d->pos += entry->d_reclen;
+  return entry->d_name;
+#else
+  struct dirent *entry;
+
+  if (d->dir == NULL) {
+    if ((d->dir = fdopendir (dup (d->fd))) == NULL)
+      return NULL;
+  }
+  entry = readdir (d->dir);
+  return entry ? entry->d_name : NULL;
+#endif
+}
+
+static void
+du_close_dir (struct du_dir *d)
+{
+#ifndef DU_GETDENTS64
+  if (d->dir)
+    closedir (d->dir);
+  d->dir = NULL;
+#endif
+  close (d->fd);
+}
+
+/* Returns TRUE if the inode was seen before, records it otherwise */
+static int
+du_inode_seen (struct du_walk *w, ino_t ino)
+{
+  struct du_inode_stripe *stripe;
+  ino_t *old_slots;
+  size_t old_size, i, slot;
+  uintmax_t hash;
+  int seen = FALSE;
+
+  if (ino == 0)
+    return FALSE;
+
+  hash = (uintmax_t) ino * 0x9E3779B97F4A7C15ULL;
+  stripe = &w->stripes[(hash >> 58) % DU_INODE_STRIPES];
+
+  du_lock (&stripe->lock);
+  if (2 * (stripe->used + 1) > stripe->size) {
+    old_slots = stripe->slots;
+    old_size = stripe->size;
+    stripe->size = old_size ? 2 * old_size : 256;
+    stripe->slots = calloc (stripe->size, sizeof (ino_t));
+    if (stripe->slots == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    for (i = 0; i < old_size; i++) {
+      if (old_slots[i] == 0)
+        continue;
+      slot = ((uintmax_t) old_slots[i] * 0x9E3779B97F4A7C15ULL) % stripe->size;
+      while (stripe->slots[slot])
+        slot = (slot + 1) % stripe->size;
+      stripe->slots[slot] = old_slots[i];
+    }
+    free (old_slots);
+  }
+  for (slot = hash % stripe->size; stripe->slots[slot]; slot = (slot + 1) % stripe->size) {
+    if (stripe->slots[slot] == ino) {
+      seen = TRUE;
+      break;
+    }
+  }
+  if (!seen) {
+    stripe->slots[slot] = ino;
+    stripe->used++;
+  }
+  du_unlock (&stripe->lock);
+
+  return seen;
+}
+
+static void
+du_error (struct du_walk *w, const char *path, const char *name)
+{
+  du_lock (&w->stats_lock);
+  if (w->tree->errors++ == 0) {
+    if (name)
+      asprintf (&w->tree->error, "%s/%s: %s", path, name, strerror (errno));
+    else
+      asprintf (&w->tree->error, "%s: %s", path, strerror (errno));
+  }
+  du_unlock (&w->stats_lock);
+}
+
+static void
+du_push (struct du_walk *w, int id, char *path, size_t subdir)
+{
+  struct du_deque *q = &w->deques[id];
+
+  du_lock (&q->lock);
+  if (q->bottom == q->size) {
+    if (q->top > 0) {
+      memmove (q->items, q->items + q->top, (q->bottom - q->top) * sizeof (struct du_work));
+      q->bottom -= q->top;
+      q->top = 0;
+    }
+    if (q->bottom == q->size) {
+      q->size = q->size ? 2 * q->size : 64;
+      q->items = realloc (q->items, q->size * sizeof (struct du_work));
+      if (q->items == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    }
+  }
+  q->items[q->bottom].path = path;
+  q->items[q->bottom].subdir = subdir;
+  q->bottom++;
+  du_unlock (&q->lock);
+
+  du_lock (&w->state_lock);
+  w->queued++;
+  w->pending++;
+#ifdef HAVE_LIBPTHREAD
+  pthread_cond_signal (&w->idle);
+#endif
+  du_unlock (&w->state_lock);
+}
+
+/* Own deque from the bottom, then the others from the top */
+static int
+du_take (struct du_walk *w, int id, struct du_work *item)
+{
+  struct du_deque *q;
+  int i, found = FALSE;
+
+  q = &w->deques[id];
+  du_lock (&q->lock);
+  if (q->bottom > q->top) {
+    *item = q->items[--q->bottom];
+    found = TRUE;
+  }
+  du_unlock (&q->lock);
+
+  for (i = 1; !found && i < w->threads; i++) {
+    q = &w->deques[(id + i) % w->threads];
+    du_lock (&q->lock);
+    if (q->bottom > q->top) {
+      *item = q->items[q->top++];
+      found = TRUE;
+    }
+    du_unlock (&q->lock);
+  }
+
+  if (found) {
+    du_lock (&w->state_lock);
+    w->queued--;
+    du_unlock (&w->state_lock);
+  }
+  return found;
+}
+
+/* Read one directory below the top one and queue its subdirectories */
+static void
+du_scan (struct du_walk *w, int id, struct du_work *item)
+{
+  struct du_dir d;
+  struct du_usage usage = { 0, 0 };
+  struct stat st;
+  const char *name;
+  char *path;
+
+  d.fd = open (item->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  if (d.fd < 0) {
+    if (errno != ENOENT)
+      du_error (w, item->path, NULL);
+    return;
+  }
+#ifdef DU_GETDENTS64
+  d.buf = malloc (DU_READ_BUFFER);
+  if (d.buf == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+  d.len = d.pos = 0;
+#else
+  d.dir = NULL;
+#endif
+
+  while ((name = du_next_name (&d)) != NULL) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+    if (fstatat (d.fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      if (errno != ENOENT)
+        du_error (w, item->path, name);
+      continue;
+    }
+    /* like du -x: other file systems mounted below are not counted */
+    if (st.st_dev != w->dev)
+      continue;
+    if (!S_ISDIR (st.st_mode) && st.st_nlink > 1 && du_inode_seen (w, st.st_ino))
+      continue;
+    usage.inodes++;
+    usage.bytes += (uintmax_t) st.st_blocks * 512;
+    if (S_ISDIR (st.st_mode)) {
+      if (asprintf (&path, "%s/%s", item->path, name) < 0)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+      du_push (w, id, path, item->subdir);
+    }
+  }
+#ifdef DU_GETDENTS64
+  free (d.buf);
+#endif
+  du_close_dir (&d);
+
+  du_lock (&w->stats_lock);
+  w->tree->subdirs[item->subdir].usage.bytes += usage.bytes;
+  w->tree->subdirs[item->subdir].usage.inodes += usage.inodes;
+  du_unlock (&w->stats_lock);
+}
+
+static void *
+du_worker (void *arg)
+{
+  struct du_worker *self = arg;
+  struct du_walk *w = self->walk;
+  struct du_work item;
+  int done;
+
+  while (1) {
+    if (du_take (w, self->id, &item)) {
+      du_scan (w, self->id, &item);
+      free (item.path);
+      du_lock (&w->state_lock);
+#ifdef HAVE_LIBPTHREAD
+      if (--w->pending == 0)
+        pthread_cond_broadcast (&w->idle);
+#else
+      w->pending--;
+#endif
+      du_unlock (&w->state_lock);
+      continue;
+    }
+
+    du_lock (&w->state_lock);
+#ifdef HAVE_LIBPTHREAD
+    while (w->queued == 0 && w->pending > 0)
+      pthread_cond_wait (&w->idle, &w->state_lock);
+#endif
+    done = w->pending == 0;
+    du_unlock (&w->state_lock);
+    if (done)
+      return NULL;
+  }
+}
+
+static int
+du_compare_name (const void *a, const void *b)
+{
+  return strcmp ((*(const struct du_subdir **) a)->name, (*(const struct du_subdir **) b)->name);
+}
+
+static int
+du_compare_size (const void *a, const void *b)
+{
+  const struct du_subdir *x = a, *y = b;
+
+  if (x->usage.bytes != y->usage.bytes)
+    return x->usage.bytes < y->usage.bytes ? 1 : -1;
+  return strcmp (x->name, y->name);
+}
+
+/*
+ * Walk tree->path with the given number of threads. Subdirectories of the
+ * top directory whose mtime and ctime match an entry of cache are not
+ * walked; the cached usage is used instead. Returns ERROR if the top
+ * directory cannot be read (tree->error says why), OK otherwise.
+ */
+int
+np_du_walk (struct du_tree *tree, int threads, const struct du_subdir *cache, size_t cache_count)
+{
+  struct du_walk w;
+  struct du_dir d;
+  struct du_worker *workers;
+  struct du_subdir key, *key_ptr, **sorted = NULL, **hit, *sub;
+  struct stat st;
+  const char *name;
+  char *path;
+  size_t i, allocated = 0;
+  int next = 0;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t *ids;
+#endif
+
+  memset (&w, 0, sizeof (w));
+  tree->total.bytes = tree->total.inodes = 0;
+  tree->subdirs = NULL;
+  tree->subdir_count = 0;
+  tree->errors = 0;
+  tree->error = NULL;
+
+#ifndef HAVE_LIBPTHREAD
+  threads = 1;
+#endif
+  w.tree = tree;
+  w.threads = threads < 1 ? 1 : threads;
+  du_lock_init (&w.state_lock);
+  du_lock_init (&w.stats_lock);
+#ifdef HAVE_LIBPTHREAD
+  pthread_cond_init (&w.idle, NULL);
+#endif
+  for (i = 0; i < DU_INODE_STRIPES; i++)
+    du_lock_init (&w.stripes[i].lock);
+  w.deques = calloc (w.threads, sizeof (struct du_deque));
+  workers = calloc (w.threads, sizeof (struct du_worker));
+  if (w.deques == NULL || workers == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+  for (i = 0; i < (size_t) w.threads; i++) {
+    du_lock_init (&w.deques[i].lock);
+    workers[i].walk = &w;
+    workers[i].id = i;
+  }
+
+  if (cache_count) {
+    sorted = malloc (cache_count * sizeof (struct du_subdir *));
+    if (sorted == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    for (i = 0; i < cache_count; i++)
+      sorted[i] = (struct du_subdir *) &cache[i];
+    qsort (sorted, cache_count, sizeof (struct du_subdir *), du_compare_name);
+  }
+
+  /* The top directory itself, read by this thread */
+  d.fd = open (tree->path, O_RDONLY | O_DIRECTORY);
+  if (d.fd < 0 || fstat (d.fd, &st) != 0) {
+    asprintf (&tree->error, "%s: %s", tree->path, strerror (errno));
+    return ERROR;
+  }
+  w.dev = st.st_dev;
+  tree->total.inodes = 1;
+  tree->total.bytes = (uintmax_t) st.st_blocks * 512;
+#ifdef DU_GETDENTS64
+  d.buf = malloc (DU_READ_BUFFER);
+  if (d.buf == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+  d.len = d.pos = 0;
+#else
+  d.dir = NULL;
+#endif
+
+  while ((name = du_next_name (&d)) != NULL) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+    if (fstatat (d.fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      if (errno != ENOENT)
+        du_error (&w, tree->path, name);
+      continue;
+    }
+    if (st.st_dev != w.dev)
+      continue;
+    if (!S_ISDIR (st.st_mode)) {
+      if (st.st_nlink > 1 && du_inode_seen (&w, st.st_ino))
+        continue;
+      tree->total.inodes++;
+      tree->total.bytes += (uintmax_t) st.st_blocks * 512;
+      continue;
+    }
+
+    if (tree->subdir_count == allocated) {
+      allocated = allocated ? 2 * allocated : 64;
+      tree->subdirs = realloc (tree->subdirs, allocated * sizeof (struct du_subdir));
+      if (tree->subdirs == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    }
+    sub = &tree->subdirs[tree->subdir_count];
+    sub->name = strdup (name);
+    sub->mtime = st.st_mtime;
+    sub->ctime = st.st_ctime;
+    sub->usage.inodes = 1;
+    sub->usage.bytes = (uintmax_t) st.st_blocks * 512;
+    sub->cached = FALSE;
+
+    key.name = sub->name;
+    key_ptr = &key;
+    hit = sorted ? bsearch (&key_ptr, sorted, cache_count, sizeof (struct du_subdir *), du_compare_name) : NULL;
+    if (hit && (*hit)->mtime == sub->mtime && (*hit)->ctime == sub->ctime) {
+      sub->usage = (*hit)->usage;
+      sub->cached = TRUE;
+    } else {
+      if (asprintf (&path, "%s/%s", tree->path, name) < 0)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+      /* spread the first level over the workers, they steal the rest */
+      du_push (&w, next, path, tree->subdir_count);
+      next = (next + 1) % w.threads;
+    }
+    tree->subdir_count++;
+  }
+#ifdef DU_GETDENTS64
+  free (d.buf);
+#endif
+  du_close_dir (&d);
+
+#ifdef HAVE_LIBPTHREAD
+  if (w.threads > 1) {
+    ids = calloc (w.threads, sizeof (pthread_t));
+    if (ids == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    for (i = 1; i < (size_t) w.threads; i++)
+      if (pthread_create (&ids[i], NULL, du_worker, &workers[i]) != 0)
+        die (STATE_UNKNOWN, _("Cannot create thread: %s"), strerror (errno));
+    du_worker (&workers[0]);
+    for (i = 1; i < (size_t) w.threads; i++)
+      pthread_join (ids[i], NULL);
+    free (ids);
+  } else
+#endif
+    du_worker (&workers[0]);
+
+  for (i = 0; i < tree->subdir_count; i++) {
+    tree->total.bytes += tree->subdirs[i].usage.bytes;
+    tree->total.inodes += tree->subdirs[i].usage.inodes;
+  }
+  if (tree->subdir_count)
+    qsort (tree->subdirs, tree->subdir_count, sizeof (struct du_subdir), du_compare_size);
+
+  for (i = 0; i < (size_t) w.threads; i++)
+    free (w.deques[i].items);
+  for (i = 0; i < DU_INODE_STRIPES; i++)
+    free (w.stripes[i].slots);
+  free (w.deques);
+  free (workers);
+  free (sorted);
+  return OK;
+}
@@ -20,6 +20,7 @@ struct parameter_list
   thresholds *usedspace_units;
   thresholds *usedspace_percent;
   thresholds *usedinodes_percent;
+  thresholds *usedinodes_count;
   thresholds *freeinodes_percent;
   char *group;
   struct mount_entry *best_match;
@@ -30,6 +31,31 @@ struct parameter_list
   double dused_inodes_percent, dfree_inodes_percent;
 };
 
+/* Directory usage of one tree, filled in by np_du_walk () */
+struct du_usage
+{
+  uintmax_t bytes;		/* allocated bytes, hard links counted once */
+  uintmax_t inodes;
+};
+
+struct du_subdir
+{
+  char *name;
+  time_t mtime, ctime;
+  struct du_usage usage;	/* includes the subdirectory itself */
+  int cached;			/* usage taken from the cache, tree not walked */
+};
+
+struct du_tree
+{
+  const char *path;
+  struct du_usage total;
+  struct du_subdir *subdirs;	/* immediate subdirectories, largest first */
+  size_t subdir_count;
+  unsigned long errors;		/* entries that could not be read */
+  char *error;			/* description of the first one */
+};
+
 void np_add_name (struct name_list **list, const char *name);
 int np_find_name (struct name_list *list, const char *name);
 int np_seen_name (struct name_list *list, const char *name);
@@ -40,3 +66,4 @@ struct parameter_list *np_del_parameter(struct parameter_list *item, struct para
 int search_parameter_list (struct parameter_list *list, const char *name);
 void np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list, int exact);
 int np_regex_match_mount_entry (struct mount_entry* me, regex_t* re);
+int np_du_walk (struct du_tree *tree, int threads, const struct du_subdir *cache, size_t cache_count);
@@ -0,0 +1,272 @@
+/*****************************************************************************
+*
+* Monitoring Plugins rolling time series
+*
+* License: GPL
+* Copyright (c) 2024 Monitoring Plugins Development Team
+*
+* Description :
+*
+* A fixed size ring of (time, value) samples stored through the state
+* routines of utils_base.c, one state file per series. The data line holds
+* the time of the oldest sample followed by "delta:value" pairs, each delta
+* counted from the sample before, so a sample costs a few bytes and the
+* whole series is one line. Values are kept as floats.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_series.h"
+#include <math.h>
+
+extern monitoring_plugin *this_monitoring_plugin;
+char *_np_state_generate_key();
+
+typedef struct {
+	int	count;
+	int	head;		/* slot the next sample goes to */
+	time_t	time[NP_SERIES_CAPACITY];
+	float	value[NP_SERIES_CAPACITY];
+	} series;
+
+/* the i-th oldest sample */
+#define SERIES_SLOT(s, i) \
+	(((s)->head - (s)->count + (i) + NP_SERIES_CAPACITY) % NP_SERIES_CAPACITY)
+
+static void
+series_add (series *s, time_t t, double value)
+{
+	s->time[s->head] = t;
+	s->value[s->head] = value;
+	s->head = (s->head + 1) % NP_SERIES_CAPACITY;
+	if (s->count < NP_SERIES_CAPACITY)
+		s->count++;
+}
+
+/*
+ * Switch the state routines over to the file of this series and return
+ * the state that was enabled before, to be put back by series_leave()
+ */
+static state_key *
+series_enter (char *key)
+{
+	state_key *saved;
+	char *generated = NULL, *name = NULL;
+
+	if (this_monitoring_plugin == NULL)
+		die(STATE_UNKNOWN, _("This requires np_init to be called"));
+	saved = this_monitoring_plugin->state;
+
+	if (key == NULL)
+		key = generated = _np_state_generate_key();
+	/* keeps the series apart from the plugin's own state */
+	if (asprintf(&name, "series_%s", key) < 0)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror(errno));
+	np_enable_state(name, NP_SERIES_DATA_VERSION);
+	free(name);
+	free(generated);
+	return saved;
+}
+
+static void
+series_leave (state_key *saved)
+{
+	state_key *this_state = this_monitoring_plugin->state;
+
+	if (this_state->state_data) {
+		free(this_state->state_data->data);
+		free(this_state->state_data);
+	}
+	free(this_state->name);
+	free(this_state->_filename);
+	free(this_state->_directory);
+	free(this_state->_legacy_filename);
+	free(this_state);
+	this_monitoring_plugin->state = saved;
+}
+
+/* A damaged line keeps whatever could be read up to that point */
+static void
+series_load (series *s)
+{
+	state_data *previous;
+	char *p, *end;
+	time_t t;
+	long delta;
+	double value;
+
+	s->count = s->head = 0;
+	previous = np_state_read();
+	if (previous == NULL || previous->data == NULL)
+		return;
+
+	p = previous->data;
+	t = strtoul(p, &end, 10);
+	if (end == p)
+		return;
+	for (p = end; *p; p = end) {
+		delta = strtol(p, &end, 10);
+		if (end == p || *end != ':' || delta < 0)
+			return;
+		p = end + 1;
+		value = strtod(p, &end);
+		if (end == p)
+			return;
+		t += delta;
+		series_add(s, t, value);
+	}
+}
+
+static void
+series_save (series *s)
+{
+	char *line, *p;
+	time_t previous;
+	int i, slot;
+
+	/* time, then at most 10 digits of delta and 15 characters of value */
+	line = malloc(24 + s->count * 28);
+	if (line == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror(errno));
+
+	previous = s->count ? s->time[SERIES_SLOT(s, 0)] : 0;
+	p = line + sprintf(line, "%lu", (unsigned long)previous);
+	for (i = 0; i < s->count; i++) {
+		slot = SERIES_SLOT(s, i);
+		p += sprintf(p, " %lu:%.7g", (unsigned long)(s->time[slot] - previous),
+		             s->value[slot]);
+		previous = s->time[slot];
+	}
+	np_state_write_string(0, line);
+	free(line);
+}
+
+int
+np_series_append (char *key, time_t sample_time, double value)
+{
+	state_key *saved;
+	series *s;
+	int result = OK;
+
+	if (sample_time == 0)
+		time(&sample_time);
+
+	s = malloc(sizeof(series));
+	if (s == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror(errno));
+
+	saved = series_enter(key);
+	series_load(s);
+	if (s->count && sample_time < s->time[SERIES_SLOT(s, s->count - 1)])
+		result = ERROR;
+	else {
+		series_add(s, sample_time, value);
+		series_save(s);
+	}
+	series_leave(saved);
+
+	free(s);
+	return result;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* interpolated between the two closest ranks */
+static double
+percentile (double *sorted, int count, double p)
+{
+	double rank = p / 100.0 * (count - 1);
+	int below = (int)rank;
+
+	if (below + 1 >= count)
+		return sorted[count - 1];
+	return sorted[below] + (rank - below) * (sorted[below + 1] - sorted[below]);
+}
+
+int
+np_series_window (char *key, int seconds, np_series_stats *stats)
+{
+	state_key *saved;
+	series *s;
+	double *values, sum = 0, squares = 0, t_mean, dt, st = 0, tt = 0;
+	time_t now;
+	int i, n, first;
+
+	memset(stats, 0, sizeof(np_series_stats));
+
+	s = malloc(sizeof(series));
+	values = malloc(NP_SERIES_CAPACITY * sizeof(double));
+	if (s == NULL || values == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror(errno));
+
+	saved = series_enter(key);
+	series_load(s);
+	series_leave(saved);
+
+	/* samples are in time order, so the window is a tail of the ring */
+	time(&now);
+	for (first = 0; seconds > 0 && first < s->count; first++)
+		if (s->time[SERIES_SLOT(s, first)] > now - seconds)
+			break;
+	n = s->count - first;
+
+	if (n > 0) {
+		stats->count = n;
+		stats->first = s->time[SERIES_SLOT(s, first)];
+		stats->last = s->time[SERIES_SLOT(s, s->count - 1)];
+
+		for (i = 0; i < n; i++) {
+			values[i] = s->value[SERIES_SLOT(s, first + i)];
+			sum += values[i];
+		}
+		stats->mean = sum / n;
+
+		/* times relative to the first sample keep the sums small */
+		t_mean = 0;
+		for (i = 0; i < n; i++)
+			t_mean += s->time[SERIES_SLOT(s, first + i)] - stats->first;
+		t_mean /= n;
+
+		for (i = 0; i < n; i++) {
+			squares += (values[i] - stats->mean) * (values[i] - stats->mean);
+			dt = s->time[SERIES_SLOT(s, first + i)] - stats->first - t_mean;
+			st += dt * (values[i] - stats->mean);
+			tt += dt * dt;
+		}
+		stats->stddev = sqrt(squares / n);
+		stats->slope = tt > 0 ? st / tt : 0;
+
+		qsort(values, n, sizeof(double), compare_doubles);
+		stats->min = values[0];
+		stats->max = values[n - 1];
+		stats->p50 = percentile(values, n, 50);
+		stats->p90 = percentile(values, n, 90);
+		stats->p95 = percentile(values, n, 95);
+		stats->p99 = percentile(values, n, 99);
+	}
+
+	free(values);
+	free(s);
+	return n;
+}
@@ -0,0 +1,48 @@
+#ifndef _UTILS_SERIES_
+#define _UTILS_SERIES_
+
+/*
+ * Header file for Monitoring Plugins utils_series.c
+ *
+ * Rolling time series kept in the plugin state directory, for plugins that
+ * want to alert on a sustained condition rather than on a single sample.
+ * Each series holds the newest NP_SERIES_CAPACITY samples; older ones are
+ * dropped as new ones arrive. Plugins using these need $(MATHLIBS).
+ */
+
+#include "utils_base.h"
+
+#define NP_SERIES_CAPACITY 256
+#define NP_SERIES_DATA_VERSION 1
+
+typedef struct np_series_stats_struct {
+	int	count;		/* samples in the window, the rest is 0 without any */
+	time_t	first;		/* time of the oldest and the newest sample */
+	time_t	last;
+	double	min;
+	double	max;
+	double	mean;
+	double	stddev;
+	double	p50;
+	double	p90;
+	double	p95;
+	double	p99;
+	double	slope;		/* least squares, change per second */
+	} np_series_stats;
+
+/*
+ * Add a sample to the series named key (alphanumerics or '_'). A NULL key
+ * uses one derived from the plugin arguments, as np_enable_state() does.
+ * time 0 is now. Returns ERROR without storing anything if the sample is
+ * older than the newest one already in the series, otherwise OK. The
+ * plugin's own state, if any, stays enabled.
+ */
+int np_series_append(char *, time_t, double);
+
+/*
+ * Fill in the statistics over the samples of the last seconds, or over the
+ * whole series if seconds is 0. Returns the number of samples used.
+ */
+int np_series_window(char *, int, np_series_stats *);
+
+#endif /* _UTILS_SERIES_ */
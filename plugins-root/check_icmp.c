@@ -10,7 +10,7 @@
 * 
 * This file contains the check_icmp plugin
 * 
-* Relevant RFC's: 792 (ICMP), 791 (IP)
+* Relevant RFC's: 792 (ICMP), 791 (IP), 4443 (ICMPv6), 8200 (IPv6)
 * 
 * This program was modeled somewhat after the check_icmp program,
 * which was in turn a hack of fping (www.fping.org) but has been
@@ -68,9 +68,42 @@ const char *email = "devel@monitoring-plugins.org";
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <float.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <ifaddrs.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+#include <netpacket/packet.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
+
+/* a packet rate budget shared by all check_icmp processes on the host */
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_CLOCK_GETTIME) && defined(__GNUC__)
+# define RATE_BUDGET 1
+#endif
+#define RATE_SHM_NAME "/check_icmp-rate"
+
+/* the option letters, shared by getopt() and find_opt_arg() */
+#define ICMP_OPTS "vhVw:c:n:p:t:H:s:i:b:I:l:m:P:46j:R:a"
+
+/* kernel transmit timestamps, numbered per socket (linux >= 3.19) */
+#if defined(SO_TIMESTAMPING) && defined(SO_EE_ORIGIN_TIMESTAMPING)
+# define TX_TIMESTAMPS 1
+#endif
 
 
 /** sometimes undefined system macros (quite a few, actually) **/
@@ -113,9 +146,14 @@ typedef struct rta_host {
 	unsigned short id;           /* id in **table, and icmp pkts */
 	char *name;                  /* arg used for adding this host */
 	char *msg;                   /* icmp error message, if any */
-	struct sockaddr_in saddr_in; /* the address of this host */
-	struct in_addr error_addr;   /* stores address of error replies */
+	struct sockaddr_storage saddr_in; /* the address of this host */
+	struct in_addr src_addr;     /* local address, for tcp/udp checksums */
+	unsigned short port;         /* destination port of tcp probes */
+	struct sockaddr_storage error_addr; /* stores address of error replies */
+	unsigned char hwaddr[6];     /* mac address answering arp probes */
+	unsigned char conflict_hwaddr[6]; /* another mac answering for the ip */
 	unsigned long long time_waited; /* total time waited, in usecs */
+	double time_waited_sq;       /* sum of squared rtts, for -a */
 	unsigned int icmp_sent, icmp_recv, icmp_lost; /* counters */
 	unsigned char icmp_type, icmp_code; /* type and code from errors */
 	unsigned short flags;        /* control/status flags */
@@ -126,7 +164,15 @@ typedef struct rta_host {
 	struct rta_host *next;       /* linked list */
 } rta_host;
 
+/* address family specific views of a struct sockaddr_storage */
+#define SA_IN(ss) ((struct sockaddr_in *)(ss))
+#define SA_IN6(ss) ((struct sockaddr_in6 *)(ss))
+
 #define FLAG_LOST_CAUSE 0x01  /* decidedly dead target. */
+#define FLAG_HWADDR 0x02      /* hwaddr is set */
+#define FLAG_IP_CONFLICT 0x04 /* more than one mac answered arp probes */
+#define FLAG_PORT_CLOSED 0x08 /* syn probe answered with a RST */
+#define FLAG_SETTLED 0x10     /* -a: more packets won't change the state */
 
 /* threshold structure. all values are maximum allowed, exclusive */
 typedef struct threshold {
@@ -158,13 +204,30 @@ typedef struct icmp_ping_data {
 #define MODE_ALL 2
 #define MODE_ICMP 3
 
-/* the different ping types we can do
- * TODO: investigate ARP ping as well */
+/* the different ping types we can do */
 #define HAVE_ICMP 1
 #define HAVE_UDP 2
 #define HAVE_TCP 4
 #define HAVE_ARP 8
 
+/* default destination ports for tcp and udp probes. The udp one is the
+ * traceroute base port, which is very unlikely to have a listener */
+#define DEFAULT_TCP_PORT 80
+#define DEFAULT_UDP_PORT 33434
+#define MAX_PROBE_PORTS 64
+
+/* -a stops probing a target once the remaining packets could only make it
+ * leave the OK state with less than this chance, per threshold. Z is the
+ * matching one-sided normal quantile */
+#define ADAPTIVE_ALPHA 0.01
+#define ADAPTIVE_Z 2.326
+#define ADAPTIVE_MIN_REPLIES 2
+
+/* udp probes carry their sequence number in the source port, which is
+ * offset by the pid and kept above the privileged range */
+#define UDP_SPORT_BASE 1024
+#define UDP_SPORT_RANGE (65536 - UDP_SPORT_BASE)
+
 #define MIN_PING_DATA_SIZE sizeof(struct icmp_ping_data)
 #define MAX_IP_PKT_SIZE 65536	/* (theoretical) max IP packet size */
 #define IP_HDR_SIZE 20
@@ -177,23 +240,80 @@ typedef struct icmp_ping_data {
 #define TSTATE_ALIVE 0x04       /* target is alive (has answered something) */
 #define TSTATE_UNREACH 0x08
 
+/* upper limit for -j. Each worker has a full set of sockets */
+#define MAX_WORKERS 64
+#define WORKER_SOCKS 5 /* icmp, icmpv6, udp, tcp, arp */
+
+/* the shared rate budget is a token bucket, kept as the time at which
+ * the next packet may be sent (GCRA), so a single compare-and-swap takes
+ * a token. Times are usecs on CLOCK_MONOTONIC, which all processes share */
+typedef struct rate_bucket {
+	unsigned long long tat;
+} rate_bucket;
+
+/* what a worker hands back to the parent, in shared memory */
+typedef struct worker_stats {
+	unsigned int icmp_sent, icmp_recv, icmp_lost;
+	unsigned long long tx_lag_total;
+	unsigned int tx_lag_max, tx_lag_count;
+} worker_stats;
+
 /** prototypes **/
 void print_help (void);
 void print_usage (void);
 static u_int get_timevar(const char *);
 static u_int get_timevaldiff(struct timeval *, struct timeval *);
 static in_addr_t get_ip_address(const char *);
-static int wait_for_reply(int, u_int);
-static int recvfrom_wto(int, void *, unsigned int, struct sockaddr *, u_int *, struct timeval*);
+static int wait_for_reply(u_int);
+static int recvfrom_wto(int *, void *, unsigned int, struct sockaddr *, u_int *, struct timeval*);
+static int send_probe(struct rta_host *);
 static int send_icmp_ping(int, struct rta_host *);
+static int send_icmp6_ping(int, struct rta_host *);
+static int send_tcp_syn(int, struct rta_host *);
+static int send_udp_probe(int, struct rta_host *);
+static int send_arp_request(int, struct rta_host *);
+static int send_packet(int, struct rta_host *, void *, size_t, struct sockaddr *, socklen_t);
+static void set_timestamping(int);
+static void set_icmp_filter(void);
+static void set_rcvbuf(void);
+static void set_rate(char *);
+static void rate_setup(void);
+static void rate_wait(void);
+static const char *find_opt_arg(int, char **, int);
+static int get_workers(int, char **);
+static void open_worker_sockets(void);
+static void start_workers(void);
+static void publish_results(void);
+static void collect_workers(int);
+static void tx_log_add(int, int);
+static void read_tx_timestamps(int);
+static void send_tcp_rst(struct rta_host *, struct tcphdr *);
+static int handle_icmp6_reply(unsigned char *, int, struct sockaddr_storage *, struct timeval *);
+static int handle_tcp_reply(unsigned char *, int, struct sockaddr_storage *, struct timeval *);
+static int handle_udp_reply(unsigned char *, int, struct sockaddr_storage *, struct timeval *);
+static int handle_arp_reply(unsigned char *, int, struct timeval *);
+static void arp_setup(void);
+static void ip_hash_add(struct rta_host *);
+static void expand_ports(void);
+static struct rta_host *ip_hash_find(struct sockaddr_storage *);
+static void record_reply(struct rta_host *, u_int, struct sockaddr_storage *, unsigned char);
+static int is_settled(struct rta_host *);
+static int get_probe_rtt(unsigned int, struct timeval *);
+static void set_protocol(char *);
+static void get_source_addr(int, struct rta_host *);
 static int get_threshold(char *str, threshold *th);
 static void run_checks(void);
 static void set_source_ip(char *);
 static int add_target(char *);
-static int add_target_ip(char *, struct in_addr *);
-static int handle_random_icmp(unsigned char *, struct sockaddr_in *);
+static int add_target_net(char *);
+static int add_target_ip(char *, struct sockaddr_storage *);
+static int handle_random_icmp(unsigned char *, struct sockaddr_storage *, struct timeval *, unsigned char);
+static int handle_random_icmp6(unsigned char *, int, struct sockaddr_storage *);
 static unsigned short icmp_checksum(unsigned short *, int);
+static unsigned short transport_checksum(struct rta_host *, int, void *, int);
 static void finish(int);
+static const char *format_hwaddr(unsigned char *);
+static const char *format_addr(struct sockaddr_storage *);
 static void crash(const char *, ...);
 
 /** external **/
@@ -212,9 +332,52 @@ static unsigned int icmp_sent = 0, icmp_recv = 0, icmp_lost = 0;
 #define icmp_pkts_en_route (icmp_sent - (icmp_recv + icmp_lost))
 static unsigned short targets_down = 0, targets = 0, packets = 0;
 #define targets_alive (targets - targets_down)
+static unsigned short targets_settled = 0;
+static int adaptive = 0;
 static unsigned int retry_interval, pkt_interval, target_interval;
-static int icmp_sock, tcp_sock, udp_sock, status = STATE_OK;
+static int icmp_sock, icmp6_sock, tcp_sock, udp_sock, arp_sock = -1;
+static int status = STATE_OK;
+static unsigned short targets_v4 = 0, targets_v6 = 0;
 static pid_t pid;
+static unsigned short probe_port, src_port;
+static unsigned short probe_ports[MAX_PROBE_PORTS];
+static int probe_port_count = 0, port_state = 0;
+static const char *probe_name = "ICMP";
+static struct in_addr source_ip;
+static struct timeval *probe_stime; /* send times of all probes */
+#ifdef TX_TIMESTAMPS
+/* the kernel numbers the sends on each timestamping socket, so we keep
+ * track of which probe went out as which send */
+typedef struct tx_log {
+	int sock;
+	unsigned int sent, size;
+	int *id;                     /* probe id per send, -1 if not a probe */
+} tx_log;
+static tx_log tx_logs[5];
+static unsigned int tx_log_count = 0;
+#endif
+static unsigned long long tx_lag_total = 0; /* usecs from sendmsg() to the wire */
+static unsigned int tx_lag_max = 0, tx_lag_count = 0;
+/* with -j, targets are dealt out round robin to this many processes,
+ * which each probe their share on their own sockets */
+static int workers = 1, worker = 0, worker_sets = 0;
+static unsigned short all_targets;
+static pid_t *worker_pids;
+static int (*worker_socks)[WORKER_SOCKS];
+static worker_stats *shard_stats;    /* per worker, shared */
+static struct rta_host *shard_hosts; /* per target, shared */
+static rate_bucket *rate_shm;        /* -R, host wide */
+static int rate_fd = -1, rate_errno = 0;
+static unsigned int rate_interval = 0, rate_burst = 0; /* usecs, packets */
+static struct rta_host **ip_hash;   /* open addressed, keyed on ipv4 */
+static unsigned int ip_hash_mask;
+#if defined(__linux__)
+static struct sockaddr_ll arp_dest; /* link layer broadcast */
+static unsigned char arp_hwaddr[6]; /* our own mac */
+#endif
+static int *probe_socks[WORKER_SOCKS] = {
+	&icmp_sock, &icmp6_sock, &udp_sock, &tcp_sock, &arp_sock
+};
 static struct timezone tz;
 static struct timeval prog_start;
 static unsigned long long max_completion_time = 0;
@@ -299,11 +462,102 @@ get_icmp_error_msg(unsigned char icmp_type, unsigned char icmp_code)
 	return msg;
 }
 
+static const char *
+get_icmp6_error_msg(unsigned char icmp_type, unsigned char icmp_code)
+{
+	const char *msg = "unreachable";
+
+	if(debug > 1) printf("get_icmp6_error_msg(%u, %u)\n", icmp_type, icmp_code);
+	switch(icmp_type) {
+	case ICMP6_DST_UNREACH:
+		switch(icmp_code) {
+		case ICMP6_DST_UNREACH_NOROUTE: msg = "No route to destination"; break;
+		case ICMP6_DST_UNREACH_ADMIN: msg = "Communication prohibited (firewall?)"; break;
+		case ICMP6_DST_UNREACH_BEYONDSCOPE: msg = "Beyond scope of source address"; break;
+		case ICMP6_DST_UNREACH_ADDR: msg = "Address unreachable"; break;
+		case ICMP6_DST_UNREACH_NOPORT: msg = "Port unreachable (firewall?)"; break;
+		default: msg = "Invalid code"; break;
+		}
+		break;
+
+	case ICMP6_TIME_EXCEEDED:
+		switch(icmp_code) {
+		case ICMP6_TIME_EXCEED_TRANSIT: msg = "Hop limit exceeded in transit"; break;
+		case ICMP6_TIME_EXCEED_REASSEMBLY: msg = "Fragment reassembly time exceeded"; break;
+		default: msg = "Invalid code"; break;
+		}
+		break;
+
+	case ICMP6_PACKET_TOO_BIG: msg = "Packet too big"; break;
+	case ICMP6_PARAM_PROB: msg = "Parameter problem"; break;
+	default: msg = ""; break;
+	}
+
+	return msg;
+}
+
+/* icmpv6 errors quote the ipv6 header and as much of our packet as fits */
+static int
+handle_random_icmp6(unsigned char *packet, int n, struct sockaddr_storage *addr)
+{
+	struct icmp6_hdr p, sent_icmp;
+	struct ip6_hdr sent_ip;
+	struct rta_host *host;
+	unsigned int id;
+
+	if(n < (int)(sizeof(p) + sizeof(sent_ip) + sizeof(sent_icmp))) return 0;
+	memcpy(&p, packet, sizeof(p));
+
+	if(debug) printf("handle_random_icmp6(%p, %p)\n", (void *)&p, (void *)addr);
+
+	/* the socket filter only lets errors through besides echo replies */
+	memcpy(&sent_ip, packet + sizeof(p), sizeof(sent_ip));
+	memcpy(&sent_icmp, packet + sizeof(p) + sizeof(sent_ip), sizeof(sent_icmp));
+	id = ntohs(sent_icmp.icmp6_seq);
+	if(sent_ip.ip6_nxt != IPPROTO_ICMPV6 ||
+	   sent_icmp.icmp6_type != ICMP6_ECHO_REQUEST ||
+	   ntohs(sent_icmp.icmp6_id) != pid || id >= (unsigned int)targets*packets)
+	{
+		if(debug) printf("Packet is no response to a packet we sent\n");
+		return 0;
+	}
+
+	/* it is indeed a response for us */
+	host = table[id/packets];
+	if(debug) {
+		printf("Received \"%s\" from %s for ICMP ECHO sent to %s.\n",
+			   get_icmp6_error_msg(p.icmp6_type, p.icmp6_code),
+			   format_addr(addr), host->name);
+	}
+
+	icmp_lost++;
+	host->icmp_lost++;
+	/* don't spend time on lost hosts any more. Too big just means this
+	 * particular packet didn't make it */
+	if(host->flags & FLAG_LOST_CAUSE || p.icmp6_type == ICMP6_PACKET_TOO_BIG)
+		return 0;
+
+	targets_down++;
+	host->flags |= FLAG_LOST_CAUSE;
+	host->icmp_type = p.icmp6_type;
+	host->icmp_code = p.icmp6_code;
+	memcpy(&host->error_addr, addr, sizeof(host->error_addr));
+
+	return 0;
+}
+
 static int
-handle_random_icmp(unsigned char *packet, struct sockaddr_in *addr)
+handle_random_icmp(unsigned char *packet, struct sockaddr_storage *addr,
+                   struct timeval *now, unsigned char rttl)
 {
 	struct icmp p, sent_icmp;
+	struct ip sent_ip;
+	struct tcphdr sent_tcp;
+	struct udphdr sent_udp;
 	struct rta_host *host = NULL;
+	unsigned char *orig;
+	unsigned int id = targets * packets;
+	int tdiff;
 
 	memcpy(&p, packet, sizeof(p));
 	if(p.icmp_type == ICMP_ECHO && ntohs(p.icmp_id) == pid) {
@@ -330,21 +584,53 @@ handle_random_icmp(unsigned char *packet, struct sockaddr_in *addr)
 	}
 
 	/* might be for us. At least it holds the original package (according
-	 * to RFC 792). If it isn't, just ignore it */
-	memcpy(&sent_icmp, packet + 28, sizeof(sent_icmp));
-	if(sent_icmp.icmp_type != ICMP_ECHO || ntohs(sent_icmp.icmp_id) != pid ||
-	   ntohs(sent_icmp.icmp_seq) >= targets*packets)
-	{
+	 * to RFC 792), which is the ip header and the first 8 bytes of
+	 * whatever we sent. If it isn't, just ignore it */
+	memcpy(&sent_ip, packet + ICMP_MINLEN, sizeof(sent_ip));
+	orig = packet + ICMP_MINLEN + (sent_ip.ip_hl << 2);
+	switch(sent_ip.ip_p) {
+	case IPPROTO_ICMP:
+		memcpy(&sent_icmp, orig, sizeof(sent_icmp));
+		if(sent_icmp.icmp_type == ICMP_ECHO && ntohs(sent_icmp.icmp_id) == pid)
+			id = ntohs(sent_icmp.icmp_seq);
+		break;
+	case IPPROTO_TCP:
+		/* the sequence number is within the first 8 bytes */
+		memcpy(&sent_tcp, orig, sizeof(sent_tcp));
+		if(protocols & HAVE_TCP && ntohs(sent_tcp.th_sport) == src_port &&
+		   ntohl(sent_tcp.th_seq) >> 16 == (u_int32_t)pid)
+			id = ntohl(sent_tcp.th_seq) & 0xffff;
+		break;
+	case IPPROTO_UDP:
+		memcpy(&sent_udp, orig, sizeof(sent_udp));
+		if(protocols & HAVE_UDP && ntohs(sent_udp.uh_dport) == probe_port) {
+			id = (ntohs(sent_udp.uh_sport) + UDP_SPORT_RANGE - UDP_SPORT_BASE -
+			      pid % UDP_SPORT_RANGE) % UDP_SPORT_RANGE;
+		}
+		break;
+	}
+	if(id >= (unsigned int)targets*packets) {
 		if(debug) printf("Packet is no response to a packet we sent\n");
 		return 0;
 	}
 
 	/* it is indeed a response for us */
-	host = table[ntohs(sent_icmp.icmp_seq)/packets];
+	host = table[id/packets];
+
+	/* a closed udp port on the target itself answers with port
+	 * unreachable, which is exactly the sign of life we're after */
+	if(sent_ip.ip_p == IPPROTO_UDP && p.icmp_type == ICMP_UNREACH &&
+	   p.icmp_code == ICMP_UNREACH_PORT &&
+	   SA_IN(addr)->sin_addr.s_addr == SA_IN(&host->saddr_in)->sin_addr.s_addr)
+	{
+		if((tdiff = get_probe_rtt(id, now)) >= 0)
+			record_reply(host, tdiff, addr, rttl);
+		return 0;
+	}
 	if(debug) {
 		printf("Received \"%s\" from %s for ICMP ECHO sent to %s.\n",
 			   get_icmp_error_msg(p.icmp_type, p.icmp_code),
-			   inet_ntoa(addr->sin_addr), host->name);
+			   format_addr(addr), host->name);
 	}
 
 	icmp_lost++;
@@ -364,7 +650,7 @@ handle_random_icmp(unsigned char *packet, struct sockaddr_in *addr)
 	}
 	host->icmp_type = p.icmp_type;
 	host->icmp_code = p.icmp_code;
-	host->error_addr.s_addr = addr->sin_addr.s_addr;
+	memcpy(&host->error_addr, addr, sizeof(host->error_addr));
 
 	return 0;
 }
@@ -375,12 +661,11 @@ main(int argc, char **argv)
 	int i;
 	char *ptr;
 	long int arg;
-	int icmp_sockerrno, udp_sockerrno, tcp_sockerrno;
+	int icmp_sockerrno, icmp6_sockerrno, udp_sockerrno, tcp_sockerrno, arp_sockerrno;
 	int result;
 	struct rta_host *host;
-#ifdef SO_TIMESTAMP
-	int on = 1;
-#endif
+	unsigned int per_worker;
+	char *source = NULL;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -388,28 +673,50 @@ main(int argc, char **argv)
 
 	/* we only need to be setsuid when we get the sockets, so do
 	 * that before pointer magic (esp. on network data) */
-	icmp_sockerrno = udp_sockerrno = tcp_sockerrno = sockets = 0;
+	icmp_sockerrno = icmp6_sockerrno = udp_sockerrno = tcp_sockerrno =
+		arp_sockerrno = sockets = 0;
 
 	if((icmp_sock = socket(PF_INET, SOCK_RAW, IPPROTO_ICMP)) != -1)
 		sockets |= HAVE_ICMP;
 	else icmp_sockerrno = errno;
 
-	/* if((udp_sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) != -1) */
-	/* 	sockets |= HAVE_UDP; */
-	/* else udp_sockerrno = errno; */
+	if((icmp6_sock = socket(PF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) != -1)
+		sockets |= HAVE_ICMP;
+	else icmp6_sockerrno = errno;
+
+	/* tcp and udp probes are crafted by hand, so they need raw sockets too.
+	 * The ones we turn out not to need are closed after parsing arguments */
+	if((udp_sock = socket(PF_INET, SOCK_RAW, IPPROTO_UDP)) != -1)
+		sockets |= HAVE_UDP;
+	else udp_sockerrno = errno;
+
+	if((tcp_sock = socket(PF_INET, SOCK_RAW, IPPROTO_TCP)) != -1)
+		sockets |= HAVE_TCP;
+	else tcp_sockerrno = errno;
+
+#if defined(__linux__)
+	if((arp_sock = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ARP))) != -1)
+		sockets |= HAVE_ARP;
+	else arp_sockerrno = errno;
+#endif
 
-	/* if((tcp_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) != -1) */
-	/* 	sockets |= HAVE_TCP; */
-	/* else tcp_sockerrno = errno; */
+	/* workers need sockets of their own, which we can only get now */
+	if((workers = get_workers(argc, argv)) > 1)
+		open_worker_sockets();
+
+#ifdef RATE_BUDGET
+	/* only root may open the -R budget, so it's created while we still are */
+	if(find_opt_arg(argc, argv, 'R')) {
+		if((rate_fd = shm_open(RATE_SHM_NAME, O_RDWR | O_CREAT, 0600)) == -1)
+			rate_errno = errno;
+		else
+			fchmod(rate_fd, 0600); /* left group writable by older versions */
+	}
+#endif
 
 	/* now drop privileges (no effect if not setsuid or geteuid() == 0) */
 	setuid(getuid());
 
-#ifdef SO_TIMESTAMP
-	if(setsockopt(icmp_sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)))
-	  if(debug) printf("Warning: no SO_TIMESTAMP support\n");
-#endif // SO_TIMESTAMP
-
 	/* POSIXLY_CORRECT might break things, so unset it (the portable way) */
 	environ = NULL;
 
@@ -434,13 +741,12 @@ main(int argc, char **argv)
 	crit.pl = 80;
 	warn.rta = 200000;
 	warn.pl = 40;
-	protocols = HAVE_ICMP | HAVE_UDP | HAVE_TCP;
+	protocols = HAVE_ICMP;
 	pkt_interval = 80000;  /* 80 msec packet interval by default */
 	packets = 5;
 
 	if(!strcmp(progname, "check_icmp") || !strcmp(progname, "check_ping")) {
 		mode = MODE_ICMP;
-		protocols = HAVE_ICMP;
 	}
 	else if(!strcmp(progname, "check_host")) {
 		mode = MODE_HOSTCHECK;
@@ -469,7 +775,7 @@ main(int argc, char **argv)
 
 	/* parse the arguments */
 	for(i = 1; i < argc; i++) {
-		while((arg = getopt(argc, argv, "vhVw:c:n:p:t:H:s:i:b:I:l:m:")) != EOF) {
+		while((arg = getopt(argc, argv, ICMP_OPTS)) != EOF) {
 			unsigned short size;
 			switch(arg) {
 			case 'v':
@@ -522,7 +828,26 @@ main(int argc, char **argv)
 				}
 				break;
 			case 's': /* specify source IP address */
-				set_source_ip(optarg);
+				source = optarg;
+				break;
+			case 'j': /* already picked up by get_workers() */
+				if(!is_intnonneg(optarg))
+					usage_va(_("Invalid number of workers: %s"), optarg);
+				break;
+			case 'P': /* probe protocol */
+				set_protocol(optarg);
+				break;
+			case 'R': /* host wide packet rate */
+				set_rate(optarg);
+				break;
+			case 'a': /* stop probing targets that are clearly fine */
+				adaptive = 1;
+				break;
+			case '4': /* resolve following hosts to ipv4 only */
+				address_family = AF_INET;
+				break;
+			case '6': /* resolve following hosts to ipv6 only */
+				address_family = AF_INET6;
 				break;
 			case 'V': /* version */
 				print_revision (progname, NP_VERSION);
@@ -539,38 +864,140 @@ main(int argc, char **argv)
 		add_target(*argv);
 		argv++;
 	}
+	if(protocols & HAVE_TCP) expand_ports();
 	if(!targets) {
 		errno = 0;
 		crash("No hosts to check");
 		exit(3);
 	}
 
-	if(!sockets) {
-		if(icmp_sock == -1) {
-			errno = icmp_sockerrno;
-			crash("Failed to obtain ICMP socket");
-			return -1;
-		}
-		/* if(udp_sock == -1) { */
-		/* 	errno = icmp_sockerrno; */
-		/* 	crash("Failed to obtain UDP socket"); */
-		/* 	return -1; */
-		/* } */
-		/* if(tcp_sock == -1) { */
-		/* 	errno = icmp_sockerrno; */
-		/* 	crash("Failed to obtain TCP socker"); */
-		/* 	return -1; */
-		/* } */
+	/* hostchecks bail out on the first reply, so there's nothing to share */
+	if(mode == MODE_HOSTCHECK) workers = 1;
+	if(workers > targets) workers = targets;
+	per_worker = (targets + workers - 1) / workers;
+
+	if(packets > 20) {
+		errno = 0;
+		crash("packets is > 20 (%d)", packets);
+	}
+
+	if(min_hosts_alive < -1) {
+		errno = 0;
+		crash("minimum alive hosts is negative (%i)", min_hosts_alive);
+	}
+
+	/* the sequence number is all that tells probes apart */
+	if(per_worker * packets > 65536) {
+		errno = 0;
+		crash("too many probes (%d targets * %d packets), max is 65536",
+		      per_worker, packets);
+	}
+
+	if(protocols & HAVE_UDP && per_worker * packets > UDP_SPORT_RANGE) {
+		errno = 0;
+		crash("too many udp probes (%d), max is %d",
+		      per_worker * packets, UDP_SPORT_RANGE);
+	}
+
+	/* the icmp socket is needed for any ipv4 target, since it carries
+	 * the errors */
+	if(targets_v4 && icmp_sock == -1) {
+		errno = icmp_sockerrno;
+		crash("Failed to obtain ICMP socket");
+		return -1;
+	}
+	if(targets_v6 && icmp6_sock == -1) {
+		errno = icmp6_sockerrno;
+		crash("Failed to obtain ICMPv6 socket");
+		return -1;
+	}
+	if(targets_v6 && !(protocols & HAVE_ICMP)) {
+		errno = 0;
+		crash("%s probes only support IPv4 targets", probe_name);
+		return -1;
+	}
+	if(protocols & HAVE_UDP && udp_sock == -1) {
+		errno = udp_sockerrno;
+		crash("Failed to obtain UDP socket");
+		return -1;
+	}
+	if(protocols & HAVE_TCP && tcp_sock == -1) {
+		errno = tcp_sockerrno;
+		crash("Failed to obtain TCP socket");
+		return -1;
+	}
+	if(protocols & HAVE_ARP && arp_sock == -1) {
+		errno = arp_sockerrno;
+		crash("Failed to obtain ARP socket");
+		return -1;
+	}
+
+	start_workers();
+	if(source) set_source_ip(source);
+
+	/* the kernel hands a copy of every tcp and udp packet to raw sockets,
+	 * so don't keep the ones we won't use around */
+	if(!(protocols & HAVE_UDP) && udp_sock != -1) {
+		close(udp_sock);
+		udp_sock = -1;
+		sockets &= ~HAVE_UDP;
+	}
+	if(!(protocols & HAVE_TCP) && tcp_sock != -1) {
+		close(tcp_sock);
+		tcp_sock = -1;
+		sockets &= ~HAVE_TCP;
+	}
+	if(!(protocols & HAVE_ARP) && arp_sock != -1) {
+		close(arp_sock);
+		arp_sock = -1;
+		sockets &= ~HAVE_ARP;
+	}
+	if(!targets_v4 && icmp_sock != -1) {
+		close(icmp_sock);
+		icmp_sock = -1;
+	}
+	if(!targets_v6 && icmp6_sock != -1) {
+		close(icmp6_sock);
+		icmp6_sock = -1;
 	}
 	if(!ttl) ttl = 64;
 
-	if(icmp_sock) {
+	set_icmp_filter();
+	set_rcvbuf();
+	if(rate_interval) rate_setup();
+	set_timestamping(icmp_sock);
+	set_timestamping(icmp6_sock);
+	set_timestamping(udp_sock);
+	set_timestamping(tcp_sock);
+	set_timestamping(arp_sock);
+
+	if(icmp_sock != -1) {
 		result = setsockopt(icmp_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
 		if(debug) {
 			if(result == -1) printf("setsockopt failed\n");
 			else printf("ttl set to %u\n", ttl);
 		}
 	}
+	if(icmp6_sock != -1) {
+		int hops = ttl;
+		struct icmp6_filter filter;
+
+		setsockopt(icmp6_sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &hops, sizeof(hops));
+
+		/* have the kernel drop everything that can't be a reply to us */
+		ICMP6_FILTER_SETBLOCKALL(&filter);
+		ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB, &filter);
+		if(setsockopt(icmp6_sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) == -1)
+			if(debug) printf("Warning: failed to set ICMP6_FILTER\n");
+	}
+	if(udp_sock != -1)
+		setsockopt(udp_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
+	if(tcp_sock != -1)
+		setsockopt(tcp_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
 
 	/* stupid users should be able to give whatever thresholds they want
 	 * (nothing will break if they do), but some anal plugin maintainer
@@ -592,6 +1019,15 @@ main(int argc, char **argv)
 	max_completion_time =
 		((targets * packets * pkt_interval) + (targets * target_interval)) +
 		(targets * packets * crit.rta) + crit.rta;
+	/* arp replies come straight from the local segment, so there's no
+	 * queueing along a path to account for */
+	if(protocols & HAVE_ARP) {
+		max_completion_time =
+			((targets * packets * pkt_interval) + (targets * target_interval)) +
+			crit.rta;
+	}
+	/* at the very least we have to wait for our share of the budget */
+	max_completion_time += (unsigned long long)targets * packets * rate_interval;
 
 	if(debug) {
 		printf("packets: %u, targets: %u\n"
@@ -622,26 +1058,33 @@ main(int argc, char **argv)
 			   icmp_pkt_size, timeout);
 	}
 
-	if(packets > 20) {
-		errno = 0;
-		crash("packets is > 20 (%d)", packets);
-	}
-
-	if(min_hosts_alive < -1) {
-		errno = 0;
-		crash("minimum alive hosts is negative (%i)", min_hosts_alive);
-	}
-
+	/* workers only know about their own share of the targets */
 	host = list;
 	table = malloc(sizeof(struct rta_host **) * targets);
+	if(workers > 1)
+		memset(ip_hash, 0, (ip_hash_mask + 1) * sizeof(*ip_hash));
 	i = 0;
-	while(host) {
+	for(per_worker = 0; host; per_worker++, host = host->next) {
+		if(per_worker % workers != (unsigned int)worker) continue;
 		host->id = i*packets;
 		table[i] = host;
-		host = host->next;
+		if(workers > 1) ip_hash_add(host);
 		i++;
 	}
 
+	probe_stime = calloc(targets * packets, sizeof(struct timeval));
+	if(!probe_stime)
+		crash("failed to allocate %d send timestamps", targets * packets);
+
+	if(protocols & (HAVE_TCP | HAVE_UDP)) {
+		if((i = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+			crash("Failed to obtain socket for source address lookup");
+		for(result = 0; result < targets; result++)
+			get_source_addr(i, table[result]);
+		close(i);
+	}
+	if(protocols & HAVE_ARP) arp_setup();
+
 	run_checks();
 
 	errno = 0;
@@ -653,7 +1096,7 @@ main(int argc, char **argv)
 static void
 run_checks()
 {
-	u_int i, t, result;
+	u_int i, t;
 	u_int final_wait, time_passed;
 
 	/* this loop might actually violate the pkt_interval or target_interval
@@ -668,12 +1111,16 @@ run_checks()
 								 table[t]->name);
 				continue;
 			}
+			if(table[t]->flags & FLAG_SETTLED) continue;
 
 			/* we're still in the game, so send next packet */
-			(void)send_icmp_ping(icmp_sock, table[t]);
-			result = wait_for_reply(icmp_sock, target_interval);
+			if(rate_interval) rate_wait();
+			(void)send_probe(table[t]);
+			wait_for_reply(target_interval);
 		}
-		result = wait_for_reply(icmp_sock, pkt_interval * targets);
+		/* nothing left to send, only replies to wait for */
+		if(targets_settled && targets_settled == targets_alive) break;
+		wait_for_reply(pkt_interval * (targets - targets_settled));
 	}
 
 	if(icmp_pkts_en_route && targets_alive) {
@@ -693,7 +1140,7 @@ run_checks()
 		 * haven't yet */
 		if(debug) printf("Waiting for %u micro-seconds (%0.3f msecs)\n",
 						 final_wait, (float)final_wait / 1000);
-		result = wait_for_reply(icmp_sock, final_wait);
+		wait_for_reply(final_wait);
 	}
 }
 
@@ -703,17 +1150,17 @@ run_checks()
  * icmp echo reply : the rest
  */
 static int
-wait_for_reply(int sock, u_int t)
+wait_for_reply(u_int t)
 {
-	int n, hlen;
+	int n, hlen, sock;
 	static unsigned char buf[4096];
-	struct sockaddr_in resp_addr;
+	struct sockaddr_storage resp_addr;
 	struct ip *ip;
 	struct icmp icp;
 	struct rta_host *host;
-	struct icmp_ping_data data;
 	struct timeval wait_start, now;
-	u_int tdiff, i, per_pkt_wait;
+	u_int i, per_pkt_wait;
+	int tdiff;
 
 	/* if we can't listen or don't have anything to listen to, just return */
 	if(!t || !icmp_pkts_en_route) return 0;
@@ -734,7 +1181,7 @@ wait_for_reply(int sock, u_int t)
 		}
 
 		/* reap responses until we hit a timeout */
-		n = recvfrom_wto(sock, buf, sizeof(buf),
+		n = recvfrom_wto(&sock, buf, sizeof(buf),
 						 (struct sockaddr *)&resp_addr, &t, &now);
 		if(!n) {
 			if(debug > 1) {
@@ -748,9 +1195,26 @@ wait_for_reply(int sock, u_int t)
 			return n;
 		}
 
+		if(sock == tcp_sock) {
+			handle_tcp_reply(buf, n, &resp_addr, &now);
+			continue;
+		}
+		if(sock == udp_sock) {
+			handle_udp_reply(buf, n, &resp_addr, &now);
+			continue;
+		}
+		if(sock == arp_sock) {
+			handle_arp_reply(buf, n, &now);
+			continue;
+		}
+		if(sock == icmp6_sock) {
+			handle_icmp6_reply(buf, n, &resp_addr, &now);
+			continue;
+		}
+
 		ip = (struct ip *)buf;
 		if(debug > 1) printf("received %u bytes from %s\n",
-						 ntohs(ip->ip_len), inet_ntoa(resp_addr.sin_addr));
+						 ntohs(ip->ip_len), format_addr(&resp_addr));
 
 /* obsolete. alpha on tru64 provides the necessary defines, but isn't broken */
 /* #if defined( __alpha__ ) && __STDC__ && !defined( __GLIBC__ ) */
@@ -764,7 +1228,7 @@ wait_for_reply(int sock, u_int t)
 
 		if(n < (hlen + ICMP_MINLEN)) {
 			crash("received packet too short for ICMP (%d bytes, expected %d) from %s\n",
-				  n, hlen + icmp_pkt_size, inet_ntoa(resp_addr.sin_addr));
+				  n, hlen + icmp_pkt_size, format_addr(&resp_addr));
 		}
 		/* else if(debug) { */
 		/* 	printf("ip header size: %u, packet size: %u (expected %u, %u)\n", */
@@ -778,139 +1242,1052 @@ wait_for_reply(int sock, u_int t)
 		if(ntohs(icp.icmp_id) != pid || icp.icmp_type != ICMP_ECHOREPLY ||
 		   ntohs(icp.icmp_seq) >= targets*packets) {
 			if(debug > 2) printf("not a proper ICMP_ECHOREPLY\n");
-			handle_random_icmp(buf + hlen, &resp_addr);
+			handle_random_icmp(buf + hlen, &resp_addr, &now, ip->ip_ttl);
 			continue;
 		}
 
 		/* this is indeed a valid response */
-		memcpy(&data, icp.icmp_data, sizeof(data));
 		if (debug > 2)
 			printf("ICMP echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
-			       (unsigned long)sizeof(data), ntohs(icp.icmp_id),
+			       (unsigned long)sizeof(struct icmp_ping_data), ntohs(icp.icmp_id),
 			       ntohs(icp.icmp_seq), icp.icmp_cksum);
 
 		host = table[ntohs(icp.icmp_seq)/packets];
-		tdiff = get_timevaldiff(&data.stime, &now);
+		tdiff = get_probe_rtt(ntohs(icp.icmp_seq), &now);
+		if(tdiff < 0) continue;
+		record_reply(host, tdiff, &resp_addr, ip->ip_ttl);
+	}
 
-		host->time_waited += tdiff;
-		host->icmp_recv++;
-		icmp_recv++;
-		if (tdiff > host->rtmax)
-			host->rtmax = tdiff;
-		if (tdiff < host->rtmin)
-			host->rtmin = tdiff;
+	return 0;
+}
 
-		if(debug) {
-			printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: %0.3f, min: %0.3f\n",
-				   (float)tdiff / 1000, inet_ntoa(resp_addr.sin_addr),
-				   ttl, ip->ip_ttl, (float)host->rtmax / 1000, (float)host->rtmin / 1000);
-		}
+/* account a reply to one of our probes */
+static void
+record_reply(struct rta_host *host, u_int tdiff, struct sockaddr_storage *addr,
+             unsigned char rttl)
+{
+	host->time_waited += tdiff;
+	host->time_waited_sq += (double)tdiff * tdiff;
+	host->icmp_recv++;
+	icmp_recv++;
+	if (tdiff > host->rtmax)
+		host->rtmax = tdiff;
+	if (tdiff < host->rtmin)
+		host->rtmin = tdiff;
+
+	if(adaptive && !(host->flags & FLAG_SETTLED) && is_settled(host)) {
+		host->flags |= FLAG_SETTLED;
+		targets_settled++;
+		if(debug) printf("%s settled after %u of %u packets\n",
+		                 host->name, host->icmp_sent, packets);
+	}
 
-		/* if we're in hostcheck mode, exit with limited printouts */
-		if(mode == MODE_HOSTCHECK) {
-			printf("OK - %s responds to ICMP. Packet %u, rta %0.3fms|"
-				   "pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
-				   host->name, icmp_recv, (float)tdiff / 1000,
-				   icmp_recv, packets, (float)tdiff / 1000,
-				   (float)warn.rta / 1000, (float)crit.rta / 1000);
-			exit(STATE_OK);
-		}
+	if(debug) {
+		printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: %0.3f, min: %0.3f\n",
+			   (float)tdiff / 1000, format_addr(addr),
+			   ttl, rttl, (float)host->rtmax / 1000, (float)host->rtmin / 1000);
 	}
 
-	return 0;
+	/* if we're in hostcheck mode, exit with limited printouts */
+	if(mode == MODE_HOSTCHECK) {
+		printf("OK - %s responds to %s. Packet %u, rta %0.3fms|"
+			   "pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
+			   host->name, probe_name, icmp_recv, (float)tdiff / 1000,
+			   icmp_recv, packets, (float)tdiff / 1000,
+			   (float)warn.rta / 1000, (float)crit.rta / 1000);
+		exit(STATE_OK);
+	}
 }
 
-/* the ping functions */
+/* chance of at least m losses in r packets, each lost with probability p */
+static double
+loss_tail(unsigned int m, unsigned int r, double p)
+{
+	double pmf = 1, below = 0;
+	unsigned int k;
+
+	if(m == 0) return 1;
+	if(m > r) return 0;
+	if(p >= 1) return 1;
+	for(k = 0; k < r; k++) pmf *= 1 - p;
+	for(k = 0; k < m; k++) {
+		below += pmf;
+		pmf *= (double)(r - k) / (k + 1) * p / (1 - p);
+	}
+	return below < 1 ? 1 - below : 0;
+}
+
+/*
+ * Decide whether the packets still to come could change an OK target's
+ * state. Each unanswered packet, sent or not, may be lost or answered. Loss
+ * is bounded by the highest loss rate under which the replies so far would
+ * have come in a row with ADAPTIVE_ALPHA chance, the rtt of further replies
+ * by the mean plus ADAPTIVE_Z standard deviations (and at least the
+ * slowest seen). Both are checked against the thresholds as they would be
+ * applied to the full count of packets.
+ */
 static int
-send_icmp_ping(int sock, struct rta_host *host)
+is_settled(struct rta_host *host)
 {
-	static union {
-		void *buf; /* re-use so we prevent leaks */
-		struct icmp *icp;
-		u_short *cksum_in;
-	} packet = { NULL };
-	long int len;
-	struct icmp_ping_data data;
-	struct msghdr hdr;
-	struct iovec iov;
-	struct timeval tv;
-	struct sockaddr *addr;
+	unsigned int n = host->icmp_recv, r, m, i, k;
+	double p_lo = 0, p_hi = 1, p, q, mean, var, bound;
+
+	if(n < ADAPTIVE_MIN_REPLIES || n >= packets) return 0;
+	if(host->flags & (FLAG_PORT_CLOSED | FLAG_IP_CONFLICT)) return 0;
+	r = packets - n;
+
+	/* losses that would make the full run reach warn.pl */
+	m = (warn.pl * packets + 99) / 100;
+	for(i = 0; i < 32; i++) {
+		p = (p_lo + p_hi) / 2;
+		for(q = 1, k = 0; k < n; k++) q *= 1 - p;
+		if(q >= ADAPTIVE_ALPHA) p_lo = p;
+		else p_hi = p;
+	}
+	if(loss_tail(m, r, p_hi) >= ADAPTIVE_ALPHA) return 0;
+
+	/* the rtt all remaining replies could have before rta reaches warn.rta */
+	mean = (double)host->time_waited / n;
+	if(mean >= warn.rta) return 0;
+	bound = ((double)warn.rta * packets - host->time_waited) / r;
+	if(host->rtmax >= bound) return 0;
+	var = (host->time_waited_sq - mean * host->time_waited) / (n - 1);
+	if(var < 0) var = 0;
+	return ADAPTIVE_Z * ADAPTIVE_Z * var < (bound - mean) * (bound - mean);
+}
 
-	if(sock == -1) {
-		errno = 0;
-		crash("Attempt to send on bogus socket");
+/* rtt for a probe, from the send time we keep on our side. Each probe
+ * is only accounted once, so duplicates yield -1 */
+static int
+get_probe_rtt(unsigned int id, struct timeval *now)
+{
+	int tdiff;
+
+	if(!probe_stime[id].tv_sec) {
+		if(debug) printf("duplicate reply for probe %u\n", id);
 		return -1;
 	}
-	addr = (struct sockaddr *)&host->saddr_in;
+	tdiff = get_timevaldiff(&probe_stime[id], now);
+	probe_stime[id].tv_sec = 0;
 
-	if(!packet.buf) {
-		if (!(packet.buf = malloc(icmp_pkt_size))) {
-			crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
-				  icmp_pkt_size);
-			return -1;	/* might be reached if we're in debug mode */
-		}
-	}
-	memset(packet.buf, 0, icmp_pkt_size);
+	return tdiff;
+}
 
-	if((gettimeofday(&tv, &tz)) == -1) return -1;
+/* raw icmpv6 sockets don't hand us the ip header */
+static int
+handle_icmp6_reply(unsigned char *buf, int n, struct sockaddr_storage *addr,
+                   struct timeval *now)
+{
+	struct icmp6_hdr icp;
+	struct rta_host *host;
+	int tdiff;
 
-	data.ping_id = 10; /* host->icmp.icmp_sent; */
-	memcpy(&data.stime, &tv, sizeof(tv));
-	memcpy(&packet.icp->icmp_data, &data, sizeof(data));
-	packet.icp->icmp_type = ICMP_ECHO;
-	packet.icp->icmp_code = 0;
-	packet.icp->icmp_cksum = 0;
-	packet.icp->icmp_id = htons(pid);
-	packet.icp->icmp_seq = htons(host->id++);
-	packet.icp->icmp_cksum = icmp_checksum(packet.cksum_in, icmp_pkt_size);
+	if(n < (int)(sizeof(icp) + sizeof(struct icmp_ping_data))) {
+		if(debug) printf("received packet too short for ICMPv6 (%d bytes) from %s\n",
+		                 n, format_addr(addr));
+		return 0;
+	}
+	memcpy(&icp, buf, sizeof(icp));
 
+	if(ntohs(icp.icmp6_id) != pid || icp.icmp6_type != ICMP6_ECHO_REPLY ||
+	   ntohs(icp.icmp6_seq) >= targets*packets) {
+		if(debug > 2) printf("not a proper ICMP6_ECHO_REPLY\n");
+		if(icp.icmp6_type != ICMP6_ECHO_REPLY)
+			handle_random_icmp6(buf, n, addr);
+		return 0;
+	}
+
+	/* this is indeed a valid response */
 	if (debug > 2)
-		printf("Sending ICMP echo-request of len %lu, id %u, seq %u, cksum 0x%X to host %s\n",
-		       (unsigned long)sizeof(data), ntohs(packet.icp->icmp_id),
-		       ntohs(packet.icp->icmp_seq), packet.icp->icmp_cksum,
-		       host->name);
+		printf("ICMPv6 echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
+		       (unsigned long)sizeof(struct icmp_ping_data), ntohs(icp.icmp6_id),
+		       ntohs(icp.icmp6_seq), icp.icmp6_cksum);
 
-	memset(&iov, 0, sizeof(iov));
-	iov.iov_base = packet.buf;
-	iov.iov_len = icmp_pkt_size;
+	host = table[ntohs(icp.icmp6_seq)/packets];
+	tdiff = get_probe_rtt(ntohs(icp.icmp6_seq), now);
+	if(tdiff < 0) return 0;
+	record_reply(host, tdiff, addr, 0);
 
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.msg_name = addr;
-	hdr.msg_namelen = sizeof(struct sockaddr);
-	hdr.msg_iov = &iov;
-	hdr.msg_iovlen = 1;
+	return 0;
+}
 
-/* MSG_CONFIRM is a linux thing and only available on linux kernels >= 2.3.15, see send(2) */
-#ifdef MSG_CONFIRM
-	len = sendmsg(sock, &hdr, MSG_CONFIRM);
-#else
-	len = sendmsg(sock, &hdr, 0);
-#endif
+/* SYN-ACK means an open port and RST a closed one, but both prove the
+ * host is alive. With -P syn the RST marks the port as closed. Anything
+ * else on the socket isn't for us */
+static int
+handle_tcp_reply(unsigned char *buf, int n, struct sockaddr_storage *addr,
+                 struct timeval *now)
+{
+	struct ip *ip = (struct ip *)buf;
+	struct tcphdr th;
+	struct rta_host *host;
+	u_int32_t seq;
+	int hlen, tdiff;
 
-	if(len < 0 || (unsigned int)len != icmp_pkt_size) {
-		if(debug) printf("Failed to send ping to %s\n",
-						 inet_ntoa(host->saddr_in.sin_addr));
-		return -1;
+	hlen = ip->ip_hl << 2;
+	if(n < hlen + (int)sizeof(th)) return 0;
+	memcpy(&th, buf + hlen, sizeof(th));
+
+	if(ntohs(th.th_dport) != src_port || !(th.th_flags & TH_ACK))
+		return 0;
+
+	seq = ntohl(th.th_ack) - 1;
+	if(seq >> 16 != (u_int32_t)pid || (seq & 0xffff) >= (u_int32_t)targets*packets)
+		return 0;
+
+	host = table[(seq & 0xffff) / packets];
+	if(SA_IN(&host->saddr_in)->sin_addr.s_addr != SA_IN(addr)->sin_addr.s_addr ||
+	   ntohs(th.th_sport) != host->port)
+	{
+		return 0;
 	}
 
-	icmp_sent++;
-	host->icmp_sent++;
+	if(debug > 2) {
+		printf("TCP %s from %s, ack %u\n",
+		       (th.th_flags & TH_SYN) ? "SYN-ACK" : "RST",
+		       format_addr(addr), seq + 1);
+	}
+
+	/* tear down the half-open connection so the target can drop it */
+	if(th.th_flags & TH_SYN) send_tcp_rst(host, &th);
+	else if(port_state) host->flags |= FLAG_PORT_CLOSED;
+
+	if((tdiff = get_probe_rtt(seq & 0xffff, now)) >= 0)
+		record_reply(host, tdiff, addr, ip->ip_ttl);
 
 	return 0;
 }
 
+/* an actual udp answer from the probed port is as good as an unreachable */
 static int
-recvfrom_wto(int sock, void *buf, unsigned int len, struct sockaddr *saddr,
-			 u_int *timo, struct timeval* tv)
+handle_udp_reply(unsigned char *buf, int n, struct sockaddr_storage *addr,
+                 struct timeval *now)
 {
-	u_int slen;
-	int n, ret;
-	struct timeval to, then, now;
+	struct ip *ip = (struct ip *)buf;
+	struct udphdr uh;
+	struct rta_host *host;
+	unsigned int id;
+	int hlen, tdiff;
+
+	hlen = ip->ip_hl << 2;
+	if(n < hlen + (int)sizeof(uh)) return 0;
+	memcpy(&uh, buf + hlen, sizeof(uh));
+
+	if(ntohs(uh.uh_sport) != probe_port) return 0;
+
+	id = (ntohs(uh.uh_dport) + UDP_SPORT_RANGE - UDP_SPORT_BASE -
+	      pid % UDP_SPORT_RANGE) % UDP_SPORT_RANGE;
+	if(id >= (unsigned int)targets*packets) return 0;
+
+	host = table[id / packets];
+	if(SA_IN(&host->saddr_in)->sin_addr.s_addr != SA_IN(addr)->sin_addr.s_addr)
+		return 0;
+
+	if((tdiff = get_probe_rtt(id, now)) >= 0)
+		record_reply(host, tdiff, addr, ip->ip_ttl);
+
+	return 0;
+}
+
+/* arp has no sequence numbers, so a reply is accounted to the oldest
+ * request to its sender that's still unanswered. More than one mac
+ * answering for the same ip means an address conflict */
+static int
+handle_arp_reply(unsigned char *buf, int n, struct timeval *now)
+{
+#if defined(__linux__)
+	struct ether_arp ea;
+	struct sockaddr_storage addr;
+	struct rta_host *host;
+	unsigned int id;
+	int tdiff;
+
+	if(n < (int)sizeof(ea)) return 0;
+	memcpy(&ea, buf, sizeof(ea));
+	if(ntohs(ea.arp_op) != ARPOP_REPLY) return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.ss_family = AF_INET;
+	memcpy(&SA_IN(&addr)->sin_addr, ea.arp_spa, sizeof(struct in_addr));
+	if(!(host = ip_hash_find(&addr))) return 0;
+
+	if(!(host->flags & FLAG_HWADDR)) {
+		memcpy(host->hwaddr, ea.arp_sha, sizeof(host->hwaddr));
+		host->flags |= FLAG_HWADDR;
+	}
+	else if(memcmp(host->hwaddr, ea.arp_sha, sizeof(host->hwaddr))) {
+		if(debug) printf("IP conflict for %s\n", host->name);
+		memcpy(host->conflict_hwaddr, ea.arp_sha, sizeof(host->conflict_hwaddr));
+		host->flags |= FLAG_IP_CONFLICT;
+		return 0;
+	}
+
+	for(id = host->id - host->icmp_sent; id < host->id; id++) {
+		if(probe_stime[id].tv_sec) break;
+	}
+	if(id == host->id) {
+		if(debug) printf("unsolicited arp reply from %s\n", host->name);
+		return 0;
+	}
+
+	if((tdiff = get_probe_rtt(id, now)) >= 0)
+		record_reply(host, tdiff, &addr, 0);
+#endif
+
+	return 0;
+}
+
+/* the ping functions */
+static int
+send_probe(struct rta_host *host)
+{
+	if(protocols & HAVE_TCP) return send_tcp_syn(tcp_sock, host);
+	if(protocols & HAVE_UDP) return send_udp_probe(udp_sock, host);
+	if(protocols & HAVE_ARP) return send_arp_request(arp_sock, host);
+
+	if(host->saddr_in.ss_family == AF_INET6)
+		return send_icmp6_ping(icmp6_sock, host);
+
+	return send_icmp_ping(icmp_sock, host);
+}
+
+static int
+send_icmp_ping(int sock, struct rta_host *host)
+{
+	static union {
+		void *buf; /* re-use so we prevent leaks */
+		struct icmp *icp;
+		u_short *cksum_in;
+	} packet = { NULL };
+	struct icmp_ping_data data;
+	struct timeval tv;
+
+	if(!packet.buf) {
+		if (!(packet.buf = malloc(icmp_pkt_size))) {
+			crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
+				  icmp_pkt_size);
+			return -1;	/* might be reached if we're in debug mode */
+		}
+	}
+	memset(packet.buf, 0, icmp_pkt_size);
+
+	if((gettimeofday(&tv, &tz)) == -1) return -1;
+
+	data.ping_id = 10; /* host->icmp.icmp_sent; */
+	memcpy(&data.stime, &tv, sizeof(tv));
+	memcpy(&probe_stime[host->id], &tv, sizeof(tv));
+	memcpy(&packet.icp->icmp_data, &data, sizeof(data));
+	packet.icp->icmp_type = ICMP_ECHO;
+	packet.icp->icmp_code = 0;
+	packet.icp->icmp_cksum = 0;
+	packet.icp->icmp_id = htons(pid);
+	packet.icp->icmp_seq = htons(host->id++);
+	packet.icp->icmp_cksum = icmp_checksum(packet.cksum_in, icmp_pkt_size);
+
+	if (debug > 2)
+		printf("Sending ICMP echo-request of len %lu, id %u, seq %u, cksum 0x%X to host %s\n",
+		       (unsigned long)sizeof(data), ntohs(packet.icp->icmp_id),
+		       ntohs(packet.icp->icmp_seq), packet.icp->icmp_cksum,
+		       host->name);
+
+	return send_packet(sock, host, packet.buf, icmp_pkt_size,
+	                   (struct sockaddr *)&host->saddr_in, sizeof(struct sockaddr_in));
+}
+
+/* the kernel fills in icmpv6 checksums, since they cover the ip header */
+static int
+send_icmp6_ping(int sock, struct rta_host *host)
+{
+	static unsigned char *buf = NULL;
+	struct icmp6_hdr *icp;
+	struct icmp_ping_data data;
+	struct timeval tv;
+
+	if(!buf) {
+		if (!(buf = malloc(icmp_pkt_size))) {
+			crash("send_icmp6_ping(): failed to malloc %d bytes for send buffer",
+				  icmp_pkt_size);
+			return -1;	/* might be reached if we're in debug mode */
+		}
+	}
+	memset(buf, 0, icmp_pkt_size);
+
+	if((gettimeofday(&tv, &tz)) == -1) return -1;
+
+	data.ping_id = 10;
+	memcpy(&data.stime, &tv, sizeof(tv));
+	memcpy(&probe_stime[host->id], &tv, sizeof(tv));
+	icp = (struct icmp6_hdr *)buf;
+	memcpy(buf + sizeof(*icp), &data, sizeof(data));
+	icp->icmp6_type = ICMP6_ECHO_REQUEST;
+	icp->icmp6_code = 0;
+	icp->icmp6_id = htons(pid);
+	icp->icmp6_seq = htons(host->id++);
+
+	if (debug > 2)
+		printf("Sending ICMPv6 echo-request of len %lu, id %u, seq %u to host %s\n",
+		       (unsigned long)sizeof(data), ntohs(icp->icmp6_id),
+		       ntohs(icp->icmp6_seq), host->name);
+
+	return send_packet(sock, host, buf, icmp_pkt_size,
+	                   (struct sockaddr *)&host->saddr_in, sizeof(struct sockaddr_in6));
+}
+
+static int
+send_tcp_syn(int sock, struct rta_host *host)
+{
+	struct {
+		struct tcphdr th;
+		unsigned char mss[4];
+	} pkt;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.th.th_sport = htons(src_port);
+	pkt.th.th_dport = htons(host->port);
+	/* the pid marks the probe as ours, like the icmp id does */
+	pkt.th.th_seq = htonl(((u_int32_t)pid << 16) | host->id);
+	pkt.th.th_off = sizeof(pkt) >> 2;
+	pkt.th.th_flags = TH_SYN;
+	pkt.th.th_win = htons(65535);
+	/* some stacks silently drop SYN's without options */
+	pkt.mss[0] = TCPOPT_MAXSEG;
+	pkt.mss[1] = TCPOLEN_MAXSEG;
+	pkt.mss[2] = 1460 >> 8;
+	pkt.mss[3] = 1460 & 0xff;
+	pkt.th.th_sum = transport_checksum(host, IPPROTO_TCP, &pkt, sizeof(pkt));
+
+	if (debug > 2)
+		printf("Sending TCP SYN, sport %u, seq %u to host %s port %u\n",
+		       src_port, ntohl(pkt.th.th_seq), host->name, host->port);
+
+	if(gettimeofday(&probe_stime[host->id], &tz) == -1) return -1;
+	host->id++;
+
+	return send_packet(sock, host, &pkt, sizeof(pkt),
+	                   (struct sockaddr *)&host->saddr_in, sizeof(struct sockaddr_in));
+}
+
+static void
+send_tcp_rst(struct rta_host *host, struct tcphdr *reply)
+{
+	struct tcphdr th;
+
+	memset(&th, 0, sizeof(th));
+	th.th_sport = reply->th_dport;
+	th.th_dport = reply->th_sport;
+	th.th_seq = reply->th_ack;
+	th.th_off = sizeof(th) >> 2;
+	th.th_flags = TH_RST;
+	th.th_sum = transport_checksum(host, IPPROTO_TCP, &th, sizeof(th));
+
+	if(sendto(tcp_sock, &th, sizeof(th), 0, (struct sockaddr *)&host->saddr_in,
+	          sizeof(struct sockaddr_in)) == -1)
+	{
+		if(debug) printf("Failed to send RST to %s\n", host->name);
+		return;
+	}
+	tx_log_add(tcp_sock, -1);
+}
+
+static int
+send_udp_probe(int sock, struct rta_host *host)
+{
+	static struct udphdr *uh = NULL;
+	unsigned short len = sizeof(struct udphdr) + icmp_data_size;
+
+	if(!uh) {
+		if (!(uh = malloc(len))) {
+			crash("send_udp_probe(): failed to malloc %d bytes for send buffer",
+				  len);
+			return -1;	/* might be reached if we're in debug mode */
+		}
+	}
+	memset(uh, 0, len);
+
+	uh->uh_sport = htons(UDP_SPORT_BASE + (pid + host->id) % UDP_SPORT_RANGE);
+	uh->uh_dport = htons(probe_port);
+	uh->uh_ulen = htons(len);
+	uh->uh_sum = transport_checksum(host, IPPROTO_UDP, uh, len);
+	/* zero means "no checksum" for udp */
+	if(!uh->uh_sum) uh->uh_sum = 0xffff;
+
+	if (debug > 2)
+		printf("Sending UDP probe of len %u, sport %u to host %s port %u\n",
+		       len, ntohs(uh->uh_sport), host->name, probe_port);
+
+	if(gettimeofday(&probe_stime[host->id], &tz) == -1) return -1;
+	host->id++;
+
+	return send_packet(sock, host, uh, len,
+	                   (struct sockaddr *)&host->saddr_in, sizeof(struct sockaddr_in));
+}
+
+static int
+send_arp_request(int sock, struct rta_host *host)
+{
+#if defined(__linux__)
+	struct ether_arp ea;
+
+	memset(&ea, 0, sizeof(ea));
+	ea.arp_hrd = htons(ARPHRD_ETHER);
+	ea.arp_pro = htons(ETHERTYPE_IP);
+	ea.arp_hln = sizeof(ea.arp_sha);
+	ea.arp_pln = sizeof(ea.arp_spa);
+	ea.arp_op = htons(ARPOP_REQUEST);
+	memcpy(ea.arp_sha, arp_hwaddr, sizeof(ea.arp_sha));
+	memcpy(ea.arp_spa, &host->src_addr, sizeof(ea.arp_spa));
+	memcpy(ea.arp_tpa, &SA_IN(&host->saddr_in)->sin_addr, sizeof(ea.arp_tpa));
+
+	if (debug > 2)
+		printf("Sending ARP who-has for host %s\n", host->name);
+
+	if(gettimeofday(&probe_stime[host->id], &tz) == -1) return -1;
+	host->id++;
+
+	return send_packet(sock, host, &ea, sizeof(ea),
+	                   (struct sockaddr *)&arp_dest, sizeof(arp_dest));
+#else
+	return -1;
+#endif
+}
+
+static int
+send_packet(int sock, struct rta_host *host, void *buf, size_t size,
+            struct sockaddr *addr, socklen_t addrlen)
+{
+	long int len;
+	struct msghdr hdr;
+	struct iovec iov;
+
+	if(sock == -1) {
+		errno = 0;
+		crash("Attempt to send on bogus socket");
+		return -1;
+	}
+
+	memset(&iov, 0, sizeof(iov));
+	iov.iov_base = buf;
+	iov.iov_len = size;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_name = addr;
+	hdr.msg_namelen = addrlen;
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+
+/* MSG_CONFIRM is a linux thing and only available on linux kernels >= 2.3.15, see send(2) */
+#ifdef MSG_CONFIRM
+	len = sendmsg(sock, &hdr, MSG_CONFIRM);
+#else
+	len = sendmsg(sock, &hdr, 0);
+#endif
+
+	if(len < 0 || (size_t)len != size) {
+		if(debug) printf("Failed to send ping to %s\n",
+						 format_addr(&host->saddr_in));
+		return -1;
+	}
+
+	icmp_sent++;
+	host->icmp_sent++;
+	/* all senders have moved on to the next id by now */
+	tx_log_add(sock, host->id - 1);
+
+	return 0;
+}
+
+/* Have the kernel timestamp outgoing packets as they're handed to the
+ * driver and incoming ones as they arrive, so time spent in our own
+ * process and the socket layer doesn't count towards the rtt. Falls back
+ * to receive timestamps only on systems without SO_TIMESTAMPING */
+static void
+set_timestamping(int sock)
+{
+#ifdef TX_TIMESTAMPS
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+		SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+		SOF_TIMESTAMPING_OPT_TSONLY;
+#endif
+#ifdef SO_TIMESTAMP
+	int on = 1;
+#endif
+
+	if(sock == -1) return;
+
+#ifdef TX_TIMESTAMPS
+	if(!setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+		memset(&tx_logs[tx_log_count], 0, sizeof(tx_log));
+		tx_logs[tx_log_count++].sock = sock;
+		return;
+	}
+	if(debug) printf("Warning: no SO_TIMESTAMPING support\n");
+#endif
+#ifdef SO_TIMESTAMP
+	if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)))
+		if(debug) printf("Warning: no SO_TIMESTAMP support\n");
+#endif
+}
+
+/* remember which probe (or -1 for other packets) a send on sock was */
+static void
+tx_log_add(int sock, int id)
+{
+#ifdef TX_TIMESTAMPS
+	unsigned int i;
+	tx_log *log;
+
+	for(i = 0; i < tx_log_count && tx_logs[i].sock != sock; i++);
+	if(i == tx_log_count) return;
+	log = &tx_logs[i];
+
+	if(log->sent == log->size) {
+		log->size = log->size ? log->size * 2 : targets * packets;
+		log->id = realloc(log->id, log->size * sizeof(int));
+		if(!log->id) crash("failed to allocate %u send records", log->size);
+	}
+	log->id[log->sent++] = id;
+#endif
+}
+
+/* pick up the kernel's transmit timestamps from the error queue and use
+ * them as send time for probes that haven't been answered yet */
+static void
+read_tx_timestamps(int sock)
+{
+#ifdef TX_TIMESTAMPS
+	unsigned int i;
+	int id;
+	u_int lag;
+	char ctl[512];
+	struct msghdr hdr;
+	struct cmsghdr *chdr;
+	struct timespec *ts;
+	struct sock_extended_err *ee;
+	struct timeval ktx;
+	tx_log *log;
+
+	for(i = 0; i < tx_log_count && tx_logs[i].sock != sock; i++);
+	if(i == tx_log_count) return;
+	log = &tx_logs[i];
+
+	for(;;) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_control = ctl;
+		hdr.msg_controllen = sizeof(ctl);
+		if(recvmsg(sock, &hdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+		ts = NULL;
+		ee = NULL;
+		for(chdr = CMSG_FIRSTHDR(&hdr); chdr; chdr = CMSG_NXTHDR(&hdr, chdr)) {
+			if(chdr->cmsg_level == SOL_SOCKET && chdr->cmsg_type == SCM_TIMESTAMPING)
+				ts = (struct timespec *)CMSG_DATA(chdr);
+			/* IP_RECVERR, IPV6_RECVERR or PACKET_TX_TIMESTAMP */
+			else if(chdr->cmsg_len >= CMSG_LEN(sizeof(*ee)))
+				ee = (struct sock_extended_err *)CMSG_DATA(chdr);
+		}
+		if(!ts || !ee || ee->ee_errno != ENOMSG ||
+		   ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+		   ee->ee_data >= log->sent)
+		{
+			continue;
+		}
+
+		id = log->id[ee->ee_data];
+		if(id < 0 || !probe_stime[id].tv_sec) continue;
+
+		ktx.tv_sec = ts[0].tv_sec;
+		ktx.tv_usec = ts[0].tv_nsec / 1000;
+		lag = get_timevaldiff(&probe_stime[id], &ktx);
+		tx_lag_total += lag;
+		tx_lag_count++;
+		if(lag > tx_lag_max) tx_lag_max = lag;
+		if(debug > 2) printf("probe %d hit the wire %u usecs after sendmsg()\n", id, lag);
+
+		probe_stime[id] = ktx;
+	}
+#endif
+}
+
+/* have the kernel drop echo replies to other processes (or workers), and
+ * our own requests when pinging localhost */
+static void
+set_icmp_filter(void)
+{
+#if defined(__linux__)
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_IND, offsetof(struct icmp, icmp_type)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 2, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO, 4, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, offsetof(struct icmp, icmp_id)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1), /* our id */
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	/* raw icmpv6 sockets start at the icmp header */
+	struct sock_filter code6[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct icmp6_hdr, icmp6_type)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct icmp6_hdr, icmp6_id)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1), /* our id */
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog filter;
+	char buf[64];
+
+	if(icmp_sock != -1) {
+		code[6].k = pid;
+		filter.len = sizeof(code) / sizeof(code[0]);
+		filter.filter = code;
+		if(setsockopt(icmp_sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)))
+			if(debug) printf("Warning: failed to attach icmp filter\n");
+	}
+	if(icmp6_sock != -1) {
+		code6[4].k = pid;
+		filter.len = sizeof(code6) / sizeof(code6[0]);
+		filter.filter = code6;
+		if(setsockopt(icmp6_sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)))
+			if(debug) printf("Warning: failed to attach icmpv6 filter\n");
+	}
+
+	/* the sockets have been open since startup, so get rid of whatever
+	 * came in before the filters were in place */
+	if(icmp_sock != -1)
+		while(recv(icmp_sock, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+	if(icmp6_sock != -1)
+		while(recv(icmp6_sock, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+#endif
+}
+
+/* replies to a sweep (and with them the transmit timestamps) can pile up
+ * faster than we read them, so make room for all of them if we may */
+static void
+set_rcvbuf(void)
+{
+	int i, want, have;
+	socklen_t len;
+
+	want = targets * packets * 2048;
+	for(i = 0; i < WORKER_SOCKS; i++) {
+		if(*probe_socks[i] == -1) continue;
+		len = sizeof(have);
+		if(getsockopt(*probe_socks[i], SOL_SOCKET, SO_RCVBUF, &have, &len) ||
+		   have >= want)
+		{
+			continue;
+		}
+		/* silently capped at net.core.rmem_max */
+		setsockopt(*probe_socks[i], SOL_SOCKET, SO_RCVBUF, &want, sizeof(want));
+	}
+}
+
+/* -R pps[,burst] */
+static void
+set_rate(char *arg)
+{
+	char *burst;
+	unsigned long rate;
+
+#ifndef RATE_BUDGET
+	usage_va(_("-R is not supported on this system"));
+#endif
+	if((burst = strchr(arg, ',')))
+		*burst++ = '\0';
+	if(!is_intpos(arg) || (rate = strtoul(arg, NULL, 10)) > 1000000)
+		usage_va(_("Invalid packet rate: %s"), arg);
+	rate_interval = 1000000 / rate;
+
+	/* by default, up to a tenth of a second's worth can go out at once */
+	rate_burst = rate / 10 ? rate / 10 : 1;
+	if(burst) {
+		if(!is_intpos(burst))
+			usage_va(_("Invalid burst size: %s"), burst);
+		rate_burst = strtoul(burst, NULL, 10);
+	}
+}
+
+static void
+rate_setup(void)
+{
+#ifdef RATE_BUDGET
+	int fd;
+	void *p;
+
+	/* whoever comes first creates it. It's zero filled, i.e. full. Normally
+	 * main() opened it already, but -R may have come from the extra opts */
+	if((fd = rate_fd) == -1 && !(errno = rate_errno))
+		fd = shm_open(RATE_SHM_NAME, O_RDWR | O_CREAT, 0600);
+	if(fd == -1)
+		crash("Failed to open shared memory %s", RATE_SHM_NAME);
+	if(ftruncate(fd, sizeof(rate_bucket)) == -1)
+		crash("Failed to size shared memory %s", RATE_SHM_NAME);
+	p = mmap(NULL, sizeof(rate_bucket), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED)
+		crash("Failed to map shared memory %s", RATE_SHM_NAME);
+	close(fd);
+	rate_shm = p;
+
+	if(debug) {
+		printf("packet rate budget: %u pps, burst %u\n",
+		       1000000 / rate_interval, rate_burst);
+	}
+#endif
+}
+
+/* take a token from the shared budget, waiting for one if need be. Replies
+ * are still read in the meantime */
+static void
+rate_wait(void)
+{
+#ifdef RATE_BUDGET
+	unsigned long long old, now, slot, floor, burst;
+	struct timespec ts;
+	struct timeval until, tv;
+	u_int delay;
+
+	burst = (unsigned long long)rate_burst * rate_interval;
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		old = rate_shm->tat;
+		/* unused budget only piles up to the burst size */
+		floor = now > burst ? now - burst : 0;
+		slot = old > floor ? old : floor;
+	} while(!__sync_bool_compare_and_swap(&rate_shm->tat, old, slot + rate_interval));
+
+	if(slot <= now) return;
+	delay = slot - now;
+	if(debug > 2) printf("waiting %u usecs for the packet rate budget\n", delay);
+
+	gettimeofday(&until, &tz);
+	until.tv_sec += (until.tv_usec + delay) / 1000000;
+	until.tv_usec = (until.tv_usec + delay) % 1000000;
+	for(;;) {
+		gettimeofday(&tv, &tz);
+		if(!(delay = get_timevaldiff(&tv, &until))) break;
+		if(icmp_pkts_en_route) wait_for_reply(delay);
+		else usleep(delay);
+	}
+#endif
+}
+
+/* some options are needed before privileges are dropped, which is before
+ * the arguments are parsed for real. Returns the argument of the last -opt,
+ * also when it's grouped with other flags as in -vj4, or NULL */
+static const char *
+find_opt_arg(int argc, char **argv, int opt)
+{
+	const char *found = NULL, *arg, *p, *o;
+	int i;
+
+	for(i = 1; i < argc; i++) {
+		if(argv[i][0] != '-' || argv[i][1] == '-' || !argv[i][1]) {
+			if(!strcmp(argv[i], "--")) break;
+			continue;
+		}
+		for(p = &argv[i][1]; *p; p++) {
+			if(*p == ':' || !(o = strchr(ICMP_OPTS, *p)) || o[1] != ':')
+				continue;
+			/* the rest of the group, or else the next word, is its argument */
+			arg = p[1] ? p + 1 : argv[++i];
+			if(*p == opt && arg) found = arg;
+			break;
+		}
+	}
+
+	return found;
+}
+
+/* the number of workers has to be known before privileges are dropped.
+ * 0 means one per cpu */
+static int
+get_workers(int argc, char **argv)
+{
+	int n = 1;
+	const char *arg;
+
+	if((arg = find_opt_arg(argc, argv, 'j'))) {
+		n = atoi(arg);
+		if(!n) n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(n < 1) n = 1;
+	if(n > MAX_WORKERS) n = MAX_WORKERS;
+
+	return n;
+}
+
+/* a full set of sockets for each worker except the first, which uses
+ * the ones we already have */
+static void
+open_worker_sockets(void)
+{
+	int w, i, sock;
+
+	worker_socks = calloc(workers, sizeof(*worker_socks));
+	worker_pids = calloc(workers, sizeof(pid_t));
+	if(!worker_socks || !worker_pids)
+		crash("failed to allocate %d workers", workers);
+
+	for(w = 1; w < workers; w++) {
+		for(i = 0; i < WORKER_SOCKS; i++) {
+			worker_socks[w][i] = -1;
+			if(*probe_socks[i] == -1) continue;
+			switch(i) {
+			case 0: sock = socket(PF_INET, SOCK_RAW, IPPROTO_ICMP); break;
+			case 1: sock = socket(PF_INET6, SOCK_RAW, IPPROTO_ICMPV6); break;
+			case 2: sock = socket(PF_INET, SOCK_RAW, IPPROTO_UDP); break;
+			case 3: sock = socket(PF_INET, SOCK_RAW, IPPROTO_TCP); break;
+#if defined(__linux__)
+			case 4: sock = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ARP)); break;
+#endif
+			default: sock = -1; break;
+			}
+			if((worker_socks[w][i] = sock) == -1) break;
+		}
+
+		/* out of descriptors, most likely. Make do with what we have */
+		if(i < WORKER_SOCKS) {
+			while(i--) {
+				if(worker_socks[w][i] != -1) close(worker_socks[w][i]);
+			}
+			break;
+		}
+	}
+	worker_sets = workers = w;
+}
+
+/* fork off the workers and have each of them (us included) keep only its
+ * own sockets and share of the targets */
+static void
+start_workers(void)
+{
+	int w, i;
+	pid_t child;
+	size_t size;
+	void *shm;
+
+	all_targets = targets;
+	if(workers > 1) {
+		size = workers * sizeof(worker_stats) + targets * sizeof(struct rta_host);
+		shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(shm == MAP_FAILED)
+			crash("failed to map %lu bytes for worker results", (unsigned long)size);
+		shard_stats = shm;
+		shard_hosts = (struct rta_host *)(shard_stats + workers);
+
+		/* or buffered output shows up once per worker */
+		fflush(stdout);
+		for(w = 1; w < workers; w++) {
+			if((child = fork()) == -1)
+				crash("failed to start worker %d", w);
+			if(!child) {
+				worker = w;
+				break;
+			}
+			worker_pids[w] = child;
+		}
+	}
+
+	for(w = 1; w < worker_sets; w++) {
+		if(w == worker) continue;
+		for(i = 0; i < WORKER_SOCKS; i++) {
+			if(worker_socks[w][i] != -1) close(worker_socks[w][i]);
+		}
+	}
+	if(worker) {
+		for(i = 0; i < WORKER_SOCKS; i++) {
+			if(*probe_socks[i] != -1) close(*probe_socks[i]);
+			*probe_socks[i] = worker_socks[worker][i];
+		}
+		/* a pid of our own tells our packets from the other workers' */
+		pid = getpid() & 0xffff;
+		src_port = 0x8000 | (pid & 0x7fff);
+	}
+
+	targets = (all_targets - worker + workers - 1) / workers;
+	if(debug && workers > 1)
+		printf("worker %d: %u of %u targets\n", worker, targets, all_targets);
+}
+
+/* hand our share of the results to the parent and bow out. The target
+ * list was set up before forking, so it's the same in all processes */
+static void
+publish_results(void)
+{
+	struct rta_host *host;
+	worker_stats *ws = &shard_stats[worker];
+	unsigned int i;
+
+	for(i = 0, host = list; host; i++, host = host->next) {
+		if(i % workers == (unsigned int)worker) shard_hosts[i] = *host;
+	}
+	ws->icmp_sent = icmp_sent;
+	ws->icmp_recv = icmp_recv;
+	ws->icmp_lost = icmp_lost;
+	ws->tx_lag_total = tx_lag_total;
+	ws->tx_lag_max = tx_lag_max;
+	ws->tx_lag_count = tx_lag_count;
+
+	fflush(stdout);
+	_exit(0);
+}
+
+/* wait for the workers and merge their results into ours */
+static void
+collect_workers(int sig)
+{
+	struct rta_host *host;
+	worker_stats *ws;
+	unsigned int i;
+	int w, wstatus;
+
+	for(w = 1; w < workers; w++) {
+		/* have them wrap up too if we're being cut short */
+		if(sig) kill(worker_pids[w], SIGTERM);
+		while(waitpid(worker_pids[w], &wstatus, 0) == -1) {
+			if(errno != EINTR) crash("failed to wait for worker %d", w);
+		}
+		/* a worker that failed has already said why */
+		if(WIFEXITED(wstatus) && WEXITSTATUS(wstatus))
+			exit(WEXITSTATUS(wstatus));
+		if(!WIFEXITED(wstatus)) {
+			errno = 0;
+			crash("worker %d died", w);
+		}
+
+		ws = &shard_stats[w];
+		icmp_sent += ws->icmp_sent;
+		icmp_recv += ws->icmp_recv;
+		icmp_lost += ws->icmp_lost;
+		tx_lag_total += ws->tx_lag_total;
+		tx_lag_count += ws->tx_lag_count;
+		if(ws->tx_lag_max > tx_lag_max) tx_lag_max = ws->tx_lag_max;
+	}
+
+	targets = all_targets;
+	targets_down = 0;
+	for(i = 0, host = list; host; i++, host = host->next) {
+		if(i % workers) *host = shard_hosts[i];
+		if(host->flags & FLAG_LOST_CAUSE) targets_down++;
+	}
+}
+
+static int
+recvfrom_wto(int *sock, void *buf, unsigned int len, struct sockaddr *saddr,
+			 u_int *timo, struct timeval* tv)
+{
+	u_int slen;
+	int n, ret, maxfd, i;
+	int socks[5];
+	struct timeval to, then, now;
 	fd_set rd, wr;
 	char ans_data[4096];
 	struct msghdr hdr;
 	struct iovec iov;
-#ifdef SO_TIMESTAMP
+#if defined(SO_TIMESTAMP) || defined(TX_TIMESTAMPS)
 	struct cmsghdr* chdr;
 #endif
 
@@ -922,44 +2299,87 @@ recvfrom_wto(int sock, void *buf, unsigned int len, struct sockaddr *saddr,
 	to.tv_sec = *timo / 1000000;
 	to.tv_usec = (*timo - (to.tv_sec * 1000000));
 
+	/* replies to tcp, udp and arp probes come in on their own socket,
+	 * but errors may still arrive as icmp */
+	socks[0] = icmp_sock;
+	socks[1] = tcp_sock;
+	socks[2] = udp_sock;
+	socks[3] = arp_sock;
+	socks[4] = icmp6_sock;
 	FD_ZERO(&rd);
 	FD_ZERO(&wr);
-	FD_SET(sock, &rd);
+	maxfd = -1;
+	for(i = 0; i < 5; i++) {
+		if(socks[i] == -1) continue;
+		FD_SET(socks[i], &rd);
+		if(socks[i] > maxfd) maxfd = socks[i];
+	}
 	errno = 0;
 	gettimeofday(&then, &tz);
-	n = select(sock + 1, &rd, &wr, NULL, &to);
+	n = select(maxfd + 1, &rd, &wr, NULL, &to);
 	if(n < 0) crash("select() in recvfrom_wto");
 	gettimeofday(&now, &tz);
 	*timo = get_timevaldiff(&then, &now);
 
 	if(!n) return 0;				/* timeout */
 
-	slen = sizeof(struct sockaddr);
+	/* transmit timestamps make a socket readable too. Pick them up first,
+	 * so the send times are in place before we look at any replies */
+	for(i = 0; i < 5; i++) {
+		if(socks[i] != -1 && FD_ISSET(socks[i], &rd))
+			read_tx_timestamps(socks[i]);
+	}
+
+	slen = sizeof(struct sockaddr_storage);
 
 	memset(&iov, 0, sizeof(iov));
 	iov.iov_base = buf;
 	iov.iov_len = len;
 
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.msg_name = saddr;
-	hdr.msg_namelen = slen;
-	hdr.msg_iov = &iov;
-	hdr.msg_iovlen = 1;
-	hdr.msg_control = ans_data;
-	hdr.msg_controllen = sizeof(ans_data);
+	ret = -1;
+	for(i = 0; i < 5; i++) {
+		if(socks[i] == -1 || !FD_ISSET(socks[i], &rd)) continue;
+		*sock = socks[i];
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = saddr;
+		hdr.msg_namelen = slen;
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = ans_data;
+		hdr.msg_controllen = sizeof(ans_data);
+
+		ret = recvmsg(*sock, &hdr, MSG_DONTWAIT);
+		if(ret >= 0 || errno != EAGAIN) break;
+	}
+	/* nothing but timestamps this time around */
+	if(ret < 0 && errno == EAGAIN) return 0;
 
-	ret = recvmsg(sock, &hdr, 0);
-#ifdef SO_TIMESTAMP
+#if defined(SO_TIMESTAMP) || defined(TX_TIMESTAMPS)
 	for(chdr = CMSG_FIRSTHDR(&hdr); chdr; chdr = CMSG_NXTHDR(&hdr, chdr)) {
-		if(chdr->cmsg_level == SOL_SOCKET
-		   && chdr->cmsg_type == SO_TIMESTAMP
+		if(chdr->cmsg_level != SOL_SOCKET) continue;
+#ifdef TX_TIMESTAMPS
+		if(chdr->cmsg_type == SCM_TIMESTAMPING
+		   && chdr->cmsg_len >= CMSG_LEN(sizeof(struct timespec))) {
+			struct timespec ts;
+
+			memcpy(&ts, CMSG_DATA(chdr), sizeof(ts));
+			if(!ts.tv_sec) continue;
+			tv->tv_sec = ts.tv_sec;
+			tv->tv_usec = ts.tv_nsec / 1000;
+			break;
+		}
+#endif
+#ifdef SO_TIMESTAMP
+		if(chdr->cmsg_type == SO_TIMESTAMP
 		   && chdr->cmsg_len >= CMSG_LEN(sizeof(struct timeval))) {
 			memcpy(tv, CMSG_DATA(chdr), sizeof(*tv));
 			break ;
 		}
+#endif
 	}
 	if (!chdr)
-#endif // SO_TIMESTAMP
+#endif
 		gettimeofday(tv, &tz);
 	return (ret);
 }
@@ -980,13 +2400,22 @@ finish(int sig)
 	if(debug > 1) printf("finish(%d) called\n", sig);
 
 	if(icmp_sock != -1) close(icmp_sock);
+	if(icmp6_sock != -1) close(icmp6_sock);
 	if(udp_sock != -1) close(udp_sock);
 	if(tcp_sock != -1) close(tcp_sock);
 
+	if(worker) publish_results();
+	if(workers > 1) collect_workers(sig);
+
 	if(debug) {
 		printf("icmp_sent: %u  icmp_recv: %u  icmp_lost: %u\n",
 			   icmp_sent, icmp_recv, icmp_lost);
 		printf("targets: %u  targets_alive: %u\n", targets, targets_alive);
+		if(tx_lag_count) {
+			printf("kernel send lag: avg %0.3fms, max %0.3fms over %u packets\n",
+			       (float)tx_lag_total / tx_lag_count / 1000,
+			       (float)tx_lag_max / 1000, tx_lag_count);
+		}
 	}
 
 	/* iterate thrice to calculate values, give output, and print perfparse */
@@ -1007,10 +2436,11 @@ finish(int sig)
 		}
 		host->pl = pl;
 		host->rta = rta;
-		if(pl >= crit.pl || rta >= crit.rta) {
+		if(pl >= crit.pl || rta >= crit.rta || host->flags & FLAG_PORT_CLOSED) {
 			status = STATE_CRITICAL;
 		}
-		else if(!status && (pl >= warn.pl || rta >= warn.rta)) {
+		else if(!status && (pl >= warn.pl || rta >= warn.rta ||
+		                    host->flags & FLAG_IP_CONFLICT)) {
 			status = STATE_WARNING;
 			hosts_warn++;
 		}
@@ -1041,8 +2471,10 @@ finish(int sig)
 			if(host->flags & FLAG_LOST_CAUSE) {
 				printf("%s: %s @ %s. rta nan, lost %d%%",
 					   host->name,
+					   host->saddr_in.ss_family == AF_INET6 ?
+					   get_icmp6_error_msg(host->icmp_type, host->icmp_code) :
 					   get_icmp_error_msg(host->icmp_type, host->icmp_code),
-					   inet_ntoa(host->error_addr),
+					   format_addr(&host->error_addr),
 					   100);
 			}
 			else { /* not marked as lost cause, so we have no flags for it */
@@ -1053,6 +2485,12 @@ finish(int sig)
 			printf("%s: rta %0.3fms, lost %u%%",
 				   host->name, host->rta / 1000, host->pl);
 		}
+		if(host->flags & FLAG_IP_CONFLICT) {
+			printf(", IP conflict (%s",  format_hwaddr(host->hwaddr));
+			printf(" and %s)", format_hwaddr(host->conflict_hwaddr));
+		}
+		if(host->flags & FLAG_PORT_CLOSED)
+			printf(", port closed");
 
 		host = host->next;
 	}
@@ -1086,6 +2524,30 @@ finish(int sig)
 	exit(status);
 }
 
+static const char *
+format_addr(struct sockaddr_storage *addr)
+{
+	static char buf[INET6_ADDRSTRLEN];
+
+	if(addr->ss_family == AF_INET6)
+		inet_ntop(AF_INET6, &SA_IN6(addr)->sin6_addr, buf, sizeof(buf));
+	else
+		inet_ntop(AF_INET, &SA_IN(addr)->sin_addr, buf, sizeof(buf));
+
+	return buf;
+}
+
+static const char *
+format_hwaddr(unsigned char *hw)
+{
+	static char buf[18];
+
+	snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+	         hw[0], hw[1], hw[2], hw[3], hw[4], hw[5]);
+
+	return buf;
+}
+
 static u_int
 get_timevaldiff(struct timeval *early, struct timeval *later)
 {
@@ -1112,40 +2574,52 @@ get_timevaldiff(struct timeval *early, struct timeval *later)
 }
 
 static int
-add_target_ip(char *arg, struct in_addr *in)
+add_target_ip(char *arg, struct sockaddr_storage *in)
 {
 	struct rta_host *host;
 
 	/* disregard obviously stupid addresses */
-	if(in->s_addr == INADDR_NONE || in->s_addr == INADDR_ANY)
+	if(in->ss_family == AF_INET6) {
+		if(IN6_IS_ADDR_UNSPECIFIED(&SA_IN6(in)->sin6_addr))
+			return -1;
+	}
+	else if(SA_IN(in)->sin_addr.s_addr == INADDR_NONE ||
+	        SA_IN(in)->sin_addr.s_addr == INADDR_ANY)
+	{
 		return -1;
+	}
 
 	/* no point in adding two identical IP's, so don't. ;) */
-	host = list;
-	while(host) {
-		if(host->saddr_in.sin_addr.s_addr == in->s_addr) {
-			if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
-			return -1;
-		}
-		host = host->next;
+	if(ip_hash_find(in)) {
+		if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
+		return -1;
 	}
 
 	/* add the fresh ip */
 	host = malloc(sizeof(struct rta_host));
 	if(!host) {
 		crash("add_target_ip(%s, %s): malloc(%d) failed",
-			  arg, inet_ntoa(*in), sizeof(struct rta_host));
+			  arg, format_addr(in), sizeof(struct rta_host));
 	}
 	memset(host, 0, sizeof(struct rta_host));
 
 	/* set the values. use calling name for output */
 	host->name = strdup(arg);
 
-	/* fill out the sockaddr_in struct */
-	host->saddr_in.sin_family = AF_INET;
-	host->saddr_in.sin_addr.s_addr = in->s_addr;
+	/* fill out the sockaddr struct, but nothing beyond the address */
+	host->saddr_in.ss_family = in->ss_family;
+	if(in->ss_family == AF_INET6) {
+		SA_IN6(&host->saddr_in)->sin6_addr = SA_IN6(in)->sin6_addr;
+		SA_IN6(&host->saddr_in)->sin6_scope_id = SA_IN6(in)->sin6_scope_id;
+		targets_v6++;
+	}
+	else {
+		SA_IN(&host->saddr_in)->sin_addr.s_addr = SA_IN(in)->sin_addr.s_addr;
+		targets_v4++;
+	}
 
 	host->rtmin = DBL_MAX;
+	ip_hash_add(host);
 
 	if(!list) list = cursor = host;
 	else cursor->next = host;
@@ -1156,35 +2630,70 @@ add_target_ip(char *arg, struct in_addr *in)
 	return 0;
 }
 
+/* tcp probes go to host->port. Every extra -P tcp port turns each target
+ * into one more, named host:port and probed like any other, so loss and
+ * rta are reported per port. Must run before the table is built */
+static void
+expand_ports(void)
+{
+	struct rta_host *host, *clone;
+	char *name;
+	int i;
+
+	for(host = list; host; host = host->next) {
+		host->port = probe_port;
+		if(probe_port_count < 2) continue;
+
+		name = host->name;
+		if(asprintf(&host->name, "%s:%u", name, probe_ports[0]) == -1)
+			crash("failed to allocate target name");
+		for(i = probe_port_count - 1; i > 0; i--) {
+			if(!(clone = malloc(sizeof(struct rta_host))))
+				crash("expand_ports(): malloc(%d) failed", sizeof(struct rta_host));
+			memcpy(clone, host, sizeof(struct rta_host));
+			clone->port = probe_ports[i];
+			if(asprintf(&clone->name, "%s:%u", name, probe_ports[i]) == -1)
+				crash("failed to allocate target name");
+			clone->next = host->next;
+			host->next = clone;
+			if(cursor == host) cursor = clone;
+			if(clone->saddr_in.ss_family == AF_INET6) targets_v6++;
+			else targets_v4++;
+			targets++;
+		}
+		free(name);
+		/* skip the clones we just inserted */
+		for(i = 1; i < probe_port_count; i++) host = host->next;
+	}
+}
+
 /* wrapper for add_target_ip */
 static int
 add_target(char *arg)
 {
-	int i;
-	struct hostent *he;
-	struct in_addr *in, ip;
+	int error;
+	struct addrinfo hints, *res, *ai;
+	struct sockaddr_storage ss;
 
-	/* don't resolve if we don't have to */
-	if((ip.s_addr = inet_addr(arg)) != INADDR_NONE) {
-		/* don't add all ip's if we were given a specific one */
-		return add_target_ip(arg, &ip);
-		/* he = gethostbyaddr((char *)in, sizeof(struct in_addr), AF_INET); */
-		/* if(!he) return add_target_ip(arg, in); */
-	}
-	else {
+	/* a network means all host addresses in it */
+	if(strchr(arg, '/')) return add_target_net(arg);
+
+	/* numeric addresses don't get resolved, and only yield themselves */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	errno = 0;
+	if((error = getaddrinfo(arg, NULL, &hints, &res)) != 0) {
 		errno = 0;
-		he = gethostbyname(arg);
-		if(!he) {
-			errno = 0;
-			crash("Failed to resolve %s", arg);
-			return -1;
-		}
+		crash("Failed to resolve %s: %s", arg, gai_strerror(error));
+		return -1;
 	}
 
 	/* possibly add all the IP's as targets */
-	for(i = 0; he->h_addr_list[i]; i++) {
-		in = (struct in_addr *)he->h_addr_list[i];
-		add_target_ip(arg, in);
+	for(ai = res; ai; ai = ai->ai_next) {
+		memset(&ss, 0, sizeof(ss));
+		memcpy(&ss, ai->ai_addr, ai->ai_addrlen);
+		add_target_ip(arg, &ss);
 
 		/* this is silly, but it works */
 		if(mode == MODE_HOSTCHECK || mode == MODE_ALL) {
@@ -1193,6 +2702,208 @@ add_target(char *arg)
 		}
 		break;
 	}
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+/* targets are kept in an open addressed table keyed on their address,
+ * grown so it's never more than half full */
+static int
+addr_equal(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if(a->ss_family != b->ss_family) return 0;
+	if(a->ss_family == AF_INET6) {
+		return IN6_ARE_ADDR_EQUAL(&SA_IN6(a)->sin6_addr, &SA_IN6(b)->sin6_addr);
+	}
+	return SA_IN(a)->sin_addr.s_addr == SA_IN(b)->sin_addr.s_addr;
+}
+
+static unsigned int
+ip_hash_slot(struct sockaddr_storage *addr)
+{
+	u_int32_t h, w[4];
+	unsigned int i;
+
+	if(addr->ss_family == AF_INET6) {
+		memcpy(w, &SA_IN6(addr)->sin6_addr, sizeof(w));
+		h = ntohl(w[0] ^ w[1] ^ w[2] ^ w[3]);
+	}
+	else h = ntohl(SA_IN(addr)->sin_addr.s_addr);
+
+	i = (h * 2654435761U) & ip_hash_mask;
+	while(ip_hash[i] && !addr_equal(&ip_hash[i]->saddr_in, addr))
+		i = (i + 1) & ip_hash_mask;
+
+	return i;
+}
+
+static void
+ip_hash_add(struct rta_host *host)
+{
+	static unsigned int used = 0;
+	struct rta_host **old = ip_hash;
+	unsigned int i, oldsize = ip_hash ? ip_hash_mask + 1 : 0;
+
+	if(++used * 2 > oldsize) {
+		ip_hash_mask = oldsize ? oldsize * 2 - 1 : 63;
+		if(!(ip_hash = calloc(ip_hash_mask + 1, sizeof(*ip_hash))))
+			crash("failed to allocate %u hash slots", ip_hash_mask + 1);
+		for(i = 0; i < oldsize; i++) {
+			if(old[i])
+				ip_hash[ip_hash_slot(&old[i]->saddr_in)] = old[i];
+		}
+		free(old);
+	}
+
+	ip_hash[ip_hash_slot(&host->saddr_in)] = host;
+}
+
+static struct rta_host *
+ip_hash_find(struct sockaddr_storage *addr)
+{
+	if(!ip_hash) return NULL;
+	return ip_hash[ip_hash_slot(addr)];
+}
+
+/* find the interface the targets are on, bind to it and have the kernel
+ * only hand us arp replies addressed to us */
+static void
+arp_setup(void)
+{
+#if defined(__linux__)
+	struct ifaddrs *ifa_list, *ifa;
+	struct sockaddr_in *sin;
+	struct sockaddr_ll *sll, local;
+	struct rta_host *host;
+	struct in_addr src;
+	in_addr_t netmask = 0;
+	unsigned int flags = 0;
+	char ifname[IFNAMSIZ] = "";
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct arphdr, ar_pro)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 5),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct arphdr, ar_op)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REPLY, 0, 3),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct ether_arp, arp_tpa)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1), /* our address */
+		BPF_STMT(BPF_RET | BPF_K, sizeof(struct ether_arp)),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog filter;
+
+	if(getifaddrs(&ifa_list) == -1)
+		crash("Failed to get interface addresses");
+
+	/* the source address picks the interface if we have one, otherwise
+	 * the network of the first target does */
+	src.s_addr = 0;
+	for(ifa = ifa_list; ifa; ifa = ifa->ifa_next) {
+		if(!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET ||
+		   !ifa->ifa_netmask)
+		{
+			continue;
+		}
+		sin = (struct sockaddr_in *)ifa->ifa_addr;
+		netmask = ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr;
+		if(source_ip.s_addr != INADDR_ANY) {
+			if(sin->sin_addr.s_addr != source_ip.s_addr) continue;
+		}
+		else if((sin->sin_addr.s_addr ^ SA_IN(&list->saddr_in)->sin_addr.s_addr) & netmask) {
+			continue;
+		}
+		src.s_addr = sin->sin_addr.s_addr;
+		flags = ifa->ifa_flags;
+		strncpy(ifname, ifa->ifa_name, sizeof(ifname) - 1);
+		break;
+	}
+	errno = 0;
+	if(!*ifname)
+		crash("%s is not on a directly connected network", list->name);
+	if(flags & (IFF_NOARP | IFF_LOOPBACK))
+		crash("Interface %s doesn't do ARP", ifname);
+
+	for(ifa = ifa_list; ifa; ifa = ifa->ifa_next) {
+		if(ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_PACKET &&
+		   !strcmp(ifa->ifa_name, ifname))
+		{
+			break;
+		}
+	}
+	sll = ifa ? (struct sockaddr_ll *)ifa->ifa_addr : NULL;
+	if(!sll || sll->sll_halen != sizeof(arp_hwaddr))
+		crash("Failed to get ethernet address of %s", ifname);
+	memcpy(arp_hwaddr, sll->sll_addr, sizeof(arp_hwaddr));
+
+	memset(&arp_dest, 0, sizeof(arp_dest));
+	arp_dest.sll_family = AF_PACKET;
+	arp_dest.sll_protocol = htons(ETH_P_ARP);
+	arp_dest.sll_ifindex = sll->sll_ifindex;
+	arp_dest.sll_halen = sizeof(arp_hwaddr);
+	memset(arp_dest.sll_addr, 0xff, sizeof(arp_hwaddr));
+	freeifaddrs(ifa_list);
+
+	for(host = list; host; host = host->next) {
+		if((SA_IN(&host->saddr_in)->sin_addr.s_addr ^ src.s_addr) & netmask)
+			crash("%s is not on the network of %s", host->name, ifname);
+		host->src_addr.s_addr = src.s_addr;
+	}
+
+	memset(&local, 0, sizeof(local));
+	local.sll_family = AF_PACKET;
+	local.sll_protocol = htons(ETH_P_ARP);
+	local.sll_ifindex = arp_dest.sll_ifindex;
+	if(bind(arp_sock, (struct sockaddr *)&local, sizeof(local)) == -1)
+		crash("Cannot bind to interface %s", ifname);
+
+	code[5].k = ntohl(src.s_addr);
+	filter.len = sizeof(code) / sizeof(code[0]);
+	filter.filter = code;
+	if(setsockopt(arp_sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)))
+		if(debug) printf("Warning: failed to attach arp filter\n");
+
+	if(debug) {
+		printf("arp probing on %s from %s\n", ifname, inet_ntoa(src));
+	}
+#endif
+}
+
+/* add all host addresses of an ipv4 network in CIDR notation. Network and
+ * broadcast addresses are skipped, except in /31's (RFC 3021) */
+static int
+add_target_net(char *arg)
+{
+	char *net, *bits, name[INET_ADDRSTRLEN];
+	struct in_addr ip;
+	struct sockaddr_storage ss;
+	u_int32_t first, last, mask, i;
+	long prefix;
+
+	net = strdup(arg);
+	bits = strchr(net, '/');
+	*bits++ = '\0';
+	prefix = strtol(bits, NULL, 10);
+	if(!inet_aton(net, &ip) || !is_intnonneg(bits) || prefix > 32 || prefix < 16) {
+		errno = 0;
+		crash("Invalid network (only /16 to /32 supported): %s", arg);
+	}
+	free(net);
+
+	mask = prefix ? 0xffffffff << (32 - prefix) : 0;
+	first = ntohl(ip.s_addr) & mask;
+	last = first | ~mask;
+	if(prefix < 31) {
+		first++;
+		last--;
+	}
+
+	memset(&ss, 0, sizeof(ss));
+	ss.ss_family = AF_INET;
+	for(i = first; i <= last && i >= first; i++) {
+		SA_IN(&ss)->sin_addr.s_addr = htonl(i);
+		inet_ntop(AF_INET, &SA_IN(&ss)->sin_addr, name, sizeof(name));
+		add_target_ip(name, &ss);
+	}
 
 	return 0;
 }
@@ -1201,6 +2912,19 @@ static void
 set_source_ip(char *arg)
 {
 	struct sockaddr_in src;
+	struct sockaddr_in6 src6;
+
+	/* an ipv6 source address only applies to ipv6 targets */
+	memset(&src6, 0, sizeof(src6));
+	if(inet_pton(AF_INET6, arg, &src6.sin6_addr) == 1) {
+		src6.sin6_family = AF_INET6;
+		if(icmp6_sock == -1 ||
+		   bind(icmp6_sock, (struct sockaddr *)&src6, sizeof(src6)) == -1)
+		{
+			crash("Cannot bind to IP address %s", arg);
+		}
+		return;
+	}
 
 	memset(&src, 0, sizeof(src));
 	src.sin_family = AF_INET;
@@ -1208,6 +2932,87 @@ set_source_ip(char *arg)
 		src.sin_addr.s_addr = get_ip_address(arg);
 	if(bind(icmp_sock, (struct sockaddr *)&src, sizeof(src)) == -1)
 		crash("Cannot bind to IP address %s", arg);
+	if(udp_sock != -1 && bind(udp_sock, (struct sockaddr *)&src, sizeof(src)) == -1)
+		crash("Cannot bind to IP address %s", arg);
+	if(tcp_sock != -1 && bind(tcp_sock, (struct sockaddr *)&src, sizeof(src)) == -1)
+		crash("Cannot bind to IP address %s", arg);
+	source_ip.s_addr = src.sin_addr.s_addr;
+}
+
+/* tcp and udp checksums cover the source address, so ask the kernel
+ * which one it would use to reach the host, unless we're bound to one */
+static void
+get_source_addr(int sock, struct rta_host *host)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+
+	if(source_ip.s_addr != INADDR_ANY) {
+		host->src_addr.s_addr = source_ip.s_addr;
+		return;
+	}
+
+	memcpy(&sa, &host->saddr_in, sizeof(sa));
+	sa.sin_port = htons(probe_port);
+	if(connect(sock, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+	   getsockname(sock, (struct sockaddr *)&sa, &len) == -1)
+	{
+		crash("Failed to find source address for %s", host->name);
+	}
+	host->src_addr.s_addr = sa.sin_addr.s_addr;
+	if(debug > 1) printf("source address for %s is %s\n",
+	                     host->name, inet_ntoa(sa.sin_addr));
+}
+
+/* -P icmp|tcp[:port,...]|syn[:port,...]|udp[:port]|arp */
+static void
+set_protocol(char *arg)
+{
+	char *port, *next;
+
+	if((port = strchr(arg, ':'))) *port++ = '\0';
+
+	if(!strcasecmp(arg, "icmp") || !strcasecmp(arg, "arp")) {
+		protocols = strcasecmp(arg, "arp") ? HAVE_ICMP : HAVE_ARP;
+		probe_name = protocols == HAVE_ARP ? "ARP" : "ICMP";
+		if(port) usage_va(_("%s probes take no port (%s)"), probe_name, port);
+#if !defined(__linux__)
+		if(protocols == HAVE_ARP)
+			usage4(_("ARP probes are not supported on this platform"));
+#endif
+		return;
+	}
+	else if(!strcasecmp(arg, "tcp") || !strcasecmp(arg, "syn")) {
+		protocols = HAVE_TCP;
+		probe_name = "TCP";
+		probe_port = DEFAULT_TCP_PORT;
+		port_state = !strcasecmp(arg, "syn");
+	}
+	else if(!strcasecmp(arg, "udp")) {
+		protocols = HAVE_UDP;
+		probe_name = "UDP";
+		probe_port = DEFAULT_UDP_PORT;
+	}
+	else {
+		usage_va(_("Unknown probe protocol: %s"), arg);
+	}
+
+	probe_port_count = 0;
+	for(; port; port = next) {
+		if((next = strchr(port, ','))) *next++ = '\0';
+		if(!is_intpos(port) || atoi(port) > 65535)
+			usage_va(_("Invalid port number: %s"), port);
+		if(probe_port_count && protocols != HAVE_TCP)
+			usage_va(_("%s probes take a single port"), probe_name);
+		if(probe_port_count == MAX_PROBE_PORTS)
+			usage_va(_("At most %d ports can be probed"), MAX_PROBE_PORTS);
+		probe_ports[probe_port_count++] = atoi(port);
+	}
+	if(probe_port_count) probe_port = probe_ports[0];
+
+	/* one source port per process is enough for tcp, since replies are
+	 * matched on the sequence number */
+	src_port = 0x8000 | (pid & 0x7fff);
 }
 
 /* TODO: Move this to netutils.c and also change check_dhcp to use that. */
@@ -1308,6 +3113,37 @@ get_threshold(char *str, threshold *th)
 	return 0;
 }
 
+/* tcp and udp checksums include a pseudo header with the addresses */
+static unsigned short
+transport_checksum(struct rta_host *host, int proto, void *seg, int len)
+{
+	static unsigned char *buf = NULL;
+	static int buflen = 0;
+	struct {
+		struct in_addr src;
+		struct in_addr dst;
+		unsigned char zero;
+		unsigned char proto;
+		unsigned short len;
+	} ph;
+
+	if(buflen < (int)sizeof(ph) + len) {
+		buflen = sizeof(ph) + len;
+		if(!(buf = realloc(buf, buflen)))
+			crash("transport_checksum(): failed to allocate %d bytes", buflen);
+	}
+
+	ph.src.s_addr = host->src_addr.s_addr;
+	ph.dst.s_addr = SA_IN(&host->saddr_in)->sin_addr.s_addr;
+	ph.zero = 0;
+	ph.proto = proto;
+	ph.len = htons(len);
+	memcpy(buf, &ph, sizeof(ph));
+	memcpy(buf + sizeof(ph), seg, len);
+
+	return icmp_checksum((unsigned short *)buf, sizeof(ph) + len);
+}
+
 unsigned short
 icmp_checksum(unsigned short *p, int n)
 {
@@ -1347,6 +3183,10 @@ print_help(void)
 
   printf (" %s\n", "-H");
   printf ("    %s\n", _("specify a target"));
+  printf (" %s\n", "-4");
+  printf ("    %s\n", _("resolve the targets that follow to IPv4 addresses only"));
+  printf (" %s\n", "-6");
+  printf ("    %s\n", _("resolve the targets that follow to IPv6 addresses only"));
   printf (" %s\n", "-w");
   printf ("    %s", _("warning threshold (currently "));
   printf ("%0.3fms,%u%%)\n", (float)warn.rta / 1000, warn.pl);
@@ -1355,6 +3195,9 @@ print_help(void)
   printf ("%0.3fms,%u%%)\n", (float)crit.rta / 1000, crit.pl);
   printf (" %s\n", "-s");
   printf ("    %s\n", _("specify a source IP address or device name"));
+  printf (" %s\n", "-P");
+  printf ("    %s\n", _("probe protocol: icmp (default), tcp[:port,...], syn[:port,...], udp[:port]"));
+  printf ("    %s\n", _("or arp"));
   printf (" %s\n", "-n");
   printf ("    %s", _("number of packets to send (currently "));
   printf ("%u)\n",packets);
@@ -1376,6 +3219,14 @@ print_help(void)
   printf (" %s\n", "-b");
   printf ("    %s\n", _("Number of icmp data bytes to send"));
   printf ("    %s %u + %d)\n", _("Packet size will be data bytes + icmp header (currently"),icmp_data_size, ICMP_MINLEN);
+  printf (" %s\n", "-R");
+  printf ("    %s\n", _("packets per second, with an optional burst size, shared by all check_icmp"));
+  printf ("    %s\n", _("processes on this host that use -R (e.g. 1000,100)"));
+  printf (" %s\n", "-j");
+  printf ("    %s\n", _("number of worker processes to share the targets (0 for one per CPU)"));
+  printf (" %s\n", "-a");
+  printf ("    %s\n", _("adaptive: stop probing a target once the remaining packets are very unlikely"));
+  printf ("    %s\n", _("to change its OK state"));
   printf (" %s\n", "-v");
   printf ("    %s\n", _("verbose"));
 
@@ -1387,6 +3238,25 @@ print_help(void)
   printf (" %s\n", _("packet loss.  The default values should work well for most users."));
   printf (" %s\n", _("You can specify different RTA factors using the standardized abbreviations"));
   printf (" %s\n", _("us (microseconds), ms (milliseconds, default) or just plain s for seconds."));
+  printf ("\n");
+  printf (" ");
+  printf (_("TCP probes send a SYN (default port %d) and count both SYN-ACK and RST as"), DEFAULT_TCP_PORT);
+  printf ("\n %s\n", _("replies, tearing the half-open connection down again. syn probes do the same"));
+  printf (" %s\n", _("but report a closed port (RST) as critical. With several ports each host"));
+  printf (" %s\n", _("is checked once per port and reported as host:port."));
+  printf (" ");
+  printf (_("UDP probes (default port %d) count both an answer and ICMP port"), DEFAULT_UDP_PORT);
+  printf ("\n %s\n", _("unreachable as replies."));
+  printf (" %s\n", _("ARP probes only work for targets on a directly connected network and also"));
+  printf (" %s\n", _("report IP conflicts. Use e.g. -P arp -n 1 -i 0 -c 100ms for fast sweeps."));
+  printf ("\n");
+  printf (" %s\n", _("Targets may also be given as networks in CIDR notation (/16 to /32)."));
+  printf (" %s\n", _("IPv4 and IPv6 targets can be mixed, but only ICMP probes support IPv6."));
+  printf (" %s\n", _("-j speeds up sweeps of many targets. It has to be given on the command"));
+  printf (" %s\n", _("line, not in an extra-opts file."));
+  printf (" %s\n", _("With -a a target needs at least 2 replies before it is left alone. Loss is"));
+  printf (" %s\n", _("then reported over the packets actually sent. Targets close to a"));
+  printf (" %s\n", _("threshold still get every packet."));
 /* -d not yet implemented */
 /*  printf ("%s\n", _("Threshold format for -d is warn,crit.  12,14 means WARNING if >= 12 hops"));
   printf ("%s\n", _("are spent and CRITICAL if >= 14 hops are spent."));
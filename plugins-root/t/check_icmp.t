@@ -12,7 +12,7 @@ my $allow_sudo = getTestParameter( "NP_ALLOW_SUDO",
 	"no" );
 
 if ($allow_sudo eq "yes" or $> == 0) {
-	plan tests => 16;
+	plan tests => 36;
 } else {
 	plan skip_all => "Need sudo to test check_icmp";
 }
@@ -83,3 +83,66 @@ $res = NPTest->testCmd(
 is( $res->return_code, 2, "One of two host nonresponsive - two required" );
 like( $res->output, $failureOutput, "Output OK" );
 
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H $host_responsive -P tcp:1 -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "TCP probe - RST from closed port counts as alive" );
+like( $res->output, $successOutput, "Output OK" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H $host_responsive -P udp -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "UDP probe - port unreachable counts as alive" );
+like( $res->output, $successOutput, "Output OK" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H 127.0.0.1 -P syn:1,2 -w 10000ms,100% -c 10000ms,100% -n 1"
+	);
+is( $res->return_code, 2, "SYN probe - closed ports are critical" );
+like( $res->output, '/127\.0\.0\.1:1: rta [\d\.]+ms, lost 0%, port closed :: 127\.0\.0\.1:2: .*, port closed\|/', "Each port reported" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H 127.0.0.0/30 -w 10000ms,100% -c 10000ms,100% -n 1"
+	);
+is( $res->return_code, 0, "Network in CIDR notation" );
+like( $res->output, '/127\.0\.0\.1: .* :: 127\.0\.0\.2: /', "Both host addresses checked" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -j 2 -H 127.0.0.0/29 -w 10000ms,100% -c 10000ms,100% -n 1"
+	);
+is( $res->return_code, 0, "Targets shared by two workers" );
+like( $res->output, '/127\.0\.0\.1: rta [\d\.]+ms, lost 0% :: 127\.0\.0\.2: rta [\d\.]+ms, lost 0% :: .* :: 127\.0\.0\.6: rta [\d\.]+ms, lost 0%\|/', "Results of all workers merged" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -vj2 -H 127.0.0.0/29 -w 10000ms,100% -c 10000ms,100% -n 1"
+	);
+is( $res->return_code, 0, "Worker count grouped with another flag" );
+like( $res->output, '/^worker 1: \d+ of 6 targets$/m', "Second worker started" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -R 50,1 -H $host_responsive -w 10000ms,100% -c 10000ms,100% -n 5 -i 0"
+	);
+is( $res->return_code, 0, "Shared packet rate budget" );
+like( $res->output, '/lost 0%/', "Paced probes still get answered" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -a -v -H $host_responsive -w 10000ms,100% -c 10000ms,100% -n 20"
+	);
+is( $res->return_code, 0, "Adaptive probing" );
+like( $res->output, '/settled after \d+ of 20 packets/', "Clear target settles early" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -a -v -H $host_nonresponsive -w 10000ms,100% -c 10000ms,100% -n 5 -t 2"
+	);
+is( $res->return_code, 2, "Adaptive probing - host nonresponsive" );
+unlike( $res->output, '/settled/', "Unanswered target never settles" );
+
+SKIP: {
+	skip "No IPv6", 2 unless NPTest::has_ipv6();
+
+	$res = NPTest->testCmd(
+		"$sudo ./check_icmp -H ::1 -H $host_responsive -w 10000ms,100% -c 10000ms,100%"
+		);
+	is( $res->return_code, 0, "Mixed IPv4 and IPv6 targets" );
+	like( $res->output, '/::1: rta [\d\.]+ms, lost \d+%/', "Output OK" );
+}
@@ -112,9 +112,18 @@ enum
 {
   SYNC_OPTION = CHAR_MAX + 1,
   NO_SYNC_OPTION,
-  BLOCK_SIZE_OPTION
+  BLOCK_SIZE_OPTION,
+  DU_OPTION,
+  DU_THREADS_OPTION,
+  DU_TOP_OPTION,
+  DU_CACHE_OPTION
 };
 
+/* Upper bound for the default number of directory walker threads */
+#define DU_MAX_THREADS 8
+/* Version of the --du-cache state data */
+#define DU_STATE_VERSION 1
+
 #ifdef _AIX
  #pragma alloca
 #endif
@@ -129,6 +138,7 @@ double calculate_percent(uintmax_t, uintmax_t);
 void stat_path (struct parameter_list *p);
 void get_stats (struct parameter_list *p, struct fs_usage *fsp);
 void get_path_stats (struct parameter_list *p, struct fs_usage *fsp);
+int check_du (void);
 
 double w_dfp = -1.0;
 double c_dfp = -1.0;
@@ -153,7 +163,13 @@ char *warn_usedinodes_percent = NULL;
 char *crit_usedinodes_percent = NULL;
 char *warn_freeinodes_percent = NULL;
 char *crit_freeinodes_percent = NULL;
+char *warn_usedinodes_count = NULL;
+char *crit_usedinodes_count = NULL;
 int path_selected = FALSE;
+int du_mode = FALSE;
+int du_threads = 0;
+int du_top = 0;
+int du_cache_age = 0;
 char *group = NULL;
 struct stat *stat_buf;
 struct name_list *seen = NULL;
@@ -196,10 +212,14 @@ main (int argc, char **argv)
 
   /* Parse extra opts if any */
   argv = np_extra_opts (&argc, argv, progname);
+  np_init ((char *) progname, argc, argv);
 
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (du_mode)
+    return check_du ();
+
   /* If a list of paths has not been selected, find entire
      mount list and create list of paths
    */
@@ -462,6 +482,10 @@ process_arguments (int argc, char **argv)
     {"verbose", no_argument, 0, 'v'},
     {"quiet", no_argument, 0, 'q'},
     {"clear", no_argument, 0, 'C'},
+    {"du", no_argument, 0, DU_OPTION},
+    {"du-threads", required_argument, 0, DU_THREADS_OPTION},
+    {"du-top", required_argument, 0, DU_TOP_OPTION},
+    {"du-cache", required_argument, 0, DU_CACHE_OPTION},
     {"version", no_argument, 0, 'V'},
     {"help", no_argument, 0, 'h'},
     {0, 0, 0, 0}
@@ -494,6 +518,14 @@ process_arguments (int argc, char **argv)
 
     /* See comments for 'c' */
     case 'w':                 /* warning threshold */
+      if (du_mode) {
+        /* Directory usage is used space, so ranges keep their usual meaning */
+        if (strstr(optarg, "%"))
+          warn_usedspace_percent = optarg;
+        else
+          warn_usedspace_units = optarg;
+        break;
+      }
       if (strstr(optarg, "%")) {
         if (*optarg == '@') {
           warn_freespace_percent = optarg;
@@ -515,6 +547,13 @@ process_arguments (int argc, char **argv)
        force @ at the beginning of the range, so that it is backwards compatible
     */
     case 'c':                 /* critical threshold */
+      if (du_mode) {
+        if (strstr(optarg, "%"))
+          crit_usedspace_percent = optarg;
+        else
+          crit_usedspace_units = optarg;
+        break;
+      }
       if (strstr(optarg, "%")) {
         if (*optarg == '@') {
           crit_freespace_percent = optarg;
@@ -531,6 +570,13 @@ process_arguments (int argc, char **argv)
       break;
 
     case 'W':			/* warning inode threshold */
+      if (du_mode) {
+        if (strstr(optarg, "%"))
+          warn_usedinodes_percent = optarg;
+        else
+          warn_usedinodes_count = optarg;
+        break;
+      }
       if (*optarg == '@') {
         warn_freeinodes_percent = optarg;
       } else {
@@ -538,6 +584,13 @@ process_arguments (int argc, char **argv)
       }
       break;
     case 'K':			/* critical inode threshold */
+      if (du_mode) {
+        if (strstr(optarg, "%"))
+          crit_usedinodes_percent = optarg;
+        else
+          crit_usedinodes_count = optarg;
+        break;
+      }
       if (*optarg == '@') {
         crit_freeinodes_percent = optarg;
       } else {
@@ -586,10 +639,12 @@ process_arguments (int argc, char **argv)
       show_local_fs = 1;
       break;
     case 'p':                 /* select path */
-      if (! (warn_freespace_units || crit_freespace_units || warn_freespace_percent ||
+      /* Directory usage is worth graphing even without thresholds */
+      if (! du_mode && ! (warn_freespace_units || crit_freespace_units || warn_freespace_percent ||
              crit_freespace_percent || warn_usedspace_units || crit_usedspace_units ||
              warn_usedspace_percent || crit_usedspace_percent || warn_usedinodes_percent ||
-             crit_usedinodes_percent || warn_freeinodes_percent || crit_freeinodes_percent )) {
+             crit_usedinodes_percent || warn_freeinodes_percent || crit_freeinodes_percent ||
+             warn_usedinodes_count || crit_usedinodes_count )) {
         die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set a threshold value before using -p\n"));
       }
 
@@ -638,6 +693,8 @@ process_arguments (int argc, char **argv)
       freespace_ignore_reserved = TRUE;
       break;
     case 'g':
+      if (du_mode)
+        die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Groups cannot be used with --du\n"));
       if (path_selected)
         die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set group value before selecting paths\n"));
       group = optarg;
@@ -689,7 +746,8 @@ process_arguments (int argc, char **argv)
       if (! (warn_freespace_units || crit_freespace_units || warn_freespace_percent ||
              crit_freespace_percent || warn_usedspace_units || crit_usedspace_units ||
              warn_usedspace_percent || crit_usedspace_percent || warn_usedinodes_percent ||
-             crit_usedinodes_percent || warn_freeinodes_percent || crit_freeinodes_percent )) {
+             crit_usedinodes_percent || warn_freeinodes_percent || crit_freeinodes_percent ||
+             warn_usedinodes_count || crit_usedinodes_count )) {
         die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set a threshold value before using -r/-R\n"));
       }
 
@@ -729,7 +787,7 @@ process_arguments (int argc, char **argv)
       break;
     case 'C':
        /* add all mount entries to path_select list if no partitions have been explicitly defined using -p */
-       if (path_selected == FALSE) {
+       if (path_selected == FALSE && ! du_mode) {
          struct parameter_list *path;
          for (me = mount_list; me; me = me->me_next) {
            if (! (path = np_find_parameter(path_select_list, me->me_mountdir)))
@@ -751,10 +809,34 @@ process_arguments (int argc, char **argv)
       crit_usedinodes_percent = NULL;
       warn_freeinodes_percent = NULL;
       crit_freeinodes_percent = NULL;
+      warn_usedinodes_count = NULL;
+      crit_usedinodes_count = NULL;
 
       path_selected = FALSE;
       group = NULL;
       break;
+    case DU_OPTION:
+      if (path_select_list || group || warn_freespace_units || crit_freespace_units ||
+          warn_freespace_percent || crit_freespace_percent || warn_usedinodes_percent ||
+          crit_usedinodes_percent || warn_freeinodes_percent || crit_freeinodes_percent)
+        die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set --du before thresholds and paths\n"));
+      du_mode = TRUE;
+      break;
+    case DU_THREADS_OPTION:
+      if (! is_intpos (optarg))
+        usage2 (_("Number of threads must be a positive integer"), optarg);
+      du_threads = atoi (optarg);
+      break;
+    case DU_TOP_OPTION:
+      if (! is_intpos (optarg))
+        usage2 (_("Number of subdirectories must be a positive integer"), optarg);
+      du_top = atoi (optarg);
+      break;
+    case DU_CACHE_OPTION:
+      if (! is_intpos (optarg))
+        usage2 (_("Cache age must be a positive integer"), optarg);
+      du_cache_age = atoi (optarg);
+      break;
     case 'V':                 /* version */
       print_revision (progname, NP_VERSION);
       exit (STATE_UNKNOWN);
@@ -785,6 +867,9 @@ process_arguments (int argc, char **argv)
     mult = (uintmax_t)1024 * 1024;
   }
 
+  if (du_mode && path_select_list == NULL)
+    usage4 (_("Directories to measure with --du must be selected with -p"));
+
   return TRUE;
 }
 
@@ -813,6 +898,8 @@ set_all_thresholds (struct parameter_list *path)
     set_thresholds(&path->usedspace_percent, warn_usedspace_percent, crit_usedspace_percent);
     if (path->usedinodes_percent != NULL) free (path->usedinodes_percent);
     set_thresholds(&path->usedinodes_percent, warn_usedinodes_percent, crit_usedinodes_percent);
+    if (path->usedinodes_count != NULL) free (path->usedinodes_count);
+    set_thresholds(&path->usedinodes_count, warn_usedinodes_count, crit_usedinodes_count);
     if (path->freeinodes_percent != NULL) free (path->freeinodes_percent);
     set_thresholds(&path->freeinodes_percent, warn_freeinodes_percent, crit_freeinodes_percent);
 }
@@ -935,6 +1022,20 @@ print_help (void)
   printf ("    %s\n", _("Ignore all filesystems of indicated type (may be repeated)"));
   printf (" %s\n", "-N, --include-type=TYPE");
   printf ("    %s\n", _("Check only filesystems of indicated type (may be repeated)"));
+  printf (" %s\n", "--du");
+  printf ("    %s\n", _("Measure the directory trees selected with -p instead of their file systems."));
+  printf ("    %s\n", _("Must precede thresholds and paths. -w/-c then apply to used space (INTEGER units"));
+  printf ("    %s\n", _("or PERCENT% of the file system), -W/-K to used inodes (INTEGER or PERCENT%)."));
+  printf ("    %s\n", _("Hard links are counted once and other file systems below the path are skipped"));
+  printf (" %s\n", "--du-threads=INTEGER");
+  printf ("    %s\n", _("Number of directory walker threads (default: online CPUs, at most 8)"));
+  printf (" %s\n", "--du-top=INTEGER");
+  printf ("    %s\n", _("Apply the thresholds to each immediate subdirectory instead of the whole tree"));
+  printf ("    %s\n", _("and list the INTEGER largest ones as well as any over a threshold"));
+  printf (" %s\n", "--du-cache=SECONDS");
+  printf ("    %s\n", _("Reuse the usage of immediate subdirectories whose mtime and ctime did not change"));
+  printf ("    %s\n", _("since the last run. Each one is walked again at least every SECONDS, as"));
+  printf ("    %s\n", _("files growing deeper down do not change those timestamps"));
 
   printf ("\n");
   printf ("%s\n", _("Examples:"));
@@ -945,6 +1046,9 @@ print_help (void)
   printf ("    %s\n", _("are grouped which means the freespace thresholds are applied to all disks together"));
   printf (" %s\n", "check_disk -w 100 -c 50 -C -w 1000 -c 500 -p /foo -C -w 5% -c 3% -p /bar");
   printf ("    %s\n", _("Checks /foo for 1000M/500M and /bar for 5/3%. All remaining volumes use 100M/50M"));
+  printf (" %s\n", "check_disk --du -u GB -w 50 -c 80 --du-top 5 --du-cache 3600 -p /srv/tenants");
+  printf ("    %s\n", _("Alerts on any tenant directory using more than 50GB/80GB and lists the 5 largest,"));
+  printf ("    %s\n", _("walking unchanged ones at most once an hour"));
 
   printf (UT_SUPPORT);
 }
@@ -958,6 +1062,8 @@ print_usage (void)
   printf (" %s -w limit -c limit [-W limit] [-K limit] {-p path | -x device}\n", progname);
   printf ("[-C] [-E] [-e] [-f] [-g group ] [-k] [-l] [-M] [-m] [-R path ] [-r path ]\n");
   printf ("[-t timeout] [-u unit] [-v] [-X type] [-N type]\n");
+  printf (" %s --du [--du-threads n] [--du-top n] [--du-cache seconds]\n", progname);
+  printf ("[-w limit] [-c limit] [-W limit] [-K limit] -p path [-e] [-t timeout] [-u unit] [-v]\n");
 }
 
 void
@@ -1054,3 +1160,330 @@ get_path_stats (struct parameter_list *p, struct fs_usage *fsp) {
   p->inodes_free  = fsp->fsu_ffree;      /* Free file nodes. */
   np_add_name(&seen, p->best_match->me_mountdir);
 }
+
+/* Ordering of the --du-cache entries, which are written sorted by name */
+static int
+du_compare_subdir_name (const void *a, const void *b)
+{
+  return strcmp (((const struct du_subdir *) a)->name, ((const struct du_subdir *) b)->name);
+}
+
+/* One state key per measured directory, so the caches of several -p do not mix */
+static char *
+du_state_key (const char *name)
+{
+  struct sha1_ctx ctx;
+  unsigned char digest[20];
+  char *key;
+  int i;
+
+  sha1_init_ctx (&ctx);
+  sha1_process_bytes (name, strlen (name) + 1, &ctx);
+  sha1_finish_ctx (&ctx, digest);
+
+  if ((key = malloc (2 * sizeof (digest) + 1)) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+  for (i = 0; i < (int) sizeof (digest); i++)
+    sprintf (key + 2 * i, "%02x", digest[i]);
+  return key;
+}
+
+static void
+du_append (char **data, size_t *length, size_t *size, const char *text)
+{
+  size_t text_length = strlen (text);
+
+  while (*length + text_length + 1 > *size) {
+    *size = *size ? *size * 2 : 4096;
+    if ((*data = realloc (*data, *size)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+  }
+  memcpy (*data + *length, text, text_length + 1);
+  *length += text_length;
+}
+
+/*
+ * The state data is the device and inode of the measured directory followed
+ * by one "walked:mtime:ctime:bytes:inodes:name" entry per subdirectory, with
+ * separators and unprintable bytes of the name written as %XX. Entries older
+ * than --du-cache seconds are not loaded, so every subtree is walked again
+ * at least that often: a directory mtime does not change when a file deep
+ * below it grows.
+ */
+static size_t
+du_cache_load (const struct stat *top, struct du_subdir **cache, time_t **walked)
+{
+  state_data *previous_state;
+  char *data, *entry, *name, *p, *q;
+  unsigned long dev, ino;
+  unsigned int byte;
+  long long entry_walked, mtime, ctime;
+  uintmax_t bytes, inodes;
+  size_t count = 0, allocated = 0;
+  time_t now = time (NULL);
+  int offset;
+
+  *cache = NULL;
+  *walked = NULL;
+  if ((previous_state = np_state_read ()) == NULL)
+    return 0;
+
+  data = (char *) previous_state->data;
+  if (sscanf (data, "%lu:%lu%n", &dev, &ino, &offset) != 2 ||
+      dev != (unsigned long) top->st_dev || ino != (unsigned long) top->st_ino) {
+    if (verbose >= 2)
+      printf (_("Cache belongs to another directory, walking everything\n"));
+    return 0;
+  }
+
+  for (entry = strtok (data + offset, " "); entry; entry = strtok (NULL, " ")) {
+    if (sscanf (entry, "%lld:%lld:%lld:%ju:%ju:%n", &entry_walked, &mtime, &ctime,
+                &bytes, &inodes, &offset) != 5)
+      break;
+    /* A directory changed in the second it was walked may have changed
+       again since without its timestamps showing it */
+    if (now - entry_walked >= du_cache_age || mtime >= entry_walked || ctime >= entry_walked)
+      continue;
+
+    name = entry + offset;
+    for (p = q = name; *p; q++) {
+      if (*p == '%' && sscanf (p + 1, "%2x", &byte) == 1) {
+        *q = byte;
+        p += 3;
+      } else {
+        *q = *p++;
+      }
+    }
+    *q = '\0';
+
+    if (count == allocated) {
+      allocated = allocated ? allocated * 2 : 64;
+      *cache = realloc (*cache, allocated * sizeof (struct du_subdir));
+      *walked = realloc (*walked, allocated * sizeof (time_t));
+      if (*cache == NULL || *walked == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    }
+    (*cache)[count].name = name;
+    (*cache)[count].mtime = mtime;
+    (*cache)[count].ctime = ctime;
+    (*cache)[count].usage.bytes = bytes;
+    (*cache)[count].usage.inodes = inodes;
+    (*cache)[count].cached = FALSE;
+    (*walked)[count] = entry_walked;
+    if (count && strcmp ((*cache)[count - 1].name, name) >= 0)
+      return 0;
+    count++;
+  }
+  return count;
+}
+
+static void
+du_cache_save (const struct stat *top, const struct du_tree *tree,
+               const struct du_subdir *cache, const time_t *walked, size_t cache_count)
+{
+  struct du_subdir *sorted, *hit;
+  char *data = NULL, *entry, *escaped, *q;
+  const char *p;
+  size_t length = 0, size = 0, i;
+  time_t now = time (NULL), entry_walked;
+
+  sorted = malloc ((tree->subdir_count + 1) * sizeof (struct du_subdir));
+  if (sorted == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+  memcpy (sorted, tree->subdirs, tree->subdir_count * sizeof (struct du_subdir));
+  qsort (sorted, tree->subdir_count, sizeof (struct du_subdir), du_compare_subdir_name);
+
+  xasprintf (&entry, "%lu:%lu", (unsigned long) top->st_dev, (unsigned long) top->st_ino);
+  du_append (&data, &length, &size, entry);
+  free (entry);
+
+  for (i = 0; i < tree->subdir_count; i++) {
+    entry_walked = now;
+    if (sorted[i].cached) {
+      hit = bsearch (&sorted[i], cache, cache_count, sizeof (struct du_subdir), du_compare_subdir_name);
+      if (hit)
+        entry_walked = walked[hit - cache];
+    }
+
+    if ((escaped = malloc (3 * strlen (sorted[i].name) + 1)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+    for (p = sorted[i].name, q = escaped; *p; p++) {
+      if ((unsigned char) *p <= ' ' || (unsigned char) *p >= 0x7f || *p == '%' || *p == ':')
+        q += sprintf (q, "%%%02X", (unsigned char) *p);
+      else
+        *q++ = *p;
+    }
+    *q = '\0';
+
+    xasprintf (&entry, " %lld:%lld:%lld:%ju:%ju:%s", (long long) entry_walked,
+               (long long) sorted[i].mtime, (long long) sorted[i].ctime,
+               sorted[i].usage.bytes, sorted[i].usage.inodes, escaped);
+    du_append (&data, &length, &size, entry);
+    free (entry);
+    free (escaped);
+  }
+
+  np_state_write_string (0, data);
+  free (data);
+  free (sorted);
+}
+
+static int
+du_status (struct parameter_list *p, const struct du_usage *usage, uintmax_t fs_bytes)
+{
+  int result = STATE_OK;
+
+  result = max_state (result, get_status ((double) usage->bytes / mult, p->usedspace_units));
+  if (fs_bytes)
+    result = max_state (result, get_status (calculate_percent (usage->bytes, fs_bytes), p->usedspace_percent));
+  result = max_state (result, get_status ((double) usage->inodes, p->usedinodes_count));
+  if (p->inodes_total)
+    result = max_state (result, get_status (calculate_percent (usage->inodes, p->inodes_total), p->usedinodes_percent));
+  return result;
+}
+
+static char *
+du_perfdata (const char *label, double value, thresholds *t, int maxp, double max)
+{
+  return fperfdata (label, value, units,
+                    t->warning && ! t->warning->end_infinity, t->warning ? t->warning->end : 0,
+                    t->critical && ! t->critical->end_infinity, t->critical ? t->critical->end : 0,
+                    TRUE, 0, maxp, max);
+}
+
+/*
+ * Directory usage mode: walk every selected path and apply the used space
+ * and inode thresholds to the tree, or with --du-top to each of its
+ * immediate subdirectories
+ */
+int
+check_du (void)
+{
+  int result = STATE_OK;
+  int path_result, sub_result, threads, listed;
+  char *output = strdup ("");
+  char *perf = strdup ("");
+  char *line, *label;
+  struct parameter_list *path;
+  struct du_tree tree;
+  struct du_subdir *cache;
+  struct fs_usage fsp;
+  struct stat top;
+  time_t *walked;
+  uintmax_t fs_bytes;
+  size_t cache_count, cached, i;
+
+  threads = du_threads;
+  if (threads == 0) {
+    threads = GET_NUMBER_OF_CPUS ();
+    if (threads < 1)
+      threads = 1;
+    else if (threads > DU_MAX_THREADS)
+      threads = DU_MAX_THREADS;
+  }
+
+  signal (SIGALRM, timeout_alarm_handler);
+  alarm (timeout_interval);
+
+  np_set_best_match (path_select_list, mount_list, exact_match);
+
+  for (path = path_select_list; path; path = path->name_next) {
+    stat_path (path);
+    top = *stat_buf;
+
+    fs_bytes = 0;
+    if (path->best_match) {
+      get_fs_usage (path->best_match->me_mountdir, path->best_match->me_devname, &fsp);
+      get_path_stats (path, &fsp);
+      fs_bytes = path->total * fsp.fsu_blocksize;
+    }
+
+    cache = NULL;
+    walked = NULL;
+    cache_count = 0;
+    if (du_cache_age) {
+      np_enable_state (du_state_key (path->name), DU_STATE_VERSION);
+      cache_count = du_cache_load (&top, &cache, &walked);
+    }
+
+    memset (&tree, 0, sizeof (tree));
+    tree.path = path->name;
+    if (np_du_walk (&tree, threads, cache, cache_count) == ERROR) {
+      printf ("DISK %s - ", _("CRITICAL"));
+      die (STATE_CRITICAL, _("%s %s: %s\n"), path->name, _("is not accessible"), tree.error);
+    }
+
+    if (du_cache_age)
+      du_cache_save (&top, &tree, cache, walked, cache_count);
+
+    for (cached = 0, i = 0; i < tree.subdir_count; i++)
+      if (tree.subdirs[i].cached)
+        cached++;
+    if (verbose >= 2)
+      printf (_("%s: %ju bytes in %ju inodes, %lu subdirectories (%lu from cache), %d threads\n"),
+              path->name, tree.total.bytes, tree.total.inodes, (unsigned long) tree.subdir_count,
+              (unsigned long) cached, threads);
+
+    xasprintf (&line, " %s %.0f %s", path->name, (double) tree.total.bytes / mult, units);
+    if (fs_bytes)
+      xasprintf (&line, "%s (%.0f%%)", line, calculate_percent (tree.total.bytes, fs_bytes));
+    xasprintf (&line, "%s %ju inodes", line, tree.total.inodes);
+
+    xasprintf (&perf, "%s %s", perf,
+               du_perfdata (path->name, (double) tree.total.bytes / mult, path->usedspace_units,
+                            fs_bytes != 0, (double) fs_bytes / mult));
+    xasprintf (&label, "%s inodes", path->name);
+    xasprintf (&perf, "%s %s", perf,
+               perfdata (label, (long) tree.total.inodes, "",
+                         path->usedinodes_count->warning && ! path->usedinodes_count->warning->end_infinity,
+                         path->usedinodes_count->warning ? (long) path->usedinodes_count->warning->end : 0,
+                         path->usedinodes_count->critical && ! path->usedinodes_count->critical->end_infinity,
+                         path->usedinodes_count->critical ? (long) path->usedinodes_count->critical->end : 0,
+                         TRUE, 0, path->inodes_total != 0, (long) path->inodes_total));
+    free (label);
+
+    if (du_top == 0) {
+      path_result = du_status (path, &tree.total, fs_bytes);
+    } else {
+      /* The largest subdirectories, then any others over a threshold */
+      path_result = STATE_OK;
+      listed = 0;
+      for (i = 0; i < tree.subdir_count; i++) {
+        sub_result = du_status (path, &tree.subdirs[i].usage, fs_bytes);
+        path_result = max_state (path_result, sub_result);
+        if (i >= (size_t) du_top && sub_result == STATE_OK)
+          continue;
+
+        xasprintf (&line, "%s%s%s %.0f %s", line, listed++ ? ", " : " [",
+                   tree.subdirs[i].name, (double) tree.subdirs[i].usage.bytes / mult, units);
+        if (sub_result != STATE_OK)
+          xasprintf (&line, "%s %s", line, state_text (sub_result));
+
+        xasprintf (&label, "%s/%s", path->name, tree.subdirs[i].name);
+        xasprintf (&perf, "%s %s", perf,
+                   du_perfdata (label, (double) tree.subdirs[i].usage.bytes / mult,
+                                path->usedspace_units, fs_bytes != 0, (double) fs_bytes / mult));
+        free (label);
+      }
+      if (listed)
+        xasprintf (&line, "%s]", line);
+    }
+
+    if (tree.errors) {
+      xasprintf (&line, _("%s, %lu entries unreadable (%s)"), line, tree.errors, tree.error);
+      path_result = max_state_alt (path_result, STATE_UNKNOWN);
+    }
+    result = max_state_alt (result, path_result);
+
+    if (path_result != STATE_OK || ! erronly || verbose)
+      xasprintf (&output, "%s%s;", output, line);
+    free (line);
+
+    free (cache);
+    free (walked);
+  }
+
+  printf ("DISK %s%s%s|%s\n", state_text (result),
+          (erronly && result == STATE_OK) ? "" : _(" - directory usage:"), output, perf);
+  return result;
+}
@@ -0,0 +1,585 @@
+/*****************************************************************************
+*
+* Monitoring check_files plugin
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_files plugin
+*
+* Checks the age, size and number of files matching paths, globs and
+* recursive (**) patterns. Each pattern is walked once with directory file
+* descriptors, every match is stat()ed with fstatat() relative to its
+* directory, and the oldest and newest entries are reported per pattern.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_files";
+const char *copyright = "2026";
+const char *email = "devel@monitoring-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#define GLOB_CHARS "*?["
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+
+typedef struct file_group_struct {
+	char *pattern;
+	int literal;			/* no wildcards: a missing file is an error */
+	char *warn_age, *crit_age;
+	char *warn_size, *crit_size;
+	char *warn_count, *crit_count;
+	thresholds *age_thlds;
+	thresholds *size_thlds;
+	thresholds *count_thlds;
+	unsigned long count;
+	long long bytes;
+	time_t oldest_mtime, newest_mtime;
+	char *oldest, *newest;
+	int result;
+	char *offender;			/* first file with the group's worst per file state */
+	long offender_age;
+	long long offender_size;
+	char *error;
+	struct file_group_struct *next;
+	} file_group;
+
+file_group *groups = NULL;
+int group_count = 0;
+int ignore_missing = FALSE;
+int verbose = 0;
+time_t now;
+
+/* Thresholds apply to the -f options that follow them */
+char *warn_age = NULL, *crit_age = NULL;
+char *warn_size = NULL, *crit_size = NULL;
+char *warn_count = NULL, *crit_count = NULL;
+
+static void add_group (char *);
+static void check_group (file_group *);
+static void walk (file_group *, int, const char *, char **, int);
+static void walk_error (file_group *, const char *, const char *);
+static void account (file_group *, int, const char *, const char *, int);
+static char *join_path (const char *, const char *);
+static char *group_label (const file_group *, const char *);
+
+
+int
+main (int argc, char **argv)
+{
+	int result = STATE_OK;
+	unsigned long total = 0;
+	char *output = NULL, *perf = NULL, *text;
+	file_group *g;
+
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* Set signal handling and alarm timeout */
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR) {
+		die (STATE_UNKNOWN, _("Cannot catch SIGALRM"));
+	}
+	(void) alarm ((unsigned) timeout_interval);
+
+	time (&now);
+
+	for (g = groups; g; g = g->next) {
+		check_group (g);
+		result = max_state_alt (result, g->result);
+		total += g->count;
+
+		xasprintf (&text, _("%s: %lu files"), g->pattern, g->count);
+		if (g->count)
+			xasprintf (&text, _("%s, oldest %s (%lds), newest %s (%lds)"), text,
+			           g->oldest, (long) (now - g->oldest_mtime),
+			           g->newest, (long) (now - g->newest_mtime));
+		if (g->result != STATE_OK)
+			xasprintf (&text, "%s - %s:", text, state_text (g->result));
+		if (g->offender)
+			xasprintf (&text, _("%s %s is %ld seconds old and %lld bytes"), text,
+			           g->offender, g->offender_age, g->offender_size);
+		if (g->error)
+			xasprintf (&text, "%s%s %s", text, g->offender ? "," : "", g->error);
+		xasprintf (&output, "%s%s%s", output ? output : "", output ? "; " : "", text);
+		free (text);
+
+		text = group_label (g, "count");
+		xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "",
+		           sperfdata_int (text, (int) g->count, "", g->warn_count, g->crit_count,
+		                          TRUE, 0, FALSE, 0));
+		free (text);
+		if (g->count) {
+			text = group_label (g, "oldest");
+			xasprintf (&perf, "%s %s", perf,
+			           sperfdata_int (text, (int) (now - g->oldest_mtime), "s",
+			                          g->warn_age, g->crit_age, FALSE, 0, FALSE, 0));
+			free (text);
+			text = group_label (g, "newest");
+			xasprintf (&perf, "%s %s", perf,
+			           perfdata (text, (long) (now - g->newest_mtime), "s",
+			                     FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0));
+			free (text);
+		}
+		text = group_label (g, "size");
+		xasprintf (&perf, "%s %s", perf,
+		           perfdata (text, (long) g->bytes, "B", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		free (text);
+	}
+
+	if (group_count > 1)
+		printf (_("FILES %s - %lu files in %d groups, %s|%s\n"), state_text (result),
+		        total, group_count, output, perf);
+	else
+		printf (_("FILES %s - %s|%s\n"), state_text (result), output, perf);
+
+	return result;
+}
+
+
+static void
+check_group (file_group *g)
+{
+	char *copy, *component, **components;
+	int count = 0, fd, state;
+
+	/* split the pattern into path components; a trailing ** means every file below */
+	copy = strdup (g->pattern);
+	components = malloc (sizeof (char *) * (strlen (g->pattern) + 2));
+	if (copy == NULL || components == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	for (component = strtok (copy, "/"); component; component = strtok (NULL, "/"))
+		if (strcmp (component, "."))
+			components[count++] = component;
+	if (count && !strcmp (components[count - 1], "**"))
+		components[count++] = "*";
+
+	fd = open (g->pattern[0] == '/' ? "/" : ".", O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		g->result = STATE_UNKNOWN;
+		xasprintf (&g->error, _("Cannot open directory: %s"), strerror (errno));
+		return;
+	}
+	if (count == 0)
+		account (g, AT_FDCWD, NULL, g->pattern, TRUE);
+	else
+		walk (g, fd, g->pattern[0] == '/' ? "" : NULL, components, count);
+	close (fd);
+	free (components);
+	free (copy);
+
+	state = get_status ((double) g->count, g->count_thlds);
+	if (g->count == 0 && g->count_thlds->warning == NULL && g->count_thlds->critical == NULL)
+		state = ignore_missing || g->error ? STATE_OK : STATE_CRITICAL;
+	if (state != STATE_OK && g->error == NULL) {
+		if (g->count == 0)
+			xasprintf (&g->error, g->literal ? _("File not found") : _("No matching files"));
+		else
+			xasprintf (&g->error, _("%lu files"), g->count);
+	}
+	g->result = max_state_alt (g->result, state);
+}
+
+
+/*
+ * Match components against the entries below dirfd. prefix is the path of
+ * dirfd as it is reported ("" for /, NULL for the working directory).
+ */
+static void
+walk (file_group *g, int dirfd, const char *prefix, char **components, int count)
+{
+	const char *component = components[0];
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	char *path;
+	int fd, is_dir;
+
+	if (!strpbrk (component, GLOB_CHARS)) {
+		if (count == 1) {
+			account (g, dirfd, prefix, component, TRUE);
+			return;
+		}
+		if ((fd = openat (dirfd, component, O_RDONLY | O_DIRECTORY)) < 0) {
+			walk_error (g, prefix, component);
+			return;
+		}
+		path = join_path (prefix, component);
+		walk (g, fd, path, components + 1, count - 1);
+		free (path);
+		close (fd);
+		return;
+	}
+
+	/* ** also matches no directory at all */
+	if (!strcmp (component, "**"))
+		walk (g, dirfd, prefix, components + 1, count - 1);
+
+	if ((fd = dup (dirfd)) < 0 || (dir = fdopendir (fd)) == NULL) {
+		walk_error (g, prefix, ".");
+		return;
+	}
+	/* the descriptor may have been read already by the ** step above */
+	rewinddir (dir);
+
+	while ((entry = readdir (dir)) != NULL) {
+		if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+			continue;
+
+		if (!strcmp (component, "**")) {
+			/* descend into every directory that is not hidden, without following symlinks */
+			if (entry->d_name[0] == '.')
+				continue;
+#ifdef DT_DIR
+			if (entry->d_type != DT_UNKNOWN)
+				is_dir = entry->d_type == DT_DIR;
+			else
+#endif
+				is_dir = fstatat (dirfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0
+				         && S_ISDIR (st.st_mode);
+			if (!is_dir)
+				continue;
+			if ((fd = openat (dirfd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) < 0) {
+				walk_error (g, prefix, entry->d_name);
+				continue;
+			}
+			path = join_path (prefix, entry->d_name);
+			walk (g, fd, path, components, count);
+			free (path);
+			close (fd);
+			continue;
+		}
+
+		if (fnmatch (component, entry->d_name, FNM_PERIOD) != 0)
+			continue;
+		if (count == 1) {
+			account (g, dirfd, prefix, entry->d_name, FALSE);
+			continue;
+		}
+		if ((fd = openat (dirfd, entry->d_name, O_RDONLY | O_DIRECTORY)) < 0) {
+			walk_error (g, prefix, entry->d_name);
+			continue;
+		}
+		path = join_path (prefix, entry->d_name);
+		walk (g, fd, path, components + 1, count - 1);
+		free (path);
+		close (fd);
+	}
+	closedir (dir);
+}
+
+
+/* Directories that vanished or are not directories just do not match */
+static void
+walk_error (file_group *g, const char *prefix, const char *name)
+{
+	char *path;
+
+	if (errno == ENOENT || errno == ENOTDIR || g->error)
+		return;
+	path = join_path (prefix, name);
+	g->result = max_state_alt (g->result, STATE_UNKNOWN);
+	xasprintf (&g->error, _("Cannot open directory %s: %s"), path, strerror (errno));
+	free (path);
+}
+
+
+/* Stat one match and fold it into the group. Wildcard matches skip directories */
+static void
+account (file_group *g, int dirfd, const char *prefix, const char *name, int literal)
+{
+	struct stat st;
+	long age;
+	int state;
+
+	if (fstatat (dirfd, name, &st, 0) != 0) {
+		/* gone since readdir, or a dangling symlink */
+		if (errno != ENOENT && g->error == NULL) {
+			g->result = max_state_alt (g->result, STATE_UNKNOWN);
+			xasprintf (&g->error, _("Cannot stat %s: %s"), name, strerror (errno));
+		}
+		return;
+	}
+	if (!literal && S_ISDIR (st.st_mode))
+		return;
+
+	g->count++;
+	g->bytes += st.st_size;
+	age = (long) (now - st.st_mtime);
+
+	if (verbose)
+		printf (_("%s/%s: %ld seconds old, %lld bytes\n"), prefix ? prefix : ".", name,
+		        age, (long long) st.st_size);
+
+	if (g->count == 1 || st.st_mtime < g->oldest_mtime) {
+		free (g->oldest);
+		g->oldest = join_path (prefix, name);
+		g->oldest_mtime = st.st_mtime;
+	}
+	if (g->count == 1 || st.st_mtime > g->newest_mtime) {
+		free (g->newest);
+		g->newest = join_path (prefix, name);
+		g->newest_mtime = st.st_mtime;
+	}
+
+	state = max_state (get_status ((double) age, g->age_thlds),
+	                   get_status ((double) st.st_size, g->size_thlds));
+	if (state != STATE_OK && max_state_alt (state, g->result) != g->result) {
+		g->result = state;
+		free (g->offender);
+		g->offender = join_path (prefix, name);
+		g->offender_age = age;
+		g->offender_size = (long long) st.st_size;
+	}
+}
+
+
+static char *
+join_path (const char *prefix, const char *name)
+{
+	char *path;
+
+	if (prefix == NULL)
+		path = strdup (name);
+	else
+		xasprintf (&path, "%s/%s", prefix, name);
+	if (path == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	return path;
+}
+
+
+/* Plain metric names for a single group, "<pattern> <metric>" otherwise */
+static char *
+group_label (const file_group *g, const char *metric)
+{
+	char *label, *p;
+
+	if (group_count == 1)
+		return strdup (metric);
+
+	xasprintf (&label, "%s %s", g->pattern, metric);
+	/* keep the quoting done by perfdata () intact */
+	for (p = label; *p; p++)
+		if (*p == '\'' || *p == '=')
+			*p = '_';
+	return label;
+}
+
+
+static void
+add_group (char *pattern)
+{
+	file_group *g, **tail;
+
+	if (*pattern == '\0')
+		usage4 (_("File pattern must not be empty"));
+
+	g = calloc (1, sizeof (file_group));
+	if (g == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+
+	g->pattern = pattern;
+	g->literal = strpbrk (pattern, GLOB_CHARS) == NULL;
+	g->warn_age = warn_age;
+	g->crit_age = crit_age;
+	g->warn_size = warn_size;
+	g->crit_size = crit_size;
+	g->warn_count = warn_count;
+	g->crit_count = crit_count;
+	/* these will abort in case of invalid ranges */
+	set_thresholds (&g->age_thlds, warn_age, crit_age);
+	set_thresholds (&g->size_thlds, warn_size, crit_size);
+	set_thresholds (&g->count_thlds, warn_count, crit_count);
+	g->result = STATE_OK;
+
+	for (tail = &groups; *tail; tail = &(*tail)->next)
+		;
+	*tail = g;
+	group_count++;
+}
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	int option = 0;
+	enum {
+		WARNING_COUNT = CHAR_MAX + 1,
+		CRITICAL_COUNT
+	};
+	static struct option longopts[] = {
+		{"file", required_argument, 0, 'f'},
+		{"warning-age", required_argument, 0, 'w'},
+		{"critical-age", required_argument, 0, 'c'},
+		{"warning-size", required_argument, 0, 'W'},
+		{"critical-size", required_argument, 0, 'C'},
+		{"warning-count", required_argument, 0, WARNING_COUNT},
+		{"critical-count", required_argument, 0, CRITICAL_COUNT},
+		{"ignore-missing", no_argument, 0, 'i'},
+		{"timeout", required_argument, 0, 't'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		usage ("\n");
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvf:w:c:W:C:it:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':									/* print short usage statement if args not parsable */
+			usage5 ();
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_UNKNOWN);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_UNKNOWN);
+		case 'v':									/* verbose */
+			verbose++;
+			break;
+		case 'f':									/* file, glob or ** pattern */
+			add_group (optarg);
+			break;
+		case 'w':
+			warn_age = optarg;
+			break;
+		case 'c':
+			crit_age = optarg;
+			break;
+		case 'W':
+			warn_size = optarg;
+			break;
+		case 'C':
+			crit_size = optarg;
+			break;
+		case WARNING_COUNT:
+			warn_count = optarg;
+			break;
+		case CRITICAL_COUNT:
+			crit_count = optarg;
+			break;
+		case 'i':									/* ignore missing */
+			ignore_missing = TRUE;
+			break;
+		case 't':									/* timeout period */
+			if (!is_integer (optarg))
+				usage2 (_("Timeout interval must be a positive integer"), optarg);
+			else
+				timeout_interval = atoi (optarg);
+			break;
+		}
+	}
+
+	/* like check_file_age, the file may be given without -f */
+	for (c = optind; c < argc; c++)
+		add_group (argv[c]);
+
+	if (group_count == 0)
+		usage4 (_("You must specify at least one file pattern"));
+
+	return OK;
+}
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("This plugin checks the age, size and number of files matching one or more"));
+	printf ("%s\n", _("paths, globs or recursive patterns in a single run."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-f, --file=PATTERN");
+	printf ("    %s\n", _("File, glob (*, ?, [...]) or pattern with ** matching any number of"));
+	printf ("    %s\n", _("directories. May be repeated; each pattern is a group that uses the"));
+	printf ("    %s\n", _("thresholds given before it"));
+	printf (" %s\n", "-w, --warning-age=RANGE");
+	printf ("    %s\n", _("Warning range for the age of each file in seconds"));
+	printf (" %s\n", "-c, --critical-age=RANGE");
+	printf ("    %s\n", _("Critical range for the age of each file in seconds"));
+	printf (" %s\n", "-W, --warning-size=RANGE");
+	printf ("    %s\n", _("Warning range for the size of each file in bytes"));
+	printf (" %s\n", "-C, --critical-size=RANGE");
+	printf ("    %s\n", _("Critical range for the size of each file in bytes"));
+	printf (" %s\n", "--warning-count=RANGE");
+	printf ("    %s\n", _("Warning range for the number of matching files"));
+	printf (" %s\n", "--critical-count=RANGE");
+	printf ("    %s\n", _("Critical range for the number of matching files"));
+	printf (" %s\n", "-i, --ignore-missing");
+	printf ("    %s\n", _("Return OK if nothing matches a pattern without count thresholds"));
+	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("Wildcards skip directories and hidden entries; ** does not follow symlinks."));
+	printf (" %s\n", _("Without count thresholds, a pattern matching nothing is CRITICAL."));
+	printf (" %s\n", _("For range syntax see https://www.monitoring-plugins.org/doc/guidelines.html#THRESHOLDFORMAT"));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_files -w 300 -c 900 -f /var/run/app/heartbeat -w 90000 -c 180000 -C 1: -f '/backup/*.tar'");
+	printf ("    %s\n", _("Heartbeat at most 5/15 minutes old, backups at most a day/two days old and not empty"));
+	printf (" %s\n", "check_files -c 3600 --warning-count 100 -f '/var/spool/app/**/*.msg'");
+	printf ("    %s\n", _("No queued message older than an hour, and at most 100 of them"));
+
+	printf (UT_SUPPORT);
+}
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s [-w <age>] [-c <age>] [-W <size>] [-C <size>] [--warning-count <range>]\n", progname);
+	printf ("    [--critical-count <range>] -f <pattern> [[-w ...] -f <pattern> ...] [-i] [-t <timeout>] [-v]\n");
+}
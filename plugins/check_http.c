@@ -42,6 +42,10 @@ const char *email = "devel@monitoring-plugins.org";
 #include "utils.h"
 #include "base64.h"
 #include <ctype.h>
+#ifdef HAVE_NGHTTP2
+#include <netinet/tcp.h>
+#include <nghttp2/nghttp2.h>
+#endif
 
 #define STICKY_NONE 0
 #define STICKY_HOST 1
@@ -131,12 +135,80 @@ char *http_content_type;
 char buffer[MAX_INPUT_BUFFER];
 char *client_cert = NULL;
 char *client_privkey = NULL;
+int conditional = FALSE;
+char *stored_etag;
+char *stored_last_modified;
+char *stored_verdict;
+int stored_result = STATE_OK;
+char *range_spec;
+long long range_first = -1;
+long long range_last = -1;
+long long range_length = -1;
+int samples = 0;
+double sample_interval = 0;
+int fresh_connections = FALSE;
+int use_http2 = FALSE;
+char **urls;
+int url_count = 0;
+
+/* --samples statistics, each of which can carry its own thresholds */
+enum { SAMPLE_CONNECT, SAMPLE_TTFB, SAMPLE_TIME, SAMPLE_SERIES };
+enum { STAT_MIN, STAT_P50, STAT_P95, STAT_MAX, SAMPLE_STATS };
+const char *sample_series_name[SAMPLE_SERIES] = { "connect", "ttfb", "time" };
+const char *sample_stat_name[SAMPLE_STATS] = { "min", "p50", "p95", "max" };
+char *sample_warn[SAMPLE_SERIES][SAMPLE_STATS];
+char *sample_crit[SAMPLE_SERIES][SAMPLE_STATS];
+
+/* Log-linear latency histogram: 16 buckets per power of two microseconds */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+typedef struct latency_hist {
+  unsigned int count[HIST_BUCKETS];
+  unsigned int n;
+  long min;
+  long max;
+} latency_hist;
+
+/* One header field, as offsets into the buffer the response is read into */
+typedef struct http_field {
+  size_t line;          /* start of the field line, where the name is */
+  size_t name_len;
+  size_t value;
+  size_t value_len;     /* continuation lines included */
+  int next;             /* previous field in the same bucket, or -1 */
+} http_field;
+
+/*
+ * Status line and header fields of a response, split and indexed by name
+ * once as the data arrives. The buffer may move between calls as long as
+ * its contents stay, so the fields only keep offsets.
+ */
+#define HTTP_HEAD_BUCKETS 64
+typedef struct http_head {
+  const char *buf;
+  int has_status;       /* FALSE for HTTP/2, whose status is a pseudo header */
+  int status_seen;
+  size_t status_len;    /* the status line starts the buffer */
+  size_t header_start;  /* the header block, without the final line break */
+  size_t header_end;
+  size_t parsed;        /* first line not looked at yet */
+  size_t length;        /* head and blank line, 0 until complete */
+  http_field *fields;
+  int count;
+  int size;
+  int bucket[HTTP_HEAD_BUCKETS];
+} http_head;
 
 int process_arguments (int, char **);
 int check_http (void);
-void redir (char *pos, char *status_line);
+int check_http_samples (void);
+int check_http2 (void);
+void redir (const http_head *head, char *status_line);
 int server_type_check(const char *type);
 int server_port_check(int ssl_flag);
+void read_conditional_state (void);
+void write_conditional_state (const http_head *head, int content_result, const char *verdict);
 char *perfd_time (double microsec);
 char *perfd_time_connect (double microsec);
 char *perfd_time_ssl (double microsec);
@@ -162,12 +234,19 @@ main (int argc, char **argv)
   xasprintf (&user_agent, "User-Agent: check_http/v%s (monitoring-plugins %s)",
             NP_VERSION, VERSION);
 
+  np_init ((char *) progname, argc, argv);
+
   /* Parse extra opts if any */
   argv=np_extra_opts (&argc, argv, progname);
 
+  np_set_args (argc, argv);
+
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (conditional)
+    read_conditional_state ();
+
   if (display_html == TRUE)
     printf ("<A HREF=\"%s://%s:%d%s\" target=\"_blank\">",
       use_ssl ? "https" : "http", host_name ? host_name : server_address,
@@ -178,7 +257,14 @@ main (int argc, char **argv)
   (void) alarm (socket_timeout);
   gettimeofday (&tv, NULL);
 
-  result = check_http ();
+  if (samples)
+    result = check_http_samples ();
+#ifdef HAVE_NGHTTP2
+  else if (use_http2)
+    result = check_http2 ();
+#endif
+  else
+    result = check_http ();
   return result;
 }
 
@@ -191,6 +277,31 @@ test_file (char *path)
   usage2 (_("file does not exist or is not readable"), path);
 }
 
+/* Parse METRIC,WARN[,CRIT] for --sample-threshold, e.g. ttfb_p95,0.2,0.5 */
+static void
+set_sample_threshold (const char *arg)
+{
+  char *ranges = strdup (arg);
+  char *label = strsep (&ranges, ",");
+  char *name;
+  int series, stat;
+
+  for (series = 0; series < SAMPLE_SERIES; series++)
+    for (stat = 0; stat < SAMPLE_STATS; stat++) {
+      xasprintf (&name, "%s_%s", sample_series_name[series], sample_stat_name[stat]);
+      if (ranges && !strcmp (label, name)) {
+        free (name);
+        label = strsep (&ranges, ",");
+        sample_warn[series][stat] = *label ? label : NULL;
+        sample_crit[series][stat] = ranges && *ranges ? ranges : NULL;
+        return;
+      }
+      free (name);
+    }
+
+  usage2 (_("Invalid sample threshold, expected METRIC,WARN[,CRIT] such as time_p95,1,2"), arg);
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -201,7 +312,14 @@ process_arguments (int argc, char **argv)
 
   enum {
     INVERT_REGEX = CHAR_MAX + 1,
-    SNI_OPTION
+    SNI_OPTION,
+    CONDITIONAL_OPTION,
+    RANGE_OPTION,
+    SAMPLES_OPTION,
+    FRESH_CONNECTIONS_OPTION,
+    SAMPLE_THRESHOLD_OPTION,
+    HTTP2_OPTION,
+    KTLS_OPTION
   };
 
   int option = 0;
@@ -236,6 +354,13 @@ process_arguments (int argc, char **argv)
     {"content-type", required_argument, 0, 'T'},
     {"pagesize", required_argument, 0, 'm'},
     {"invert-regex", no_argument, NULL, INVERT_REGEX},
+    {"conditional", no_argument, NULL, CONDITIONAL_OPTION},
+    {"range", required_argument, NULL, RANGE_OPTION},
+    {"samples", required_argument, NULL, SAMPLES_OPTION},
+    {"fresh-connections", no_argument, NULL, FRESH_CONNECTIONS_OPTION},
+    {"sample-threshold", required_argument, NULL, SAMPLE_THRESHOLD_OPTION},
+    {"http2", no_argument, NULL, HTTP2_OPTION},
+    {"ktls", no_argument, NULL, KTLS_OPTION},
     {"use-ipv4", no_argument, 0, '4'},
     {"use-ipv6", no_argument, 0, '6'},
     {"extended-perfdata", no_argument, 0, 'E'},
@@ -370,6 +495,13 @@ process_arguments (int argc, char **argv)
     case SNI_OPTION:
       use_sni = TRUE;
       break;
+    case KTLS_OPTION:
+#ifdef HAVE_SSL
+      np_net_ssl_set_ktls (TRUE);
+#else
+      usage4 (_("Invalid option - SSL is not available"));
+#endif
+      break;
     case 'f': /* onredirect */
       if (!strcmp (optarg, "stickyport"))
         onredirect = STATE_DEPENDENT, followsticky = STICKY_HOST|STICKY_PORT;
@@ -419,6 +551,9 @@ process_arguments (int argc, char **argv)
     case 'u': /* URL path */
       server_url = strdup (optarg);
       server_url_length = strlen (server_url);
+      /* all of them become streams with --http2, otherwise the last one wins */
+      urls = realloc (urls, sizeof (char *) * (++url_count));
+      urls[url_count - 1] = server_url;
       break;
     case 'p': /* Server port */
       if (!is_intnonneg (optarg))
@@ -481,6 +616,56 @@ process_arguments (int argc, char **argv)
     case INVERT_REGEX:
       invert_regex = 1;
       break;
+    case CONDITIONAL_OPTION:
+      if (conditional == FALSE)
+        np_enable_state (NULL, 1);
+      conditional = TRUE;
+      break;
+    case RANGE_OPTION: /* FIRST-LAST or -SUFFIX_LENGTH */
+      range_spec = optarg;
+      if (optarg[0] == '-') {
+        range_length = strtoll (optarg + 1, &p, 10);
+        if (p == optarg + 1 || *p || range_length <= 0)
+          usage2 (_("Invalid byte range"), optarg);
+      } else {
+        range_first = strtoll (optarg, &p, 10);
+        if (p == optarg || *p != '-' || range_first < 0)
+          usage2 (_("Invalid byte range"), optarg);
+        /* FIRST- would fetch the rest of the object */
+        if (!*++p)
+          usage2 (_("The byte range needs a last byte"), optarg);
+        range_last = strtoll (p, &temp, 10);
+        if (*temp || range_last < range_first)
+          usage2 (_("Invalid byte range"), optarg);
+        range_length = range_last - range_first + 1;
+      }
+      break;
+    case SAMPLES_OPTION: /* N[,INTERVAL] */
+      samples = strtol (optarg, &p, 10);
+      if (p == optarg || samples < 1 || (*p && *p != ','))
+        usage2 (_("Invalid number of samples"), optarg);
+      if (*p == ',') {
+        sample_interval = strtod (p + 1, &temp);
+        if (temp == p + 1 || *temp || sample_interval < 0)
+          usage2 (_("Invalid sample interval"), optarg);
+      }
+      break;
+    case FRESH_CONNECTIONS_OPTION:
+      fresh_connections = TRUE;
+      break;
+    case SAMPLE_THRESHOLD_OPTION:
+      set_sample_threshold (optarg);
+      break;
+    case HTTP2_OPTION:
+#ifdef HAVE_NGHTTP2
+      use_http2 = TRUE;
+      use_ssl = TRUE;
+      if (specify_port == FALSE)
+        server_port = HTTPS_PORT;
+#else
+      usage4 (_("HTTP/2 support not available"));
+#endif
+      break;
     case '4':
       address_family = AF_INET;
       break;
@@ -569,6 +754,39 @@ process_arguments (int argc, char **argv)
   if (client_cert && !client_privkey)
     usage4 (_("If you use a client certificate you must also specify a private key file"));
 
+  if (conditional && strcmp (http_method, "GET") && strcmp (http_method, "HEAD"))
+    usage4 (_("Conditional requests are only supported with the GET and HEAD methods"));
+
+  if (use_http2) {
+    if (url_count == 0) {
+      urls = malloc (sizeof (char *));
+      urls[url_count++] = server_url;
+    }
+    if (http_post_data || samples || conditional || range_spec ||
+        onredirect == STATE_DEPENDENT || !strcmp (http_method, "CONNECT"))
+      usage4 (_("--http2 cannot be combined with POST data, --samples, --conditional, --range or following redirects"));
+    if (check_cert)
+      usage4 (_("--http2 cannot be combined with certificate checks"));
+  }
+
+  if (samples) {
+#ifdef HAVE_SSL
+    if (check_cert)
+      usage4 (_("--samples cannot be combined with certificate checks"));
+#endif
+    if (strlen (header_expect) || strlen (string_expect) || strlen (regexp) ||
+        min_page_len || max_page_len || maximum_age >= 0 || conditional || range_spec ||
+        onredirect == STATE_DEPENDENT || !strcmp (http_method, "CONNECT"))
+      usage4 (_("--samples only measures latency and cannot be combined with content or redirect checks"));
+    if ((samples - 1) * sample_interval >= socket_timeout)
+      usage4 (_("The samples take longer than the timeout (-t)"));
+    /* -w and -c apply to the median response time unless given explicitly */
+    if (!sample_warn[SAMPLE_TIME][STAT_P50] && !sample_crit[SAMPLE_TIME][STAT_P50]) {
+      sample_warn[SAMPLE_TIME][STAT_P50] = warning_thresholds;
+      sample_crit[SAMPLE_TIME][STAT_P50] = critical_thresholds;
+    }
+  }
+
   if (virtual_port == 0)
     virtual_port = server_port;
 
@@ -577,22 +795,180 @@ process_arguments (int argc, char **argv)
 
 
 
-/* Returns 1 if we're done processing the document body; 0 to keep going */
+static void
+http_head_init (http_head *head, int has_status)
+{
+  int i;
+
+  memset (head, 0, sizeof (http_head));
+  head->has_status = has_status;
+  for (i = 0; i < HTTP_HEAD_BUCKETS; i++)
+    head->bucket[i] = -1;
+}
+
+static void
+http_head_free (http_head *head)
+{
+  free (head->fields);
+  head->fields = NULL;
+  head->count = head->size = 0;
+}
+
+static unsigned int
+http_field_hash (const char *name, size_t len)
+{
+  unsigned int hash = 5381;
+
+  while (len--)
+    hash = hash * 33 + tolower (*name++);
+  return hash % HTTP_HEAD_BUCKETS;
+}
+
+/* Take in the line from start up to end, where its LF is (or would be) */
+static void
+http_head_line (http_head *head, size_t start, size_t end)
+{
+  const char *line = head->buf + start;
+  size_t len = end - start, name_len, value;
+  http_field *field;
+  int hash;
+
+  if (len > 0 && line[len - 1] == '\r')
+    len--;
+
+  if (head->has_status && !head->status_seen) {
+    head->status_seen = TRUE;
+    head->status_len = len;
+    head->header_start = head->header_end = end + 1;
+    return;
+  }
+
+  if (len == 0) {
+    head->length = end + 1;
+    return;
+  }
+  head->header_end = start + len;
+
+  /* RFC 7230 3.2.4: a line starting with white space continues the value */
+  if (line[0] == ' ' || line[0] == '\t') {
+    if (head->count == 0)
+      return;
+    field = &head->fields[head->count - 1];
+    while (len > 0 && isspace (line[len - 1]))
+      len--;
+    if (field->value_len == 0) {
+      value = strspn (line, " \t");
+      if (value < len) {
+        field->value = start + value;
+        field->value_len = len - value;
+      }
+    }
+    else if (len > 0)
+      field->value_len = start + len - field->value;
+    return;
+  }
+
+  for (name_len = 0; name_len < len && line[name_len] != ':' && !isspace (line[name_len]); name_len++)
+    ;
+  if (name_len == 0 || name_len == len || line[name_len] != ':')
+    return;
+
+  if (head->count == head->size) {
+    head->size = head->size ? 2 * head->size : 16;
+    head->fields = realloc (head->fields, head->size * sizeof (http_field));
+    if (head->fields == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  }
+  field = &head->fields[head->count];
+  field->line = start;
+  field->name_len = name_len;
+  for (value = name_len + 1; value < len && (line[value] == ' ' || line[value] == '\t'); value++)
+    ;
+  while (len > value && isspace (line[len - 1]))
+    len--;
+  field->value = start + value;
+  field->value_len = len - value;
+
+  /* newest first, so a repeated field reads as its last value */
+  hash = http_field_hash (line, name_len);
+  field->next = head->bucket[hash];
+  head->bucket[hash] = head->count++;
+}
+
+/*
+ * Parse the lines of buf (len bytes so far) that completed since the last
+ * call. Returns TRUE once the blank line ending the head was seen.
+ */
 static int
-document_headers_done (char *full_page)
+http_head_feed (http_head *head, const char *buf, size_t len)
 {
-  const char *body;
+  const char *eol;
 
-  for (body = full_page; *body; body++) {
-    if (!strncmp (body, "\n\n", 2) || !strncmp (body, "\n\r\n", 3))
-      break;
+  head->buf = buf;
+  while (!head->length && (eol = memchr (buf + head->parsed, '\n', len - head->parsed)) != NULL) {
+    http_head_line (head, head->parsed, eol - buf);
+    head->parsed = eol - buf + 1;
   }
+  return head->length > 0;
+}
+
+/* The connection closed: whatever has no blank line after it is all head */
+static void
+http_head_finish (http_head *head, const char *buf, size_t len)
+{
+  if (http_head_feed (head, buf, len))
+    return;
+  if (head->parsed < len)
+    http_head_line (head, head->parsed, len);
+  head->parsed = head->length = len;
+  if (head->header_start > len)
+    head->header_start = head->header_end = len;
+}
+
+static const http_field *
+http_head_find (const http_head *head, const char *name)
+{
+  size_t len = strlen (name);
+  int i;
+
+  for (i = head->bucket[http_field_hash (name, len)]; i >= 0; i = head->fields[i].next)
+    if (head->fields[i].name_len == len &&
+        !strncasecmp (head->buf + head->fields[i].line, name, len))
+      return &head->fields[i];
+  return NULL;
+}
 
-  if (!*body)
-    return 0;  /* haven't read end of headers yet */
+/* Returns a copy of the value of the named header, folded onto one line, or NULL */
+static char *
+http_head_value (const http_head *head, const char *name)
+{
+  const http_field *field = http_head_find (head, name);
+  const char *s, *end;
+  char *value, *p;
+
+  if (field == NULL)
+    return NULL;
+  if ((value = p = malloc (field->value_len + 1)) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  for (s = head->buf + field->value, end = s + field->value_len; s < end; s++) {
+    if (*s == '\r' || *s == '\n') {
+      while (s + 1 < end && isspace (s[1]))
+        s++;
+      *p++ = ' ';
+    }
+    else
+      *p++ = *s;
+  }
+  *p = '\0';
+  return value;
+}
 
-  full_page[body - full_page] = 0;
-  return 1;
+/* Looks for text anywhere in the header block, as -d always did */
+static int
+http_head_contains (const http_head *head, const char *text)
+{
+  return memmem (head->buf + head->header_start, head->header_end - head->header_start,
+                 text, strlen (text)) != NULL;
 }
 
 static time_t
@@ -707,61 +1083,16 @@ expected_statuscode (const char *reply, const char *statuscodes)
 }
 
 static int
-check_document_dates (const char *headers, char **msg)
+check_document_dates (const http_head *head, const char *stored_date, char **msg)
 {
-  const char *s;
-  char *server_date = 0;
-  char *document_date = 0;
+  char *server_date = http_head_value (head, "date");
+  char *document_date = http_head_value (head, "last-modified");
   int date_result = STATE_OK;
 
-  s = headers;
-  while (*s) {
-    const char *field = s;
-    const char *value = 0;
-
-    /* Find the end of the header field */
-    while (*s && !isspace(*s) && *s != ':')
-      s++;
-
-    /* Remember the header value, if any. */
-    if (*s == ':')
-      value = ++s;
-
-    /* Skip to the end of the header, including continuation lines. */
-    while (*s && !(*s == '\n' && (s[1] != ' ' && s[1] != '\t')))
-      s++;
-
-    /* Avoid stepping over end-of-string marker */
-    if (*s)
-      s++;
-
-    /* Process this header. */
-    if (value && value > field+2) {
-      char *ff = (char *) malloc (value-field);
-      char *ss = ff;
-      while (field < value-1)
-        *ss++ = tolower(*field++);
-      *ss++ = 0;
-
-      if (!strcmp (ff, "date") || !strcmp (ff, "last-modified")) {
-        const char *e;
-        while (*value && isspace (*value))
-          value++;
-        for (e = value; *e && *e != '\r' && *e != '\n'; e++)
-          ;
-        ss = (char *) malloc (e - value + 1);
-        strncpy (ss, value, e - value);
-        ss[e - value] = 0;
-        if (!strcmp (ff, "date")) {
-          if (server_date) free (server_date);
-          server_date = ss;
-        } else {
-          if (document_date) free (document_date);
-          document_date = ss;
-        }
-      }
-      free (ff);
-    }
+  /* A 304 reply need not repeat Last-Modified, so fall back to the stored one */
+  if ((!document_date || !*document_date) && stored_date && *stored_date) {
+    free (document_date);
+    document_date = strdup (stored_date);
   }
 
   /* Done parsing the body.  Now check the dates we (hopefully) parsed.  */
@@ -794,63 +1125,191 @@ check_document_dates (const char *headers, char **msg)
         date_result = max_state_alt(STATE_CRITICAL, date_result);
       }
     }
-    free (server_date);
-    free (document_date);
   }
+  free (server_date);
+  free (document_date);
   return date_result;
 }
 
 int
-get_content_length (const char *headers)
+get_content_length (const http_head *head)
+{
+  char *value = http_head_value (head, "content-length");
+  int content_length = value ? atoi (value) : 0;
+
+  free (value);
+  return content_length;
+}
+
+/* Validate the reply to a --range request; total is set to the full object size if known.
+ * body_len is -1 for a chunked body, whose length is not checked */
+static int
+check_content_range (const http_head *head, int status, long long body_len, char **msg, long long *total)
+{
+  char *content_range;
+  char size[32];
+  long long first, last;
+  int result = STATE_OK;
+
+  if (status != 206) {
+    xasprintf (msg, _("%sserver ignored the range request, "), *msg);
+    return STATE_WARNING;
+  }
+
+  if ((content_range = http_head_value (head, "content-range")) == NULL) {
+    xasprintf (msg, _("%sno Content-Range in partial response, "), *msg);
+    return STATE_CRITICAL;
+  }
+
+  if (sscanf (content_range, "bytes %lld-%lld/%31s", &first, &last, size) != 3 || last < first) {
+    xasprintf (msg, _("%sinvalid Content-Range \"%.100s\", "), *msg, content_range);
+    result = STATE_CRITICAL;
+  } else {
+    if (strcmp (size, "*"))
+      *total = strtoll (size, NULL, 10);
+    if ((range_first >= 0 && first != range_first) ||
+        (range_last >= 0 && last > range_last) ||
+        (range_first < 0 && *total >= 0 && last != *total - 1) ||
+        (*total >= 0 && last >= *total)) {
+      xasprintf (msg, _("%sContent-Range \"%.100s\" does not match bytes=%s, "), *msg, content_range, range_spec);
+      result = STATE_CRITICAL;
+    } else if (!no_body && body_len >= 0 && body_len != last - first + 1) {
+      xasprintf (msg, _("%sreceived %lld of %lld bytes in range, "), *msg, body_len, last - first + 1);
+      result = STATE_CRITICAL;
+    }
+  }
+
+  free (content_range);
+  return result;
+}
+
+/* Header, string, regex and size checks on one response, problems are appended to msg */
+static int
+check_content (const http_head *head, const char *page, const char *url, long long size, char **msg)
 {
-  const char *s;
-  int content_length = 0;
-
-  s = headers;
-  while (*s) {
-    const char *field = s;
-    const char *value = 0;
-
-    /* Find the end of the header field */
-    while (*s && !isspace(*s) && *s != ':')
-      s++;
-
-    /* Remember the header value, if any. */
-    if (*s == ':')
-      value = ++s;
-
-    /* Skip to the end of the header, including continuation lines. */
-    while (*s && !(*s == '\n' && (s[1] != ' ' && s[1] != '\t')))
-      s++;
-
-    /* Avoid stepping over end-of-string marker */
-    if (*s)
-      s++;
-
-    /* Process this header. */
-    if (value && value > field+2) {
-      char *ff = (char *) malloc (value-field);
-      char *ss = ff;
-      while (field < value-1)
-        *ss++ = tolower(*field++);
-      *ss++ = 0;
-
-      if (!strcmp (ff, "content-length")) {
-        const char *e;
-        while (*value && isspace (*value))
-          value++;
-        for (e = value; *e && *e != '\r' && *e != '\n'; e++)
-          ;
-        ss = (char *) malloc (e - value + 1);
-        strncpy (ss, value, e - value);
-        ss[e - value] = 0;
-        content_length = atoi(ss);
-        free (ss);
+  int result = STATE_OK;
+
+  if (strlen (header_expect)) {
+    if (!http_head_contains (head, header_expect)) {
+      strncpy(&output_header_search[0],header_expect,sizeof(output_header_search));
+      if(output_header_search[sizeof(output_header_search)-1]!='\0') {
+        bcopy("...",&output_header_search[sizeof(output_header_search)-4],4);
+      }
+      xasprintf (msg, _("%sheader '%s' not found on '%s://%s:%d%s', "), *msg, output_header_search, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, url);
+      result = STATE_CRITICAL;
+    }
+  }
+
+
+  if (strlen (string_expect)) {
+    if (!strstr (page, string_expect)) {
+      strncpy(&output_string_search[0],string_expect,sizeof(output_string_search));
+      if(output_string_search[sizeof(output_string_search)-1]!='\0') {
+        bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
       }
-      free (ff);
+      xasprintf (msg, _("%sstring '%s' not found on '%s://%s:%d%s', "), *msg, output_string_search, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, url);
+      result = STATE_CRITICAL;
+    }
+  }
+
+  if (strlen (regexp)) {
+    errcode = regexec (&preg, page, REGS, pmatch, 0);
+    if ((errcode == 0 && invert_regex == 0) || (errcode == REG_NOMATCH && invert_regex == 1)) {
+      /* OK - No-op to avoid changing the logic around it */
+      result = max_state_alt(STATE_OK, result);
+    }
+    else if ((errcode == REG_NOMATCH && invert_regex == 0) || (errcode == 0 && invert_regex == 1)) {
+      if (invert_regex == 0)
+        xasprintf (msg, _("%spattern not found, "), *msg);
+      else
+        xasprintf (msg, _("%spattern found, "), *msg);
+      result = STATE_CRITICAL;
+    }
+    else {
+      /* FIXME: Shouldn't that be UNKNOWN? */
+      regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+      xasprintf (msg, _("%sExecute Error: %s, "), *msg, errbuf);
+      result = STATE_CRITICAL;
     }
   }
-  return (content_length);
+
+  if ((max_page_len > 0) && (size > max_page_len)) {
+    xasprintf (msg, _("%spage size %lld too large, "), *msg, size);
+    result = max_state_alt(STATE_WARNING, result);
+  } else if ((min_page_len > 0) && (size < min_page_len)) {
+    xasprintf (msg, _("%spage size %lld too small, "), *msg, size);
+    result = max_state_alt(STATE_WARNING, result);
+  }
+
+  return result;
+}
+
+/* Load the validators and content verdict saved by the last --conditional run */
+void
+read_conditional_state (void)
+{
+  state_data *previous_state;
+  char *copy, *data, *field;
+
+  previous_state = np_state_read ();
+  if (previous_state == NULL)
+    return;
+
+  /* result <TAB> etag <TAB> last-modified <TAB> verdict, kept for the run */
+  data = copy = strdup ((char *) previous_state->data);
+  if (copy == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  if ((field = strsep (&data, "\t")) == NULL || !is_intnonneg (field)) {
+    free (copy);
+    return;
+  }
+  stored_etag = strsep (&data, "\t");
+  stored_last_modified = strsep (&data, "\t");
+  if (stored_etag == NULL || stored_last_modified == NULL || data == NULL) {
+    stored_etag = stored_last_modified = NULL;
+    free (copy);
+    return;
+  }
+  stored_result = atoi (field);
+  stored_verdict = data;
+
+  if (verbose)
+    printf (_("Stored state: ETag '%s', Last-Modified '%s', result %s\n"),
+            stored_etag, stored_last_modified, state_text (stored_result));
+}
+
+/* Blank out characters that would break the tab separated state line */
+static char *
+flatten_state_field (char *field)
+{
+  char *p;
+
+  for (p = field; p && *p; p++)
+    if (*p == '\t' || *p == '\r' || *p == '\n')
+      *p = ' ';
+  return field ? field : "";
+}
+
+/* Save the validators of a freshly fetched document with its content verdict */
+void
+write_conditional_state (const http_head *head, int content_result, const char *verdict)
+{
+  char *etag, *last_modified, *text, *data;
+
+  etag = http_head_value (head, "etag");
+  last_modified = http_head_value (head, "last-modified");
+  text = strdup (verdict);
+
+  /* Stored in full, a cut validator would never match again */
+  xasprintf (&data, "%d\t%s\t%s\t%s", content_result,
+             flatten_state_field (etag), flatten_state_field (last_modified),
+             flatten_state_field (text));
+  np_state_write_string (0, data);
+
+  free (etag);
+  free (last_modified);
+  free (text);
+  free (data);
 }
 
 char *
@@ -869,84 +1328,14 @@ prepend_slash (char *path)
   return newpath;
 }
 
-int
-check_http (void)
+/* Assemble the request for server_url; only --samples may ask to keep the connection open */
+static char *
+build_request (int keep_alive)
 {
-  char *msg;
-  char *status_line;
-  char *status_code;
-  char *header;
-  char *page;
-  char *auth;
-  int http_status;
-  int i = 0;
-  size_t pagesize = 0;
-  char *full_page;
-  char *full_page_new;
   char *buf;
-  char *pos;
-  long microsec = 0L;
-  double elapsed_time = 0.0;
-  long microsec_connect = 0L;
-  double elapsed_time_connect = 0.0;
-  long microsec_ssl = 0L;
-  double elapsed_time_ssl = 0.0;
-  long microsec_firstbyte = 0L;
-  double elapsed_time_firstbyte = 0.0;
-  long microsec_headers = 0L;
-  double elapsed_time_headers = 0.0;
-  long microsec_transfer = 0L;
-  double elapsed_time_transfer = 0.0;
-  int page_len = 0;
-  int result = STATE_OK;
+  char *auth;
   char *force_host_header = NULL;
-
-  /* try to connect to the host at the given port number */
-  gettimeofday (&tv_temp, NULL);
-  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
-    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
-  microsec_connect = deltime (tv_temp);
-
-    /* if we are called with the -I option, the -j method is CONNECT and */
-    /* we received -S for SSL, then we tunnel the request through a proxy*/
-    /* @20100414, public[at]frank4dd.com, http://www.frank4dd.com/howto  */
-
-    if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
-      && host_name != NULL && use_ssl == TRUE) {
-
-    if (verbose) printf ("Entering CONNECT tunnel mode with proxy %s:%d to dst %s:%d\n", server_address, server_port, host_name, HTTPS_PORT);
-    asprintf (&buf, "%s %s:%d HTTP/1.1\r\n%s\r\n", http_method, host_name, HTTPS_PORT, user_agent);
-    asprintf (&buf, "%sProxy-Connection: keep-alive\r\n", buf);
-    asprintf (&buf, "%sHost: %s\r\n", buf, host_name);
-    /* we finished our request, send empty line with CRLF */
-    asprintf (&buf, "%s%s", buf, CRLF);
-    if (verbose) printf ("%s\n", buf);
-    send(sd, buf, strlen (buf), 0);
-    buf[0]='\0';
-
-    if (verbose) printf ("Receive response from proxy\n");
-    read (sd, buffer, MAX_INPUT_BUFFER-1);
-    if (verbose) printf ("%s", buffer);
-    /* Here we should check if we got HTTP/1.1 200 Connection established */
-  }
-#ifdef HAVE_SSL
-  elapsed_time_connect = (double)microsec_connect / 1.0e6;
-  if (use_ssl == TRUE) {
-    gettimeofday (&tv_temp, NULL);
-    result = np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey);
-    if (verbose) printf ("SSL initialized\n");
-    if (result != STATE_OK)
-      die (STATE_CRITICAL, NULL);
-    microsec_ssl = deltime (tv_temp);
-    elapsed_time_ssl = (double)microsec_ssl / 1.0e6;
-    if (check_cert == TRUE) {
-      result = np_net_ssl_check_cert(days_till_exp_warn, days_till_exp_crit);
-      if (sd) close(sd);
-      np_net_ssl_cleanup();
-      return result;
-    }
-  }
-#endif /* HAVE_SSL */
+  int i;
 
   if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
        && host_name != NULL && use_ssl == TRUE)
@@ -954,8 +1343,12 @@ check_http (void)
   else
     asprintf (&buf, "%s %s %s\r\n%s\r\n", http_method, server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
 
-  /* tell HTTP/1.1 servers not to keep the connection alive */
-  xasprintf (&buf, "%sConnection: close\r\n", buf);
+  if (samples && keep_alive)
+    /* --samples sends its next request over the same connection */
+    xasprintf (&buf, "%sConnection: keep-alive\r\n", buf);
+  else
+    /* tell HTTP/1.1 servers not to keep the connection alive */
+    xasprintf (&buf, "%sConnection: close\r\n", buf);
 
   /* check if Host header is explicitly set in options */
   if (http_opt_headers_count) {
@@ -999,6 +1392,17 @@ check_http (void)
     /* free(http_opt_headers); */
   }
 
+  if (range_spec)
+    xasprintf (&buf, "%sRange: bytes=%s\r\n", buf, range_spec);
+
+  /* revalidate the document checked by the last run */
+  if (conditional && redir_depth == 0 && stored_verdict) {
+    if (*stored_etag)
+      xasprintf (&buf, "%sIf-None-Match: %s\r\n", buf, stored_etag);
+    if (*stored_last_modified)
+      xasprintf (&buf, "%sIf-Modified-Since: %s\r\n", buf, stored_last_modified);
+  }
+
   /* optionally send the authentication info */
   if (strlen(user_auth)) {
     base64_encode_alloc (user_auth, strlen (user_auth), &auth);
@@ -1027,14 +1431,106 @@ check_http (void)
     xasprintf (&buf, "%s%s", buf, CRLF);
   }
 
-  if (verbose) printf ("%s\n", buf);
+  return buf;
+}
+
+int
+check_http (void)
+{
+  char *msg;
+  char *status_line;
+  char *status_code;
+  char *header;
+  char *value;
+  char *page;
+  http_head head;
+  int http_status = 0;
+  int i = 0;
+  size_t pagesize = 0;
+  char *full_page;
+  char *buf;
+  char *pos;
+  long microsec = 0L;
+  double elapsed_time = 0.0;
+  long microsec_connect = 0L;
+  double elapsed_time_connect = 0.0;
+  long microsec_ssl = 0L;
+  double elapsed_time_ssl = 0.0;
+  long microsec_firstbyte = 0L;
+  double elapsed_time_firstbyte = 0.0;
+  long microsec_headers = 0L;
+  double elapsed_time_headers = 0.0;
+  long microsec_transfer = 0L;
+  double elapsed_time_transfer = 0.0;
+  int page_len = 0;
+  long long object_size = -1;
+  long long range_body = 0;
+  int range_chunked = -1; /* until the head is in */
+  int result = STATE_OK;
+  int status_result;
+  int not_modified = FALSE;
+  size_t content_start;
+
+  /* try to connect to the host at the given port number */
+  gettimeofday (&tv_temp, NULL);
+  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+  microsec_connect = deltime (tv_temp);
+
+    /* if we are called with the -I option, the -j method is CONNECT and */
+    /* we received -S for SSL, then we tunnel the request through a proxy*/
+    /* @20100414, public[at]frank4dd.com, http://www.frank4dd.com/howto  */
+
+    if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
+      && host_name != NULL && use_ssl == TRUE) {
+
+    if (verbose) printf ("Entering CONNECT tunnel mode with proxy %s:%d to dst %s:%d\n", server_address, server_port, host_name, HTTPS_PORT);
+    asprintf (&buf, "%s %s:%d HTTP/1.1\r\n%s\r\n", http_method, host_name, HTTPS_PORT, user_agent);
+    asprintf (&buf, "%sProxy-Connection: keep-alive\r\n", buf);
+    asprintf (&buf, "%sHost: %s\r\n", buf, host_name);
+    /* we finished our request, send empty line with CRLF */
+    asprintf (&buf, "%s%s", buf, CRLF);
+    if (verbose) printf ("%s\n", buf);
+    send(sd, buf, strlen (buf), 0);
+    buf[0]='\0';
+
+    if (verbose) printf ("Receive response from proxy\n");
+    read (sd, buffer, MAX_INPUT_BUFFER-1);
+    if (verbose) printf ("%s", buffer);
+    /* Here we should check if we got HTTP/1.1 200 Connection established */
+  }
+#ifdef HAVE_SSL
+  elapsed_time_connect = (double)microsec_connect / 1.0e6;
+  if (use_ssl == TRUE) {
+    gettimeofday (&tv_temp, NULL);
+    result = np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey);
+    if (verbose) printf ("SSL initialized\n");
+    if (result != STATE_OK)
+      die (STATE_CRITICAL, NULL);
+    if (verbose)
+      printf (_("kTLS: %s\n"), np_net_ssl_get_ktls () ? np_net_ssl_get_ktls () : _("not active"));
+    microsec_ssl = deltime (tv_temp);
+    elapsed_time_ssl = (double)microsec_ssl / 1.0e6;
+    if (check_cert == TRUE) {
+      result = np_net_ssl_check_cert(days_till_exp_warn, days_till_exp_crit);
+      if (sd) close(sd);
+      np_net_ssl_cleanup();
+      return result;
+    }
+  }
+#endif /* HAVE_SSL */
+
+  buf = build_request (FALSE);
+
+  if (verbose) printf ("%s\n", buf);
   gettimeofday (&tv_temp, NULL);
   my_send (buf, strlen (buf));
   microsec_headers = deltime (tv_temp);
   elapsed_time_headers = (double)microsec_headers / 1.0e6;
 
-  /* fetch the page */
+  /* fetch the page, splitting up the head as it comes in */
   full_page = strdup("");
+  http_head_init (&head, TRUE);
   gettimeofday (&tv_temp, NULL);
   while ((i = my_recv (buffer, MAX_INPUT_BUFFER-1)) > 0) {
     if ((i >= 1) && (elapsed_time_firstbyte <= 0.000001)) {
@@ -1045,17 +1541,36 @@ check_http (void)
       /* replace nul character with a blank */
       *pos = ' ';
     }
-    buffer[i] = '\0';
-    xasprintf (&full_page_new, "%s%s", full_page, buffer);
-    free (full_page);
-    full_page = full_page_new;
+    if ((full_page = realloc (full_page, pagesize + i + 1)) == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    memcpy (full_page + pagesize, buffer, i);
     pagesize += i;
+    full_page[pagesize] = '\0';
 
-                if (no_body && document_headers_done (full_page)) {
-                  i = 0;
-                  break;
-                }
+    if (http_head_feed (&head, full_page, pagesize)) {
+      if (range_spec && range_chunked < 0) {
+        value = http_head_value (&head, "transfer-encoding");
+        range_chunked = value && strstr (value, "chunked");
+        free (value);
+      }
+      if (no_body) {
+        full_page[head.length] = '\0';
+        i = 0;
+        break;
+      }
+      /* a server ignoring the Range header must not make us fetch it all */
+      if (range_spec) {
+        status_code = memchr (full_page, ' ', head.status_len);
+        if (!status_code || atoi (status_code + 1) != 206 ||
+            (range_length >= 0 && !range_chunked &&
+             (long long) (pagesize - head.length) >= range_length)) {
+          i = 0;
+          break;
+        }
+      }
+    }
   }
+  http_head_finish (&head, full_page, pagesize);
   microsec_transfer = deltime (tv_temp);
   elapsed_time_transfer = (double)microsec_transfer / 1.0e6;
 
@@ -1085,6 +1600,10 @@ check_http (void)
   if (pagesize == (size_t) 0)
     die (STATE_CRITICAL, _("HTTP CRITICAL - No data received from host\n"));
 
+  /* the chunk framing is not part of the range */
+  if (range_spec)
+    range_body = range_chunked > 0 ? -1 : (long long) (pagesize - head.length);
+
   /* close the connection */
   if (sd) close(sd);
 #ifdef HAVE_SSL
@@ -1103,35 +1622,30 @@ check_http (void)
       use_ssl ? "https" : "http", server_address,
       server_port, server_url, (int)pagesize);
 
-  /* find status line and null-terminate it */
+  /* null-terminate the status line and header block, no field reaches into their line ends */
   status_line = page;
-  page += (size_t) strcspn (page, "\r\n");
-  pos = page;
-  page += (size_t) strspn (page, "\r\n");
-  status_line[strcspn(status_line, "\r\n")] = 0;
+  status_line[head.status_len] = 0;
+  header = page + head.header_start;
+  page[head.header_end] = 0;
+  page += head.length;
   strip (status_line);
   if (verbose)
     printf ("STATUS: %s\n", status_line);
 
-  /* find header info and null-terminate it */
-  header = page;
-  while (strcspn (page, "\r\n") > 0) {
-    page += (size_t) strcspn (page, "\r\n");
-    pos = page;
-    if ((strspn (page, "\r") == 1 && strspn (page, "\r\n") >= 2) ||
-        (strspn (page, "\n") == 1 && strspn (page, "\r\n") >= 2))
-      page += (size_t) 2;
-    else
-      page += (size_t) 1;
+  if (conditional || range_spec) {
+    status_code = strchr (status_line, ' ');
+    http_status = status_code ? atoi (status_code + 1) : 0;
   }
-  page += (size_t) strspn (page, "\r\n");
-  header[pos - header] = 0;
+
+  /* a 304 to our validators stands in for the document checked last time */
+  not_modified = conditional && redir_depth == 0 && stored_verdict && http_status == 304;
+
   if (verbose)
     printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", header,
                 (no_body ? "  [[ skipped ]]" : page));
 
   /* make sure the status line matches the response we are looking for */
-  if (!expected_statuscode (status_line, server_expect)) {
+  if (!not_modified && !expected_statuscode (status_line, server_expect)) {
     if (server_port == HTTP_PORT)
       xasprintf (&msg,
                 _("Invalid HTTP response received from host: %s\n"),
@@ -1145,7 +1659,10 @@ check_http (void)
 
   /* Bypass normal status line check if server_expect was set by user and not default */
   /* NOTE: After this if/else block msg *MUST* be an asprintf-allocated string */
-  if ( server_expect_yn  )  {
+  if (not_modified) {
+    xasprintf (&msg, _("%s (unchanged) - "), status_line);
+  }
+  else if ( server_expect_yn  )  {
     xasprintf (&msg,
               _("Status line output matched \"%s\" - "), server_expect);
     if (verbose)
@@ -1181,7 +1698,7 @@ check_http (void)
     else if (http_status >= 300) {
 
       if (onredirect == STATE_DEPENDENT)
-        redir (header, status_line);
+        redir (&head, status_line);
       else
         result = max_state_alt(onredirect, result);
       xasprintf (&msg, _("%s - "), status_line);
@@ -1196,72 +1713,41 @@ check_http (void)
   /* reset the alarm - must be called *after* redir or we'll never die on redirects! */
   alarm (0);
 
-  if (maximum_age >= 0) {
-    result = max_state_alt(check_document_dates(header, &msg), result);
-  }
-
-  /* Page and Header content checks go here */
-  if (strlen (header_expect)) {
-    if (!strstr (header, header_expect)) {
-      strncpy(&output_header_search[0],header_expect,sizeof(output_header_search));
-      if(output_header_search[sizeof(output_header_search)-1]!='\0') {
-        bcopy("...",&output_header_search[sizeof(output_header_search)-4],4);
-      }
-      xasprintf (&msg, _("%sheader '%s' not found on '%s://%s:%d%s', "), msg, output_header_search, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, server_url);
-      result = STATE_CRITICAL;
-    }
-  }
-
-
-  if (strlen (string_expect)) {
-    if (!strstr (page, string_expect)) {
-      strncpy(&output_string_search[0],string_expect,sizeof(output_string_search));
-      if(output_string_search[sizeof(output_string_search)-1]!='\0') {
-        bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
-      }
-      xasprintf (&msg, _("%sstring '%s' not found on '%s://%s:%d%s', "), msg, output_string_search, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, server_url);
-      result = STATE_CRITICAL;
-    }
-  }
+  if (range_spec && !not_modified && http_status >= 200 && http_status < 300)
+    result = max_state_alt(check_content_range(&head, http_status, range_body, &msg, &object_size), result);
 
-  if (strlen (regexp)) {
-    errcode = regexec (&preg, page, REGS, pmatch, 0);
-    if ((errcode == 0 && invert_regex == 0) || (errcode == REG_NOMATCH && invert_regex == 1)) {
-      /* OK - No-op to avoid changing the logic around it */
-      result = max_state_alt(STATE_OK, result);
-    }
-    else if ((errcode == REG_NOMATCH && invert_regex == 0) || (errcode == 0 && invert_regex == 1)) {
-      if (invert_regex == 0)
-        xasprintf (&msg, _("%spattern not found, "), msg);
-      else
-        xasprintf (&msg, _("%spattern found, "), msg);
-      result = STATE_CRITICAL;
-    }
-    else {
-      /* FIXME: Shouldn't that be UNKNOWN? */
-      regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
-      xasprintf (&msg, _("%sExecute Error: %s, "), msg, errbuf);
-      result = STATE_CRITICAL;
-    }
+  if (maximum_age >= 0) {
+    result = max_state_alt(check_document_dates(&head, not_modified ? stored_last_modified : NULL, &msg), result);
   }
 
   /* make sure the page is of an appropriate size */
-  /* page_len = get_content_length(header); */
+  /* page_len = get_content_length(&head); */
   /* FIXME: Will this work with -N ? IMHO we should use
-   * get_content_length(header) and always check if it's different than the
+   * get_content_length(&head) and always check if it's different than the
    * returned pagesize
    */
   /* FIXME: IIRC pagesize returns headers - shouldn't we make
-   * it == get_content_length(header) ??
+   * it == get_content_length(&head) ??
    */
   page_len = pagesize;
-  if ((max_page_len > 0) && (page_len > max_page_len)) {
-    xasprintf (&msg, _("%spage size %d too large, "), msg, page_len);
-    result = max_state_alt(STATE_WARNING, result);
-  } else if ((min_page_len > 0) && (page_len < min_page_len)) {
-    xasprintf (&msg, _("%spage size %d too small, "), msg, page_len);
-    result = max_state_alt(STATE_WARNING, result);
+  /* with --range the limits apply to the size announced in Content-Range */
+  if (object_size < 0)
+    object_size = page_len;
+
+  /* Page and Header content checks go here, -m included. --conditional caches
+   * their verdict, as a 304 carries no body to measure */
+  status_result = result;
+  content_start = strlen (msg);
+  if (not_modified) {
+    xasprintf (&msg, "%s%s", msg, stored_verdict);
+    result = stored_result;
   }
+  else
+    result = check_content (&head, page, server_url, object_size, &msg);
+
+  if (conditional && redir_depth == 0 && http_status >= 200 && http_status < 300)
+    write_conditional_state (&head, result, msg + content_start);
+  result = max_state_alt(status_result, result);
 
   /* Cut-off trailing characters */
   if(msg[strlen(msg)-2] == ',')
@@ -1299,6 +1785,580 @@ check_http (void)
 
 
 
+/* Map a latency in microseconds to its histogram bucket */
+static int
+hist_bucket (long usec)
+{
+  unsigned long v = usec < 0 ? 0 : (unsigned long) usec;
+  int msb;
+
+  if (v > 0xffffffffUL)
+    v = 0xffffffffUL;
+  if (v < HIST_SUB)
+    return v;
+  for (msb = HIST_SUB_BITS; v >> (msb + 1); msb++)
+    ;
+  return (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static void
+hist_add (latency_hist *hist, long usec)
+{
+  if (hist->n == 0 || usec < hist->min)
+    hist->min = usec;
+  if (hist->n == 0 || usec > hist->max)
+    hist->max = usec;
+  hist->count[hist_bucket (usec)]++;
+  hist->n++;
+}
+
+/* Returns the pct percentile in seconds, as the top of the bucket it falls in */
+static double
+hist_stat (const latency_hist *hist, int stat)
+{
+  unsigned long rank, seen = 0;
+  long top;
+  int b, msb;
+
+  if (stat == STAT_MIN)
+    return hist->min / 1.0e6;
+  if (stat == STAT_MAX)
+    return hist->max / 1.0e6;
+
+  rank = ((stat == STAT_P50 ? 50 : 95) * (unsigned long) hist->n + 99) / 100;
+  for (b = 0; b < HIST_BUCKETS; b++) {
+    seen += hist->count[b];
+    if (seen >= rank)
+      break;
+  }
+
+  if (b < HIST_SUB)
+    top = b;
+  else {
+    msb = b / HIST_SUB + HIST_SUB_BITS - 1;
+    top = (((long) HIST_SUB + b % HIST_SUB + 1) << (msb - HIST_SUB_BITS)) - 1;
+  }
+  return max (hist->min, min (top, hist->max)) / 1.0e6;
+}
+
+/* Returns 1 once body holds the last chunk and trailer of a chunked message */
+static int
+chunked_done (const char *body, size_t len)
+{
+  const char *eol;
+  unsigned long size;
+  size_t pos = 0;
+
+  while ((eol = memmem (body + pos, len - pos, CRLF, 2)) != NULL) {
+    size = strtoul (body + pos, NULL, 16);
+    pos = eol - body + 2;
+    if (size == 0)
+      return memmem (body + pos - 2, len - pos + 2, CRLF CRLF, 4) != NULL;
+    if (len - pos < size + 2)
+      return 0;
+    pos += size + 2;
+  }
+  return 0;
+}
+
+/*
+ * Read one response for --samples and return its status code, or -1 if the
+ * connection broke before it was complete.  *reusable tells whether another
+ * request may follow on the same connection.
+ */
+static int
+read_sample_response (struct timeval sent, long *ttfb, char **status_line, int *reusable)
+{
+  char *response = NULL;
+  char *value;
+  http_head head;
+  size_t len = 0, header_len = 0;
+  long long content_length = -1;
+  int chunked = FALSE, complete = FALSE;
+  int status = -1;
+  int i;
+
+  *ttfb = -1;
+  *reusable = FALSE;
+  http_head_init (&head, TRUE);
+  while (!complete && (i = my_recv (buffer, MAX_INPUT_BUFFER-1)) > 0) {
+    if (*ttfb < 0)
+      *ttfb = deltime (sent);
+    response = realloc (response, len + i + 1);
+    if (response == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    memcpy (response + len, buffer, i);
+    len += i;
+    response[len] = '\0';
+
+    if (!header_len && http_head_feed (&head, response, len)) {
+      header_len = head.length;
+      free (*status_line);
+      *status_line = strndup (response, head.status_len);
+      value = strchr (*status_line, ' ');
+      status = value ? atoi (value + 1) : 0;
+
+      if ((value = http_head_value (&head, "content-length")) != NULL)
+        content_length = strtoll (value, NULL, 10);
+      free (value);
+      value = http_head_value (&head, "transfer-encoding");
+      chunked = value && strstr (value, "chunked");
+      free (value);
+      value = http_head_value (&head, "connection");
+      if (!strncmp (response, "HTTP/1.0", 8))
+        *reusable = value && !strcasecmp (value, "keep-alive");
+      else
+        *reusable = !value || strcasecmp (value, "close");
+      free (value);
+
+      if (!strcmp (http_method, "HEAD") || status < 200 || status == 204 || status == 304)
+        content_length = 0, chunked = FALSE;
+    }
+
+    if (header_len && chunked)
+      complete = chunked_done (response + header_len, len - header_len);
+    else if (header_len && content_length >= 0)
+      complete = (long long) (len - header_len) >= content_length;
+  }
+
+  /* without a length the body ends where the connection does */
+  if (!complete) {
+    *reusable = FALSE;
+    if (!header_len || chunked || content_length >= 0)
+      status = -1;
+  }
+
+  http_head_free (&head);
+  free (response);
+  return status;
+}
+
+/* Open the connection for --samples, returning its setup time in microseconds */
+static long
+open_sample_connection (void)
+{
+  struct timeval start;
+
+  gettimeofday (&start, NULL);
+  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+#ifdef HAVE_SSL
+  if (use_ssl == TRUE &&
+      np_net_ssl_init_with_hostname_version_and_cert (sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey) != STATE_OK)
+    die (STATE_CRITICAL, NULL);
+#endif
+  return deltime (start);
+}
+
+static void
+close_sample_connection (void)
+{
+#ifdef HAVE_SSL
+  if (use_ssl == TRUE)
+    np_net_ssl_cleanup ();
+#endif
+  close (sd);
+}
+
+/* --samples: time N requests, over one keep-alive connection unless told otherwise */
+int
+check_http_samples (void)
+{
+  latency_hist hist[SAMPLE_SERIES];
+  struct timeval start;
+  thresholds *sample_thlds;
+  char *request;
+  char *status_line = NULL;
+  char *failure = NULL;
+  char *msg;
+  char *perf = strdup ("");
+  char *label;
+  long ttfb;
+  double value, wait;
+  int connected = FALSE, reused, reusable = FALSE;
+  int failures = 0, connections = 0;
+  int result = STATE_OK;
+  int n, status, series, stat;
+
+  memset (hist, 0, sizeof (hist));
+  /* a kept-alive connection may have been closed by the server */
+  (void) signal (SIGPIPE, SIG_IGN);
+  request = build_request (!fresh_connections);
+  if (verbose)
+    printf ("%s\n", request);
+
+  for (n = 0; n < samples; n++) {
+    /* pace the requests from the start of the check */
+    wait = n * sample_interval - deltime (tv) / 1.0e6;
+    if (wait > 0)
+      usleep ((useconds_t) (wait * 1.0e6));
+
+    do {
+      gettimeofday (&start, NULL);
+      reused = connected;
+      if (!connected) {
+        hist_add (&hist[SAMPLE_CONNECT], open_sample_connection ());
+        connected = TRUE;
+        connections++;
+      }
+
+      my_send (request, strlen (request));
+      status = read_sample_response (start, &ttfb, &status_line, &reusable);
+
+      if (!reusable || fresh_connections) {
+        close_sample_connection ();
+        connected = FALSE;
+      }
+      /* the server may drop an idle kept-alive connection: retry on a new one */
+    } while (status < 0 && reused && ttfb < 0);
+
+    if (status < 0) {
+      xasprintf (&failure, _("Incomplete response received"));
+    } else if (!expected_statuscode (status_line, server_expect) || status >= 400) {
+      xasprintf (&failure, "%s", status_line);
+      status = -1;
+    } else {
+      hist_add (&hist[SAMPLE_TTFB], ttfb);
+      hist_add (&hist[SAMPLE_TIME], deltime (start));
+    }
+
+    if (status < 0)
+      failures++;
+    if (verbose)
+      printf (_("Sample %d: %s, %s, first byte after %.6fs, total %.6fs\n"), n + 1,
+              status < 0 ? failure : status_line, reused ? _("reused connection") : _("new connection"),
+              ttfb / 1.0e6, deltime (start) / 1.0e6);
+  }
+  if (connected)
+    close_sample_connection ();
+  alarm (0);
+
+  if (failures == samples)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - All %d requests failed (%s)\n"), samples, failure);
+
+  xasprintf (&msg, _("%d requests over %d connection(s)"), samples, connections);
+  if (failures) {
+    xasprintf (&msg, _("%s, %d failed (%s)"), msg, failures, failure);
+    result = STATE_CRITICAL;
+  }
+
+  for (series = 0; series < SAMPLE_SERIES; series++) {
+    if (hist[series].n == 0)
+      continue;
+    xasprintf (&msg, "%s, %s", msg, sample_series_name[series]);
+    for (stat = 0; stat < SAMPLE_STATS; stat++) {
+      value = hist_stat (&hist[series], stat);
+      xasprintf (&msg, "%s%s%.3f", msg, stat ? "/" : " ", value);
+      if (sample_warn[series][stat] || sample_crit[series][stat]) {
+        set_thresholds (&sample_thlds, sample_warn[series][stat], sample_crit[series][stat]);
+        result = max_state_alt (get_status (value, sample_thlds), result);
+      }
+      xasprintf (&label, "%s_%s", sample_series_name[series], sample_stat_name[stat]);
+      xasprintf (&perf, "%s%s%s", perf, *perf ? " " : "",
+                 sperfdata (label, value, "s", sample_warn[series][stat], sample_crit[series][stat], TRUE, 0, FALSE, 0));
+      free (label);
+    }
+  }
+
+  die (result, _("HTTP %s: %s (min/p50/p95/max seconds)|%s\n"), state_text (result), msg, perf);
+  /* die failed? */
+  return STATE_UNKNOWN;
+}
+
+
+#ifdef HAVE_NGHTTP2
+/* One URL of --http2, requested as a stream of the shared connection */
+typedef struct h2_stream {
+  const char *url;
+  int32_t id;
+  int status;
+  char *header;
+  char *body;
+  size_t body_len;
+  uint32_t error_code;
+  int closed;
+  struct timeval start;
+  long ttfb;
+  long total;
+} h2_stream;
+
+static int h2_open_streams = 0;
+
+static ssize_t
+h2_send (nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *user_data)
+{
+  int sent = np_net_ssl_write (data, length);
+  return sent > 0 ? sent : NGHTTP2_ERR_CALLBACK_FAILURE;
+}
+
+static int
+h2_begin_headers (nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
+{
+  h2_stream *stream = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+
+  if (stream != NULL && stream->ttfb < 0)
+    stream->ttfb = deltime (stream->start);
+  return 0;
+}
+
+static int
+h2_header (nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+           const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data)
+{
+  h2_stream *stream = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+
+  if (stream == NULL)
+    return 0;
+  /* nghttp2 hands out NUL terminated names and values */
+  if (!strcmp ((const char *) name, ":status"))
+    stream->status = atoi ((const char *) value);
+  else
+    xasprintf (&stream->header, "%s%s: %s\r\n", stream->header, name, value);
+  return 0;
+}
+
+static int
+h2_data (nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len, void *user_data)
+{
+  h2_stream *stream = nghttp2_session_get_stream_user_data (session, stream_id);
+  size_t i;
+
+  if (stream == NULL)
+    return 0;
+  if ((stream->body = realloc (stream->body, stream->body_len + len + 1)) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  /* replace nul characters with blanks as the HTTP/1 reader does */
+  for (i = 0; i < len; i++)
+    stream->body[stream->body_len++] = data[i] ? data[i] : ' ';
+  stream->body[stream->body_len] = '\0';
+  return 0;
+}
+
+static int
+h2_close (nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+  h2_stream *stream = nghttp2_session_get_stream_user_data (session, stream_id);
+
+  if (stream != NULL && !stream->closed) {
+    stream->closed = TRUE;
+    stream->error_code = error_code;
+    stream->total = deltime (stream->start);
+    h2_open_streams--;
+  }
+  return 0;
+}
+
+/* Append header name (lower cased, as HTTP/2 requires) and value to nva */
+static void
+h2_add_header (nghttp2_nv *nva, size_t *nvlen, const char *name, size_t namelen, const char *value)
+{
+  char *lname = strndup (name, namelen);
+  char *p;
+
+  for (p = lname; *p; p++)
+    *p = tolower (*p);
+  nva[*nvlen].name = (uint8_t *) lname;
+  nva[*nvlen].namelen = namelen;
+  nva[*nvlen].value = (uint8_t *) value;
+  nva[*nvlen].valuelen = strlen (value);
+  nva[*nvlen].flags = NGHTTP2_NV_FLAG_NONE;
+  (*nvlen)++;
+}
+
+/* --http2: request every -u URL as a concurrent stream over one TLS connection */
+int
+check_http2 (void)
+{
+  static const unsigned char alpn[] = "\x02h2\x08http/1.1";
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_session *session;
+  nghttp2_nv *nva;
+  h2_stream *streams;
+  http_head head;
+  const char *proto;
+  const char *authority_header = NULL;
+  char *authority, *auth, *value;
+  char *msg = strdup ("");
+  char *stream_msg;
+  char *perf = strdup ("");
+  char *label, *url_label, *p;
+  char *status_line;
+  long microsec, microsec_connect, microsec_ssl;
+  long total_size = 0;
+  size_t nvlen;
+  double elapsed_time;
+  int result = STATE_OK, stream_result;
+  int i, n, rv;
+  int one = 1;
+
+  gettimeofday (&tv_temp, NULL);
+  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+  microsec_connect = deltime (tv_temp);
+  /* nghttp2 writes frame by frame, which must not wait for delayed ACKs */
+  setsockopt (sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+  gettimeofday (&tv_temp, NULL);
+  np_net_ssl_set_alpn (alpn, sizeof (alpn) - 1);
+  if (np_net_ssl_init_with_hostname_version_and_cert (sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey) != STATE_OK)
+    die (STATE_CRITICAL, NULL);
+  microsec_ssl = deltime (tv_temp);
+
+  proto = np_net_ssl_get_alpn ();
+  if (verbose) {
+    printf (_("ALPN negotiated protocol: %s\n"), proto ? proto : _("none"));
+    printf (_("kTLS: %s\n"), np_net_ssl_get_ktls () ? np_net_ssl_get_ktls () : _("not active"));
+  }
+  if (proto == NULL || strcmp (proto, "h2"))
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Server did not negotiate HTTP/2 (ALPN: %s)\n"), proto ? proto : _("none"));
+
+  nghttp2_session_callbacks_new (&callbacks);
+  nghttp2_session_callbacks_set_send_callback (callbacks, h2_send);
+  nghttp2_session_callbacks_set_on_begin_headers_callback (callbacks, h2_begin_headers);
+  nghttp2_session_callbacks_set_on_header_callback (callbacks, h2_header);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback (callbacks, h2_data);
+  nghttp2_session_callbacks_set_on_stream_close_callback (callbacks, h2_close);
+  if (nghttp2_session_client_new (&session, callbacks, NULL) != 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot create HTTP/2 session\n"));
+  nghttp2_session_callbacks_del (callbacks);
+  nghttp2_submit_settings (session, NGHTTP2_FLAG_NONE, NULL, 0);
+
+  /* the request headers shared by all streams, :path is filled in per stream */
+  for (i = 0; i < http_opt_headers_count; i++)
+    if (!strncasecmp (http_opt_headers[i], "Host:", 5))
+      authority_header = http_opt_headers[i] + 5 + strspn (http_opt_headers[i] + 5, " \t");
+  if (authority_header)
+    authority = strdup (authority_header);
+  else if (host_name == NULL || virtual_port == HTTPS_PORT)
+    authority = strdup (host_name ? host_name : server_address);
+  else
+    xasprintf (&authority, "%s:%d", host_name, virtual_port);
+
+  if ((nva = calloc (http_opt_headers_count + 6, sizeof (nghttp2_nv))) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  nvlen = 0;
+  h2_add_header (nva, &nvlen, ":method", 7, http_method);
+  h2_add_header (nva, &nvlen, ":scheme", 7, "https");
+  h2_add_header (nva, &nvlen, ":authority", 10, authority);
+  h2_add_header (nva, &nvlen, ":path", 5, server_url);
+  h2_add_header (nva, &nvlen, "user-agent", 10, strchr (user_agent, ':') + 2);
+  if (strlen (user_auth)) {
+    base64_encode_alloc (user_auth, strlen (user_auth), &auth);
+    xasprintf (&auth, "Basic %s", auth);
+    h2_add_header (nva, &nvlen, "authorization", 13, auth);
+  }
+  for (i = 0; i < http_opt_headers_count; i++) {
+    if ((value = strchr (http_opt_headers[i], ':')) == NULL || !strncasecmp (http_opt_headers[i], "Host:", 5))
+      continue;
+    h2_add_header (nva, &nvlen, http_opt_headers[i], value - http_opt_headers[i], value + 1 + strspn (value + 1, " \t"));
+  }
+
+  if ((streams = calloc (url_count, sizeof (h2_stream))) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  for (n = 0; n < url_count; n++) {
+    streams[n].url = urls[n];
+    streams[n].header = strdup ("");
+    streams[n].ttfb = -1;
+    nva[3].value = (uint8_t *) urls[n];
+    nva[3].valuelen = strlen (urls[n]);
+    gettimeofday (&streams[n].start, NULL);
+    if ((streams[n].id = nghttp2_submit_request (session, NULL, nva, nvlen, NULL, &streams[n])) < 0)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot submit HTTP/2 request: %s\n"), nghttp2_strerror (streams[n].id));
+    h2_open_streams++;
+    if (verbose)
+      printf (_("Stream %d: %s %s\n"), streams[n].id, http_method, urls[n]);
+  }
+
+  while (h2_open_streams > 0 && (nghttp2_session_want_read (session) || nghttp2_session_want_write (session))) {
+    if ((rv = nghttp2_session_send (session)) != 0)
+      die (STATE_CRITICAL, _("HTTP CRITICAL - HTTP/2 send failed: %s\n"), nghttp2_strerror (rv));
+    if ((i = np_net_ssl_read (buffer, MAX_INPUT_BUFFER)) <= 0)
+      die (STATE_CRITICAL, _("HTTP CRITICAL - Connection closed with %d streams open\n"), h2_open_streams);
+    if ((rv = nghttp2_session_mem_recv (session, (const uint8_t *) buffer, i)) < 0)
+      die (STATE_CRITICAL, _("HTTP CRITICAL - HTTP/2 protocol error: %s\n"), nghttp2_strerror (rv));
+  }
+  nghttp2_session_terminate_session (session, NGHTTP2_NO_ERROR);
+  nghttp2_session_send (session);
+  nghttp2_session_del (session);
+  if (sd) close (sd);
+  np_net_ssl_cleanup ();
+
+  microsec = deltime (tv);
+  elapsed_time = (double) microsec / 1.0e6;
+  alarm (0);
+
+  /* evaluate each stream like a single HTTP/1 response */
+  for (n = 0; n < url_count; n++) {
+    h2_stream *stream = &streams[n];
+
+    if (verbose)
+      printf ("**** STREAM %d %s: %d ****\n%s\n", stream->id, stream->url, stream->status, stream->header);
+
+    stream_msg = strdup ("");
+    xasprintf (&status_line, "HTTP/2 %d", stream->status);
+    if (!stream->closed || stream->status == 0) {
+      xasprintf (&stream_msg, _("stream reset (%s), "), nghttp2_http2_strerror (stream->error_code));
+      stream_result = STATE_CRITICAL;
+    } else if (server_expect_yn && !expected_statuscode (status_line, server_expect)) {
+      xasprintf (&stream_msg, _("unexpected status, "));
+      stream_result = STATE_CRITICAL;
+    } else {
+      if (stream->status >= 500)
+        stream_result = STATE_CRITICAL;
+      else if (stream->status >= 400)
+        stream_result = STATE_WARNING;
+      else if (stream->status >= 300)
+        stream_result = onredirect;
+      else
+        stream_result = STATE_OK;
+
+      http_head_init (&head, FALSE);
+      http_head_finish (&head, stream->header, strlen (stream->header));
+      if (maximum_age >= 0)
+        stream_result = max_state_alt (check_document_dates (&head, NULL, &stream_msg), stream_result);
+      stream_result = max_state_alt (check_content (&head, stream->body ? stream->body : "",
+                                                    stream->url, stream->body_len, &stream_msg), stream_result);
+      http_head_free (&head);
+    }
+    result = max_state_alt (stream_result, result);
+    total_size += stream->body_len;
+
+    /* Cut-off trailing characters */
+    if (strlen (stream_msg) > 1)
+      stream_msg[strlen (stream_msg) - 2] = '\0';
+    xasprintf (&msg, "%s%s%s %d%s%s%s", msg, n ? ", " : "", stream->url, stream->status,
+               *stream_msg ? " (" : "", stream_msg, *stream_msg ? ")" : "");
+
+    /* keep the quoting done by perfdata () intact */
+    url_label = strdup (stream->url);
+    for (p = url_label; *p; p++)
+      if (*p == '\'' || *p == '=')
+        *p = '_';
+    xasprintf (&label, "time_%s", url_label);
+    xasprintf (&perf, "%s %s", perf, fperfdata (label, stream->total / 1.0e6, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    free (label);
+    xasprintf (&label, "time_firstbyte_%s", url_label);
+    xasprintf (&perf, "%s %s", perf, fperfdata (label, stream->ttfb < 0 ? 0 : stream->ttfb / 1.0e6, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    free (label);
+    xasprintf (&label, "size_%s", url_label);
+    xasprintf (&perf, "%s %s", perf, perfdata (label, stream->body_len, "B", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    free (label);
+    free (url_label);
+  }
+
+  result = max_state_alt (get_status (elapsed_time, thlds), result);
+
+  die (result, _("HTTP %s: HTTP/2 %d streams: %s - %ld bytes in %.3f second response time |%s %s %s %s%s\n"),
+       state_text (result), url_count, msg, total_size, elapsed_time,
+       perfd_time (elapsed_time), perfd_size (total_size),
+       perfd_time_connect ((double) microsec_connect / 1.0e6),
+       perfd_time_ssl ((double) microsec_ssl / 1.0e6), perf);
+  /* die failed? */
+  return STATE_UNKNOWN;
+}
+#endif /* HAVE_NGHTTP2 */
+
+
 /* per RFC 2396 */
 #define URI_HTTP "%5[HTPShtps]"
 #define URI_HOST "%255[-.abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789]"
@@ -1311,103 +2371,84 @@ check_http (void)
 #define HD5 URI_PATH
 
 void
-redir (char *pos, char *status_line)
+redir (const http_head *head, char *status_line)
 {
   int i = 0;
   char *x;
-  char xx[2];
   char type[6];
   char *addr;
   char *url;
+  char *pos;
 
   addr = malloc (MAX_IPV4_HOSTLENGTH + 1);
   if (addr == NULL)
     die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate addr\n"));
 
   memset(addr, 0, MAX_IPV4_HOSTLENGTH);
-  url = malloc (strcspn (pos, "\r\n"));
-  if (url == NULL)
-    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate URL\n"));
 
-  while (pos) {
-    sscanf (pos, "%1[Ll]%*1[Oo]%*1[Cc]%*1[Aa]%*1[Tt]%*1[Ii]%*1[Oo]%*1[Nn]:%n", xx, &i);
-    if (i == 0) {
-      pos += (size_t) strcspn (pos, "\r\n");
-      pos += (size_t) strspn (pos, "\r\n");
-      if (strlen(pos) == 0)
-        die (STATE_UNKNOWN,
-             _("HTTP UNKNOWN - Could not find redirect location - %s%s\n"),
-             status_line, (display_html ? "</A>" : ""));
-      continue;
-    }
-
-    pos += i;
-    pos += strspn (pos, " \t");
-
-    /*
-     * RFC 2616 (4.2):  ``Header fields can be extended over multiple lines by
-     * preceding each extra line with at least one SP or HT.''
-     */
-    for (; (i = strspn (pos, "\r\n")); pos += i) {
-      pos += i;
-      if (!(i = strspn (pos, " \t"))) {
-        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Empty redirect location%s\n"),
-             display_html ? "</A>" : "");
-      }
-    }
-
-    url = realloc (url, strcspn (pos, "\r\n") + 1);
-    if (url == NULL)
-      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate URL\n"));
+  /*
+   * RFC 2616 (4.2):  ``Header fields can be extended over multiple lines by
+   * preceding each extra line with at least one SP or HT.''  The header
+   * table already folded those into one line.
+   */
+  if ((pos = http_head_value (head, "location")) == NULL)
+    die (STATE_UNKNOWN,
+         _("HTTP UNKNOWN - Could not find redirect location - %s%s\n"),
+         status_line, (display_html ? "</A>" : ""));
+  if (*pos == '\0')
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Empty redirect location%s\n"),
+         display_html ? "</A>" : "");
 
-    /* URI_HTTP, URI_HOST, URI_PORT, URI_PATH */
-    if (sscanf (pos, HD1, type, addr, &i, url) == 4) {
-      url = prepend_slash (url);
-      use_ssl = server_type_check (type);
-    }
+  url = malloc (strlen (pos) + 1);
+  if (url == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate URL\n"));
 
-    /* URI_HTTP URI_HOST URI_PATH */
-    else if (sscanf (pos, HD2, type, addr, url) == 3 ) {
-      url = prepend_slash (url);
-      use_ssl = server_type_check (type);
-      i = server_port_check (use_ssl);
-    }
+  /* URI_HTTP, URI_HOST, URI_PORT, URI_PATH */
+  if (sscanf (pos, HD1, type, addr, &i, url) == 4) {
+    url = prepend_slash (url);
+    use_ssl = server_type_check (type);
+  }
 
-    /* URI_HTTP URI_HOST URI_PORT */
-    else if (sscanf (pos, HD3, type, addr, &i) == 3) {
-      strcpy (url, HTTP_URL);
-      use_ssl = server_type_check (type);
-    }
+  /* URI_HTTP URI_HOST URI_PATH */
+  else if (sscanf (pos, HD2, type, addr, url) == 3 ) {
+    url = prepend_slash (url);
+    use_ssl = server_type_check (type);
+    i = server_port_check (use_ssl);
+  }
 
-    /* URI_HTTP URI_HOST */
-    else if (sscanf (pos, HD4, type, addr) == 2) {
-      strcpy (url, HTTP_URL);
-      use_ssl = server_type_check (type);
-      i = server_port_check (use_ssl);
-    }
+  /* URI_HTTP URI_HOST URI_PORT */
+  else if (sscanf (pos, HD3, type, addr, &i) == 3) {
+    strcpy (url, HTTP_URL);
+    use_ssl = server_type_check (type);
+  }
 
-    /* URI_PATH */
-    else if (sscanf (pos, HD5, url) == 1) {
-      /* relative url */
-      if ((url[0] != '/')) {
-        if ((x = strrchr(server_url, '/')))
-          *x = '\0';
-        xasprintf (&url, "%s/%s", server_url, url);
-      }
-      i = server_port;
-      strcpy (type, server_type);
-      strcpy (addr, host_name ? host_name : server_address);
-    }
+  /* URI_HTTP URI_HOST */
+  else if (sscanf (pos, HD4, type, addr) == 2) {
+    strcpy (url, HTTP_URL);
+    use_ssl = server_type_check (type);
+    i = server_port_check (use_ssl);
+  }
 
-    else {
-      die (STATE_UNKNOWN,
-           _("HTTP UNKNOWN - Could not parse redirect location - %s%s\n"),
-           pos, (display_html ? "</A>" : ""));
+  /* URI_PATH */
+  else if (sscanf (pos, HD5, url) == 1) {
+    /* relative url */
+    if ((url[0] != '/')) {
+      if ((x = strrchr(server_url, '/')))
+        *x = '\0';
+      xasprintf (&url, "%s/%s", server_url, url);
     }
+    i = server_port;
+    strcpy (type, server_type);
+    strcpy (addr, host_name ? host_name : server_address);
+  }
 
-    break;
+  else {
+    die (STATE_UNKNOWN,
+         _("HTTP UNKNOWN - Could not parse redirect location - %s%s\n"),
+         pos, (display_html ? "</A>" : ""));
+  }
 
-  } /* end while (pos) */
+  free (pos);
 
   if (++redir_depth > max_depth)
     die (STATE_WARNING,
@@ -1557,6 +2598,9 @@ print_help (void)
   printf ("    %s\n", _("1.2 = TLSv1.2). With a '+' suffix, newer versions are also accepted."));
   printf (" %s\n", "--sni");
   printf ("    %s\n", _("Enable SSL/TLS hostname extension support (SNI)"));
+  printf (" %s\n", "--ktls");
+  printf ("    %s\n", _("Let the kernel decrypt the connection after the handshake (kTLS) when the"));
+  printf ("    %s\n", _("tls module is loaded. Saves CPU on large downloads."));
   printf (" %s\n", "-C, --certificate=INTEGER[,INTEGER]");
   printf ("    %s\n", _("Minimum number of days a certificate has to be valid. Port defaults to 443"));
   printf ("    %s\n", _("(when this option is used the URL is not checked.)"));
@@ -1589,6 +2633,32 @@ print_help (void)
   printf (" %s\n", "-M, --max-age=SECONDS");
   printf ("    %s\n", _("Warn if document is more than SECONDS old. the number can also be of"));
   printf ("    %s\n", _("the form \"10m\" for minutes, \"10h\" for hours, or \"10d\" for days."));
+  printf (" %s\n", "--conditional");
+  printf ("    %s\n", _("Remember ETag, Last-Modified and the content check result between runs and"));
+  printf ("    %s\n", _("revalidate with If-None-Match/If-Modified-Since. On 304 Not Modified the"));
+  printf ("    %s\n", _("stored result of -d, -s, -r and -m is reused without transferring the body,"));
+  printf ("    %s\n", _("while the status, times and -M are checked on the reply (GET/HEAD only)."));
+  printf (" %s\n", "--range=FIRST-LAST|-LENGTH");
+  printf ("    %s\n", _("Only fetch the given bytes of the document, or its last LENGTH bytes, and"));
+  printf ("    %s\n", _("expect 206 Partial Content with a matching Content-Range. -s and -r search"));
+  printf ("    %s\n", _("the partial body, -m checks the full size announced in Content-Range."));
+  printf ("    %s\n", _("Open ended ranges (FIRST-) would fetch the rest and are not accepted."));
+  printf (" %s\n", "--samples=N[,INTERVAL]");
+  printf ("    %s\n", _("Send N requests, one every INTERVAL seconds, over a keep-alive connection"));
+  printf ("    %s\n", _("and report min/p50/p95/max of the connect (including TLS handshake), first"));
+  printf ("    %s\n", _("byte and total times. -w and -c apply to the median total time (time_p50)."));
+  printf ("    %s\n", _("Content, redirect and certificate checks are not available in this mode."));
+  printf (" %s\n", "--fresh-connections");
+  printf ("    %s\n", _("Open a new connection for every sample"));
+  printf (" %s\n", "--sample-threshold=METRIC,WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds for a --samples metric, which is one of connect, ttfb or time"));
+  printf ("    %s\n", _("followed by _min, _p50, _p95 or _max, e.g. ttfb_p95,0.2,0.5. May be repeated."));
+#ifdef HAVE_NGHTTP2
+  printf (" %s\n", "--http2");
+  printf ("    %s\n", _("Use HTTP/2 over TLS, negotiated by ALPN. Every -u URL is requested as a"));
+  printf ("    %s\n", _("concurrent stream on one connection and checked on its own. Implies --ssl."));
+  printf ("    %s\n", _("Certificate checks (-C) need a run of their own without it."));
+#endif
   printf (" %s\n", "-T, --content-type=STRING");
   printf ("    %s\n", _("specify Content-Type header media type when POSTing\n"));
 
@@ -1688,6 +2758,8 @@ print_usage (void)
   printf ("       [-b proxy_auth] [-f <ok|warning|critcal|follow|sticky|stickyport>]\n");
   printf ("       [-e <expect>] [-d string] [-s string] [-l] [-r <regex> | -R <case-insensitive regex>]\n");
   printf ("       [-P string] [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>]\n");
-  printf ("       [-A string] [-k string] [-S <version>] [--sni] [-C <warn_age>[,<crit_age>]]\n");
-  printf ("       [-T <content-type>] [-j method]\n");
+  printf ("       [-A string] [-k string] [-S <version>] [--sni] [--ktls] [-C <warn_age>[,<crit_age>]]\n");
+  printf ("       [-T <content-type>] [-j method] [--conditional]\n");
+  printf ("       [--range <bytes>] [--samples <n>[,<interval>] [--fresh-connections]\n");
+  printf ("       [--sample-threshold <metric>,<warn>[,<crit>]]] [--http2]\n");
 }
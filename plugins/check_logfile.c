@@ -0,0 +1,642 @@
+/*****************************************************************************
+*
+* Monitoring check_logfile plugin
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_logfile plugin
+*
+* Counts the lines appended to a log file since the previous run that
+* contain any of a set of fixed strings. Only the new part of the file is
+* read: the device, inode and offset reached are kept in the plugin state
+* store, so the cost of a check follows the log volume written in between
+* rather than the size of the file.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_logfile";
+const char *copyright = "2026";
+const char *email = "devel@monitoring-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define STATE_VERSION 1
+#define READ_CHUNK 65536
+#define LAST_LINE_MAX 256
+/* bytes in front of the saved offset, compared to spot a truncated and regrown log */
+#define FINGERPRINT_MAX 16
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+
+char *log_file = NULL;
+char **patterns = NULL;
+int pattern_count = 0;
+int ignore_case = FALSE;
+int verbose = 0;
+char *warning_range = NULL;
+char *critical_range = NULL;
+thresholds *thlds = NULL;
+
+/* Aho-Corasick automaton over all patterns, compiled into a full DFA whose
+ * alphabet is reduced to the bytes that occur in some pattern (class 0 is
+ * every other byte) */
+unsigned char byte_class[256];
+int class_count = 1;
+int *delta = NULL;
+int *node_output = NULL;
+int *node_next_output = NULL;
+
+/* Scan state shared by the current and the rotated file */
+unsigned long line_total = 0;
+unsigned long matched_total = 0;
+unsigned long *pattern_hits = NULL;
+unsigned long *seen_in_line = NULL;
+int *line_hits = NULL;
+int line_hit_count = 0;
+long long bytes_total = 0;
+int last_fd = -1;
+off_t last_start = 0;
+size_t last_length = 0;
+
+typedef struct log_position_struct {
+	unsigned long dev;
+	unsigned long ino;
+	long long offset;
+	unsigned char fingerprint[FINGERPRINT_MAX];
+	int fingerprint_length;
+	} log_position;
+
+static void build_automaton (void);
+static off_t scan_range (int, off_t, off_t, int);
+static void read_fingerprint (int, log_position *);
+static int read_position (log_position *);
+static void write_position (const log_position *);
+static off_t last_line_start (int, off_t);
+static char *state_key_name (void);
+
+
+int
+main (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
+	int fd, rotated_fd = -1;
+	int rotated = FALSE, truncated = FALSE;
+	struct stat st, rotated_st;
+	log_position previous, current;
+	off_t start;
+	char *rotated_file, *last_line = NULL, *perf, *label, *p;
+	ssize_t n;
+	int i;
+
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+
+	np_init ((char *) progname, argc, argv);
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* Set signal handling and alarm timeout */
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR) {
+		die (STATE_UNKNOWN, _("Cannot catch SIGALRM"));
+	}
+	(void) alarm ((unsigned) timeout_interval);
+
+	build_automaton ();
+	np_enable_state (state_key_name (), STATE_VERSION);
+
+	if ((fd = open (log_file, O_RDONLY)) < 0)
+		die (STATE_UNKNOWN, _("LOG UNKNOWN - Cannot open %s: %s\n"), log_file, strerror (errno));
+	if (fstat (fd, &st) != 0)
+		die (STATE_UNKNOWN, _("LOG UNKNOWN - Cannot stat %s: %s\n"), log_file, strerror (errno));
+
+	current.dev = (unsigned long) st.st_dev;
+	current.ino = (unsigned long) st.st_ino;
+
+	if (!read_position (&previous)) {
+		/* First run: start watching from the last complete line */
+		current.offset = last_line_start (fd, st.st_size);
+		read_fingerprint (fd, &current);
+		write_position (&current);
+		printf (_("LOG OK - Log check data initialized at offset %lld\n"), current.offset);
+		return STATE_OK;
+	}
+
+	start = (off_t) previous.offset;
+	if (previous.dev != current.dev || previous.ino != current.ino) {
+		/* Finish the rotated log first if it is still next to the new one */
+		rotated = TRUE;
+		start = 0;
+		xasprintf (&rotated_file, "%s.1", log_file);
+		if ((rotated_fd = open (rotated_file, O_RDONLY)) >= 0
+		    && fstat (rotated_fd, &rotated_st) == 0
+		    && (unsigned long) rotated_st.st_dev == previous.dev
+		    && (unsigned long) rotated_st.st_ino == previous.ino) {
+			if (verbose)
+				printf (_("Reading %s from offset %lld\n"), rotated_file, previous.offset);
+			if (rotated_st.st_size > (off_t) previous.offset)
+				scan_range (rotated_fd, (off_t) previous.offset, rotated_st.st_size, TRUE);
+		} else if (verbose) {
+			printf (_("Rotated log %s not found, lines written to it since the last check are skipped\n"),
+			        rotated_file);
+		}
+	} else {
+		current.offset = previous.offset;
+		read_fingerprint (fd, &current);
+		if (st.st_size < (off_t) previous.offset
+		    || current.fingerprint_length != previous.fingerprint_length
+		    || memcmp (current.fingerprint, previous.fingerprint, previous.fingerprint_length)) {
+			truncated = TRUE;
+			start = 0;
+		}
+	}
+
+	if (verbose)
+		printf (_("Reading %s from offset %lld to %lld\n"), log_file,
+		        (long long) start, (long long) st.st_size);
+
+	current.offset = (long long) scan_range (fd, start, st.st_size, FALSE);
+	read_fingerprint (fd, &current);
+	write_position (&current);
+
+	if (last_fd >= 0) {
+		last_line = malloc (LAST_LINE_MAX + 1);
+		if (last_line == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+		n = pread (last_fd, last_line, min (last_length, LAST_LINE_MAX), last_start);
+		last_line[n > 0 ? n : 0] = '\0';
+		for (p = last_line; *p; p++)
+			if (iscntrl ((unsigned char) *p) || *p == '|')
+				*p = ' ';
+	}
+
+	if (rotated_fd >= 0)
+		close (rotated_fd);
+	close (fd);
+
+	result = get_status ((double) matched_total, thlds);
+
+	perf = sperfdata_int ("matches", (int) matched_total, "", warning_range,
+	                      critical_range, TRUE, 0, FALSE, 0);
+	for (i = 0; i < pattern_count; i++) {
+		/* keep the quoting done by perfdata () intact */
+		label = strdup (patterns[i]);
+		for (p = label; *p; p++)
+			if (*p == '\'' || *p == '=')
+				*p = '_';
+		xasprintf (&perf, "%s %s", perf,
+		           perfdata (label, (long) pattern_hits[i], "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		free (label);
+	}
+	xasprintf (&perf, "%s %s %s", perf,
+	           perfdata ("lines", (long) line_total, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+	           perfdata ("bytes", (long) bytes_total, "B", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+
+	printf (_("LOG %s - %lu of %lu new lines matched%s%s"), state_text (result),
+	        matched_total, line_total,
+	        rotated ? _(" (log rotated)") : "", truncated ? _(" (log truncated)") : "");
+	if (last_line)
+		printf (_(", last: %s"), last_line);
+	printf ("|%s\n", perf);
+
+	return result;
+}
+
+
+/* Compile the patterns into the DFA used by scan_range () */
+static void
+build_automaton (void)
+{
+	int i, k, c, node, next, node_count = 1, max_nodes = 1;
+	int head = 0, tail = 0, *fail, *queue;
+	const unsigned char *s;
+
+	for (i = 0; i < pattern_count; i++) {
+		for (s = (unsigned char *) patterns[i]; *s; s++) {
+			c = ignore_case ? tolower (*s) : *s;
+			if (byte_class[c] == 0) {
+				byte_class[c] = class_count++;
+				if (ignore_case)
+					byte_class[toupper (c)] = byte_class[c];
+			}
+		}
+		max_nodes += strlen (patterns[i]);
+	}
+
+	delta = malloc (sizeof (int) * max_nodes * class_count);
+	node_output = malloc (sizeof (int) * max_nodes);
+	node_next_output = malloc (sizeof (int) * max_nodes);
+	fail = malloc (sizeof (int) * max_nodes);
+	queue = malloc (sizeof (int) * max_nodes);
+	if (!delta || !node_output || !node_next_output || !fail || !queue)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+
+	for (i = 0; i < max_nodes * class_count; i++)
+		delta[i] = -1;
+	for (i = 0; i < max_nodes; i++)
+		node_output[i] = node_next_output[i] = -1;
+
+	/* trie */
+	for (i = 0; i < pattern_count; i++) {
+		node = 0;
+		for (s = (unsigned char *) patterns[i]; *s; s++) {
+			k = byte_class[*s];
+			if (delta[node * class_count + k] < 0)
+				delta[node * class_count + k] = node_count++;
+			node = delta[node * class_count + k];
+		}
+		if (node_output[node] >= 0)
+			usage2 (_("Duplicate pattern"), patterns[i]);
+		node_output[node] = i;
+	}
+
+	/* failure links, breadth first, folded into the transition table */
+	for (k = 0; k < class_count; k++) {
+		next = delta[k];
+		if (next < 0) {
+			delta[k] = 0;
+		} else {
+			fail[next] = 0;
+			queue[tail++] = next;
+		}
+	}
+	while (head < tail) {
+		node = queue[head++];
+		for (k = 0; k < class_count; k++) {
+			next = delta[node * class_count + k];
+			if (next < 0) {
+				delta[node * class_count + k] = delta[fail[node] * class_count + k];
+				continue;
+			}
+			fail[next] = delta[fail[node] * class_count + k];
+			node_next_output[next] = node_output[fail[next]] >= 0 ?
+				fail[next] : node_next_output[fail[next]];
+			queue[tail++] = next;
+		}
+	}
+
+	if (verbose >= 2)
+		printf (_("Automaton: %d patterns, %d states, %d byte classes\n"),
+		        pattern_count, node_count, class_count);
+
+	pattern_hits = calloc (pattern_count, sizeof (unsigned long));
+	seen_in_line = calloc (pattern_count, sizeof (unsigned long));
+	line_hits = calloc (pattern_count, sizeof (int));
+	if (!pattern_hits || !seen_in_line || !line_hits)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+
+	free (fail);
+	free (queue);
+}
+
+
+/*
+ * Match the bytes [from, to) of fd line by line. Returns the offset of the
+ * first byte not belonging to a complete line, which is where the next run
+ * has to continue. With final set, a trailing line without a newline is
+ * counted as well (the rotated file will not grow any more).
+ */
+static off_t
+scan_range (int fd, off_t from, off_t to, int final)
+{
+	unsigned char *buf;
+	off_t pos = from, line_start = from;
+	ssize_t n, j;
+	int i, node = 0, out;
+	/* line numbers start at 1, seen_in_line[] starts out as 0 */
+	unsigned long line_id = line_total + 1;
+
+	if ((buf = malloc (READ_CHUNK)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+
+	line_hit_count = 0;
+	while (pos < to) {
+		n = pread (fd, buf, min (to - pos, READ_CHUNK), pos);
+		if (n < 0)
+			die (STATE_UNKNOWN, _("LOG UNKNOWN - Cannot read %s: %s\n"), log_file, strerror (errno));
+		if (n == 0)
+			break;
+		for (j = 0; j < n; j++) {
+			if (buf[j] == '\n') {
+				line_total++;
+				if (line_hit_count) {
+					matched_total++;
+					for (i = 0; i < line_hit_count; i++)
+						pattern_hits[line_hits[i]]++;
+					last_fd = fd;
+					last_start = line_start;
+					last_length = pos + j - line_start;
+				}
+				line_id++;
+				line_hit_count = 0;
+				line_start = pos + j + 1;
+				node = 0;
+				continue;
+			}
+			node = delta[node * class_count + byte_class[buf[j]]];
+			out = node_output[node] >= 0 ? node : node_next_output[node];
+			for (; out >= 0; out = node_next_output[out]) {
+				i = node_output[out];
+				if (seen_in_line[i] != line_id) {
+					seen_in_line[i] = line_id;
+					line_hits[line_hit_count++] = i;
+				}
+			}
+		}
+		pos += n;
+		bytes_total += n;
+	}
+	free (buf);
+
+	if (final && line_start < pos) {
+		line_total++;
+		if (line_hit_count) {
+			matched_total++;
+			for (i = 0; i < line_hit_count; i++)
+				pattern_hits[line_hits[i]]++;
+			last_fd = fd;
+			last_start = line_start;
+			last_length = pos - line_start;
+		}
+		line_start = pos;
+	}
+	line_hit_count = 0;
+
+	return line_start;
+}
+
+
+/* Remember the bytes just in front of the offset to recognise the file later */
+static void
+read_fingerprint (int fd, log_position *position)
+{
+	off_t length = min (position->offset, FINGERPRINT_MAX);
+	ssize_t n;
+
+	n = pread (fd, position->fingerprint, length, position->offset - length);
+	position->fingerprint_length = n > 0 ? n : 0;
+}
+
+
+/* Offset just past the last newline, so a line still being written is read whole next time */
+static off_t
+last_line_start (int fd, off_t size)
+{
+	unsigned char *buf;
+	off_t from = size > READ_CHUNK ? size - READ_CHUNK : 0;
+	ssize_t n;
+
+	if ((buf = malloc (READ_CHUNK)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	n = pread (fd, buf, size - from, from);
+	if (n < 0) {
+		free (buf);
+		return size;
+	}
+	while (n > 0 && buf[n - 1] != '\n')
+		n--;
+	free (buf);
+
+	/* a single line longer than the window is taken as read */
+	return n > 0 || from == 0 ? from + n : size;
+}
+
+
+/*
+ * Key the position on what is watched rather than on the whole command line,
+ * so changing thresholds or -v does not throw the position away
+ */
+static char *
+state_key_name (void)
+{
+	struct sha1_ctx ctx;
+	unsigned char digest[20];
+	char *key;
+	int i;
+
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (log_file, strlen (log_file) + 1, &ctx);
+	sha1_process_bytes (ignore_case ? "i" : "", ignore_case ? 2 : 1, &ctx);
+	for (i = 0; i < pattern_count; i++)
+		sha1_process_bytes (patterns[i], strlen (patterns[i]) + 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+
+	if ((key = malloc (2 * sizeof (digest) + 1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	for (i = 0; i < (int) sizeof (digest); i++)
+		sprintf (key + 2 * i, "%02x", digest[i]);
+	return key;
+}
+
+
+/* dev <SP> inode <SP> offset <SP> hex fingerprint */
+static int
+read_position (log_position *position)
+{
+	state_data *previous_state;
+	char hex[2 * FINGERPRINT_MAX + 2];
+	unsigned int byte;
+	int i, fields;
+
+	previous_state = np_state_read ();
+	if (previous_state == NULL)
+		return FALSE;
+
+	hex[0] = '\0';
+	fields = sscanf ((char *) previous_state->data, "%lu %lu %lld %33s",
+	                 &position->dev, &position->ino, &position->offset, hex);
+	if (fields < 3 || position->offset < 0 || strlen (hex) > 2 * FINGERPRINT_MAX)
+		return FALSE;
+
+	position->fingerprint_length = strlen (hex) / 2;
+	for (i = 0; i < position->fingerprint_length; i++) {
+		if (sscanf (hex + 2 * i, "%2x", &byte) != 1)
+			return FALSE;
+		position->fingerprint[i] = byte;
+	}
+
+	if (verbose)
+		printf (_("Stored position: device %lu, inode %lu, offset %lld\n"),
+		        position->dev, position->ino, position->offset);
+	return TRUE;
+}
+
+
+static void
+write_position (const log_position *position)
+{
+	char *data;
+	int i;
+
+	xasprintf (&data, "%lu %lu %lld ", position->dev, position->ino, position->offset);
+	for (i = 0; i < position->fingerprint_length; i++)
+		xasprintf (&data, "%s%02x", data, position->fingerprint[i]);
+	np_state_write_string (0, data);
+	free (data);
+}
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	int option = 0;
+	static struct option longopts[] = {
+		{"filename", required_argument, 0, 'F'},
+		{"pattern", required_argument, 0, 'e'},
+		{"ignore-case", no_argument, 0, 'i'},
+		{"critical", required_argument, 0, 'c'},
+		{"warning", required_argument, 0, 'w'},
+		{"timeout", required_argument, 0, 't'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		usage ("\n");
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvF:e:ic:w:t:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':									/* print short usage statement if args not parsable */
+			usage5 ();
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_UNKNOWN);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_UNKNOWN);
+		case 'v':									/* verbose */
+			verbose++;
+			break;
+		case 'F':									/* log file */
+			log_file = optarg;
+			break;
+		case 'e':									/* pattern */
+			if (*optarg == '\0')
+				usage4 (_("Patterns must not be empty"));
+			patterns = realloc (patterns, sizeof (char *) * (pattern_count + 1));
+			if (patterns == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+			patterns[pattern_count++] = optarg;
+			break;
+		case 'i':									/* ignore case */
+			ignore_case = TRUE;
+			break;
+		case 't':									/* timeout period */
+			if (!is_integer (optarg))
+				usage2 (_("Timeout interval must be a positive integer"), optarg);
+			else
+				timeout_interval = atoi (optarg);
+			break;
+		case 'c':									/* critical */
+			critical_range = optarg;
+			break;
+		case 'w':									/* warning */
+			warning_range = optarg;
+			break;
+		}
+	}
+
+	if (log_file == NULL)
+		usage4 (_("You must specify a log file"));
+	if (pattern_count == 0)
+		usage4 (_("You must specify at least one pattern"));
+
+	/* like check_log, any match is critical unless told otherwise */
+	if (warning_range == NULL && critical_range == NULL)
+		critical_range = "0";
+
+	/* this will abort in case of invalid ranges */
+	set_thresholds (&thlds, warning_range, critical_range);
+
+	return OK;
+}
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("This plugin counts the lines written to a log file since its last run that"));
+	printf ("%s\n", _("contain any of the given patterns. Only the new part of the file is read;"));
+	printf ("%s\n", _("the position reached is kept in the plugin state directory."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-F, --filename=FILE");
+	printf ("    %s\n", _("Log file to watch"));
+	printf (" %s\n", "-e, --pattern=STRING");
+	printf ("    %s\n", _("Fixed string to look for, may be given several times. All patterns are"));
+	printf ("    %s\n", _("matched in a single pass and counted separately in the performance data"));
+	printf (" %s\n", "-i, --ignore-case");
+	printf ("    %s\n", _("Match patterns regardless of (ASCII) case"));
+	printf (" %s\n", "-w, --warning=RANGE");
+	printf ("    %s\n", _("Warning range for the number of matching lines"));
+	printf (" %s\n", "-c, --critical=RANGE");
+	printf ("    %s\n", _("Critical range for the number of matching lines (default: 0, i.e. any"));
+	printf ("    %s\n", _("match is critical, unless -w is given)"));
+	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("The first run only records the end of the file and returns OK."));
+	printf (" %s\n", _("A changed inode is taken as a rotation: the rest of FILE.1 is read if it is"));
+	printf (" %s\n", _("the old log, then the new file from its start. A shrunk or rewritten file"));
+	printf (" %s\n", _("(copytruncate) is read again from its start."));
+	printf (" %s\n", _("The position is kept per file, pattern list and -i setting."));
+
+	printf (UT_SUPPORT);
+}
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s -F <file> -e <pattern> [-e <pattern> ...] [-i] [-w <range>] [-c <range>]\n", progname);
+	printf ("    [-t <timeout>] [-v]\n");
+}
@@ -43,6 +43,7 @@ const char *email = "devel@monitoring-plugins.org";
 
 #include <pwd.h>
 #include <errno.h>
+#include <dirent.h>
 
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
@@ -51,6 +52,13 @@ const char *email = "devel@monitoring-plugins.org";
 int process_arguments (int, char **);
 int validate_arguments (void);
 int convert_to_seconds (char *); 
+char *cgroup_resolve (const char *);
+char *cgroup_find (const char *, const char *, int);
+void cgroup_add_pids (const char *);
+int proc_read (pid_t, char *, int *, pid_t *, int *, int *, float *, char *, char *, char *, int *);
+int proc_threads (pid_t);
+void tree_add (pid_t, pid_t, int, int, float, int, const char *, int);
+int tree_build (void);
 void print_help (void);
 void print_usage (void);
 
@@ -74,6 +82,9 @@ int options = 0; /* bitmask of filter criteria to test against */
 #define KTHREAD_PARENT "kthreadd" /* the parent process of kernel threads:
 							ppid of procs are compared to pid of this proc*/
 
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_FIND_DEPTH 8 /* how deep --unit looks for the unit's cgroup */
+
 /* Different metrics */
 char *metric_name;
 enum metric {
@@ -81,7 +92,8 @@ enum metric {
 	METRIC_VSZ,
 	METRIC_RSS,
 	METRIC_CPU,
-	METRIC_ELAPSED
+	METRIC_ELAPSED,
+	METRIC_THREADS
 };
 enum metric metric = METRIC_PROCS;
 
@@ -101,6 +113,33 @@ char *fails;
 char tmp[MAX_INPUT_BUFFER];
 int kthread_filter = 0;
 int usepid = 0; /* whether to test for pid or /proc/pid/exe */
+char *cgroup_name = NULL; /* --cgroup or --unit as given */
+char *cgroup_path = NULL; /* its directory under CGROUP_ROOT */
+int cgroup_is_unit = 0;
+int cgroup_recursive = 0;
+pid_t *cgroup_pids = NULL; /* processes to look at instead of the ps output */
+int cgroup_pid_count = 0;
+int cgroup_pid_size = 0;
+
+/* --tree: every process is kept, to add up the subtree of each matched one */
+typedef struct tree_proc {
+	pid_t pid;
+	pid_t ppid;
+	int matched;
+	int threads;      /* -1 until known */
+	char *prog;
+	int first_child;  /* indexes into tree_procs, -1 for none */
+	int next_sibling;
+	int root;         /* matched process whose subtree this one is in, or -1 */
+	/* own values, then the totals of the subtree on its root */
+	long long vsz, rss, procs, nthreads;
+	double pcpu;
+} tree_proc;
+
+int tree_mode = 0;
+tree_proc *tree_procs = NULL;
+int tree_count = 0;
+int tree_size = 0;
 
 FILE *ps_input = NULL;
 
@@ -138,6 +177,13 @@ main (int argc, char **argv)
 	char procstat[8];
 	char procetime[MAX_INPUT_BUFFER] = { '\0' };
 	char *procargs;
+	char procline[MAX_INPUT_BUFFER];
+	int procthreads = -1;
+	int lines = 0;
+	int trees = 0; /* matched processes heading a subtree in --tree mode */
+	tree_proc *tp;
+	char *label;
+	double value = 0;
 
 	const char *zombie = "Z";
 
@@ -192,27 +238,45 @@ main (int argc, char **argv)
 	if (verbose >= 2)
 		printf (_("CMD: %s\n"), PS_COMMAND);
 
-	if (input_filename == NULL) {
+	if (cgroup_path) {
+		/* only the members of the cgroup, straight from /proc */
+		cgroup_add_pids (cgroup_path);
+		lines = cgroup_pid_count + 1;
+		if (verbose >= 2)
+			printf (_("%d processes in %s\n"), cgroup_pid_count, cgroup_path);
+	} else if (input_filename == NULL) {
 		result = cmd_run( PS_COMMAND, &chld_out, &chld_err, 0);
 		if (chld_err.lines > 0) {
 			printf ("%s: %s", _("System call sent warnings to stderr"), chld_err.line[0]);
 			exit(STATE_WARNING);
 		}
+		lines = chld_out.lines;
 	} else {
 		result = cmd_file_read( input_filename, &chld_out, 0);
+		lines = chld_out.lines;
 	}
 
 	/* flush first line: j starts at 1 */
-	for (j = 1; j < chld_out.lines; j++) {
-		input_line = chld_out.line[j];
-
-		if (verbose >= 3)
-			printf ("%s", input_line);
-
+	for (j = 1; j < lines; j++) {
 		strcpy (procprog, "");
 		xasprintf (&procargs, "%s", "");
 
-		cols = sscanf (input_line, PS_FORMAT, PS_VARLIST);
+		if (cgroup_path) {
+			procpid = cgroup_pids[j - 1];
+			/* gone since cgroup.procs was read */
+			if (proc_read (procpid, procstat, &procuid, &procppid, &procvsz, &procrss,
+			               &procpcpu, procetime, procprog, procline, &procthreads) == ERROR)
+				continue;
+			input_line = procline;
+			pos = 0;
+			cols = expected_cols;
+		} else {
+			input_line = chld_out.line[j];
+			cols = sscanf (input_line, PS_FORMAT, PS_VARLIST);
+		}
+
+		if (verbose >= 3)
+			printf ("%s", input_line);
 
 		/* Zombie processes do not give a procprog command */
 		if ( cols < expected_cols && strstr(procstat, zombie) ) {
@@ -286,6 +350,10 @@ main (int argc, char **argv)
 
 			found++;
 
+			if (tree_mode)
+				tree_add (procpid, procppid, procvsz, procrss, procpcpu, procthreads, procprog,
+				          options == resultsum || options == ALL);
+
 			/* Next line if filters not matched */
 			if (!(options == resultsum || options == ALL))
 				continue;
@@ -298,6 +366,10 @@ main (int argc, char **argv)
 					procetime, procprog, procargs);
 			}
 
+			/* thresholds apply to the subtrees, once they are all known */
+			if (tree_mode)
+				continue;
+
 			if (metric == METRIC_VSZ)
 				i = get_status ((double)procvsz, procs_thresholds);
 			else if (metric == METRIC_RSS)
@@ -327,16 +399,47 @@ main (int argc, char **argv)
 		}
 	}
 
-	if (found == 0) {							/* no process lines parsed so return STATE_UNKNOWN */
+	if (found == 0 && !cgroup_path) {			/* no process lines parsed so return STATE_UNKNOWN */
 		printf (_("Unable to read output\n"));
 		return STATE_UNKNOWN;
 	}
 
+	if (tree_mode) {
+		trees = tree_build ();
+		for (i = 0; i < tree_count; i++) {
+			tp = &tree_procs[i];
+			if (tp->root != i)
+				continue;
+			if (metric == METRIC_PROCS)
+				value = tp->procs;
+			else if (metric == METRIC_VSZ)
+				value = tp->vsz;
+			else if (metric == METRIC_RSS)
+				value = tp->rss;
+			else if (metric == METRIC_CPU)
+				value = tp->pcpu;
+			else if (metric == METRIC_THREADS)
+				value = tp->nthreads;
+			if (verbose >= 2)
+				printf ("Tree: pid=%d prog=%s procs=%lld vsz=%lld rss=%lld pcpu=%.2f threads=%lld\n",
+				        (int) tp->pid, tp->prog, tp->procs, tp->vsz, tp->rss, tp->pcpu, tp->nthreads);
+			j = get_status (value, procs_thresholds);
+			if (j == STATE_WARNING)
+				warn++;
+			else if (j == STATE_CRITICAL)
+				crit++;
+			if (j != STATE_OK) {
+				xasprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), tp->prog);
+				result = max_state (result, j);
+			}
+		}
+	}
+
 	if ( result == STATE_UNKNOWN ) 
 		result = STATE_OK;
 
 	/* Needed if procs found, but none match filter */
-	if ( metric == METRIC_PROCS ) {
+	if ( metric == METRIC_PROCS && !tree_mode ) {
 		result = max_state (result, get_status ((double)procs, procs_thresholds) );
 	}
 
@@ -344,16 +447,19 @@ main (int argc, char **argv)
 		printf ("%s %s: ", metric_name, _("OK"));
 	} else if (result == STATE_WARNING) {
 		printf ("%s %s: ", metric_name, _("WARNING"));
-		if ( metric != METRIC_PROCS ) {
+		if ( metric != METRIC_PROCS || tree_mode ) {
 			printf (_("%d warn out of "), warn);
 		}
 	} else if (result == STATE_CRITICAL) {
 		printf ("%s %s: ", metric_name, _("CRITICAL"));
-		if (metric != METRIC_PROCS) {
+		if (metric != METRIC_PROCS || tree_mode) {
 			printf (_("%d crit, %d warn out of "), crit, warn);
 		}
 	} 
-	printf (ngettext ("%d process", "%d processes", (unsigned long) procs), procs);
+	if (tree_mode)
+		printf (ngettext ("%d process tree", "%d process trees", (unsigned long) trees), trees);
+	else
+		printf (ngettext ("%d process", "%d processes", (unsigned long) procs), procs);
 	
 	if (strcmp(fmt,"") != 0) {
 		printf (_(" with %s"), fmt);
@@ -362,7 +468,33 @@ main (int argc, char **argv)
 	if ( verbose >= 1 && strcmp(fails,"") )
 		printf (" [%s]", fails);
 
-	if (metric == METRIC_PROCS)
+	if (tree_mode) {
+		printf (" | trees=%d;;;0; trees_warn=%d;;;0; trees_crit=%d;;;0;", trees, warn, crit);
+		/* one value per tree, named after its root */
+		for (i = 0; i < tree_count; i++) {
+			tp = &tree_procs[i];
+			if (tp->root != i)
+				continue;
+			/* keep the quoting of the label intact */
+			for (label = tp->prog; *label; label++)
+				if (*label == '\'' || *label == '=')
+					*label = '_';
+			printf (" '%s_%d'=", tp->prog, (int) tp->pid);
+			if (metric == METRIC_PROCS)
+				printf ("%lld", tp->procs);
+			else if (metric == METRIC_VSZ)
+				printf ("%lldKB", tp->vsz);
+			else if (metric == METRIC_RSS)
+				printf ("%lldKB", tp->rss);
+			else if (metric == METRIC_CPU)
+				printf ("%.2f%%", tp->pcpu);
+			else
+				printf ("%lld", tp->nthreads);
+			printf (";%s;%s;0;", warning_range ? warning_range : "",
+			        critical_range ? critical_range : "");
+		}
+	}
+	else if (metric == METRIC_PROCS)
 		printf (" | procs=%d;%s;%s;0;", procs,
 				warning_range ? warning_range : "",
 				critical_range ? critical_range : "");
@@ -409,6 +541,10 @@ process_arguments (int argc, char **argv)
 		{"input-file", required_argument, 0, CHAR_MAX+2},
 		{"no-kthreads", required_argument, 0, 'k'},
 		{"traditional-filter", no_argument, 0, 'T'},
+		{"cgroup", required_argument, 0, CHAR_MAX+3},
+		{"unit", required_argument, 0, CHAR_MAX+4},
+		{"cgroup-recursive", no_argument, 0, CHAR_MAX+5},
+		{"tree", no_argument, 0, CHAR_MAX+6},
 		{0, 0, 0, 0}
 	};
 
@@ -559,8 +695,12 @@ process_arguments (int argc, char **argv)
 				metric = METRIC_ELAPSED;
 				break;
 			}
+			else if ( strcmp(optarg, "THREADS") == 0) {
+				metric = METRIC_THREADS;
+				break;
+			}
 				
-			usage4 (_("Metric must be one of PROCS, VSZ, RSS, CPU, ELAPSED!"));
+			usage4 (_("Metric must be one of PROCS, VSZ, RSS, CPU, ELAPSED, THREADS!"));
 		case 'k':	/* linux kernel thread filter */
 			kthread_filter = 1;
 			break;
@@ -573,6 +713,20 @@ process_arguments (int argc, char **argv)
 		case CHAR_MAX+2:
 			input_filename = optarg;
 			break;
+		case CHAR_MAX+3:
+			cgroup_name = optarg;
+			cgroup_is_unit = 0;
+			break;
+		case CHAR_MAX+4:
+			cgroup_name = optarg;
+			cgroup_is_unit = 1;
+			break;
+		case CHAR_MAX+5:
+			cgroup_recursive = 1;
+			break;
+		case CHAR_MAX+6:
+			tree_mode = 1;
+			break;
 		}
 	}
 
@@ -598,6 +752,8 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments ()
 {
+	char *temp;
+
 	if (options == 0)
 		options = ALL;
 
@@ -616,10 +772,215 @@ validate_arguments ()
 	if (fails==NULL)
 		fails = strdup("");
 
+	if (tree_mode && metric == METRIC_ELAPSED)
+		usage4 (_("ELAPSED cannot be added up with --tree"));
+	if (!tree_mode && metric == METRIC_THREADS)
+		usage4 (_("THREADS needs --tree"));
+
+	if (cgroup_name) {
+		if (input_filename)
+			usage4 (_("--input-file cannot be combined with --cgroup or --unit"));
+		if (cgroup_is_unit) {
+			/* systemd puts services in system.slice, the rest we look for */
+			if (strchr (cgroup_name, '.') == NULL)
+				xasprintf (&cgroup_name, "%s.service", cgroup_name);
+			xasprintf (&temp, "system.slice/%s", cgroup_name);
+			if ((cgroup_path = cgroup_resolve (temp)) == NULL &&
+			    (cgroup_path = cgroup_find (CGROUP_ROOT "/unified", cgroup_name, 0)) == NULL &&
+			    (cgroup_path = cgroup_find (CGROUP_ROOT "/systemd", cgroup_name, 0)) == NULL)
+				cgroup_path = cgroup_find (CGROUP_ROOT, cgroup_name, 0);
+			free (temp);
+		}
+		else
+			cgroup_path = cgroup_resolve (cgroup_name);
+		if (cgroup_path == NULL)
+			die (STATE_UNKNOWN, "PROCS %s: %s %s '%s'\n", _("UNKNOWN"), _("Could not find"),
+			     cgroup_is_unit ? _("unit") : _("cgroup"), cgroup_name);
+		xasprintf (&fmt, "%s%s%s '%s'", fmt, (strcmp (fmt, "") ? ", " : ""),
+		           cgroup_is_unit ? "unit" : "cgroup", cgroup_name);
+	}
+
 	return options;
 }
 
 
+/*
+ * Directory of a cgroup given absolutely or relative to CGROUP_ROOT. On
+ * hybrid hierarchies the unified and the systemd trees are tried as well,
+ * so the paths of /proc/PID/cgroup work as they are.
+ */
+char *
+cgroup_resolve (const char *name)
+{
+	const char *roots[] = { "", "/unified", "/systemd" };
+	char *path, *procs;
+	size_t i;
+	int found;
+
+	if (!strncmp (name, CGROUP_ROOT "/", strlen (CGROUP_ROOT) + 1))
+		return strdup (name);
+	while (*name == '/')
+		name++;
+
+	for (i = 0; i < sizeof (roots) / sizeof (roots[0]); i++) {
+		xasprintf (&path, "%s%s%s%s", CGROUP_ROOT, roots[i], (*name ? "/" : ""), name);
+		xasprintf (&procs, "%s/cgroup.procs", path);
+		found = access (procs, R_OK) == 0;
+		free (procs);
+		if (found)
+			return path;
+		free (path);
+	}
+	return NULL;
+}
+
+
+/* first cgroup below dir named name, depth first - unit names are unique */
+char *
+cgroup_find (const char *dir, const char *name, int depth)
+{
+	DIR *d;
+	struct dirent *de;
+	char *path, *found = NULL;
+
+	if (depth > CGROUP_FIND_DEPTH || (d = opendir (dir)) == NULL)
+		return NULL;
+	while (found == NULL && (de = readdir (d)) != NULL) {
+		if (de->d_name[0] == '.' || (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN))
+			continue;
+		xasprintf (&path, "%s/%s", dir, de->d_name);
+		if (!strcmp (de->d_name, name))
+			found = path;
+		else {
+			found = cgroup_find (path, name, depth + 1);
+			free (path);
+		}
+	}
+	closedir (d);
+	return found;
+}
+
+
+/* collect the members of a cgroup, and of its children with --cgroup-recursive */
+void
+cgroup_add_pids (const char *dir)
+{
+	DIR *d;
+	struct dirent *de;
+	char *path, *procs_file;
+	FILE *fp;
+	long pid;
+
+	xasprintf (&path, "%s/cgroup.procs", dir);
+	if ((fp = fopen (path, "r")) == NULL)
+		die (STATE_UNKNOWN, "PROCS %s: %s %s - %s\n", _("UNKNOWN"), _("Could not read"), path, strerror (errno));
+	while (fscanf (fp, "%ld", &pid) == 1) {
+		if (cgroup_pid_count == cgroup_pid_size) {
+			cgroup_pid_size = cgroup_pid_size ? cgroup_pid_size * 2 : 64;
+			cgroup_pids = realloc (cgroup_pids, cgroup_pid_size * sizeof (pid_t));
+			if (cgroup_pids == NULL)
+				die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+		}
+		cgroup_pids[cgroup_pid_count++] = (pid_t) pid;
+	}
+	fclose (fp);
+	free (path);
+
+	if (!cgroup_recursive || (d = opendir (dir)) == NULL)
+		return;
+	while ((de = readdir (d)) != NULL) {
+		if (de->d_name[0] == '.' || (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN))
+			continue;
+		xasprintf (&path, "%s/%s", dir, de->d_name);
+		xasprintf (&procs_file, "%s/cgroup.procs", path);
+		if (access (procs_file, R_OK) == 0)
+			cgroup_add_pids (path);
+		free (procs_file);
+		free (path);
+	}
+	closedir (d);
+}
+
+
+/*
+ * Fill in what ps would have shown for pid from /proc/PID/stat and
+ * /proc/PID/cmdline: the one letter state, comm as the command and the
+ * command line, or [comm] for kernel threads, as the arguments, and the
+ * number of threads. Returns ERROR if the process is gone.
+ */
+int
+proc_read (pid_t pid, char *state, int *uid, pid_t *ppid, int *vsz, int *rss,
+           float *pcpu, char *etime, char *prog, char *args, int *threads)
+{
+	static double uptime = -1;
+	static long hz = 0, page_kb = 0;
+	char path[64], buf[1024], *comm, *end;
+	unsigned long utime, stime, vsize;
+	unsigned long long starttime;
+	long pages;
+	double elapsed;
+	struct stat sb;
+	FILE *fp;
+	size_t n, i;
+	int seconds;
+
+	if (uptime < 0) {
+		hz = sysconf (_SC_CLK_TCK);
+		page_kb = sysconf (_SC_PAGESIZE) / 1024;
+		if ((fp = fopen ("/proc/uptime", "r")) == NULL || fscanf (fp, "%lf", &uptime) != 1)
+			die (STATE_UNKNOWN, "PROCS %s: %s /proc/uptime - %s\n", _("UNKNOWN"), _("Could not read"), strerror (errno));
+		fclose (fp);
+	}
+
+	snprintf (path, sizeof (path), "/proc/%d", (int) pid);
+	if (stat (path, &sb) == -1)
+		return ERROR;
+	*uid = sb.st_uid;
+
+	snprintf (path, sizeof (path), "/proc/%d/stat", (int) pid);
+	if ((fp = fopen (path, "r")) == NULL)
+		return ERROR;
+	n = fread (buf, 1, sizeof (buf) - 1, fp);
+	fclose (fp);
+	buf[n] = '\0';
+
+	/* comm may hold anything, parentheses and spaces too */
+	if ((comm = strchr (buf, '(')) == NULL || (end = strrchr (buf, ')')) == NULL)
+		return ERROR;
+	*end = '\0';
+	strncpy (prog, comm + 1, MAX_INPUT_BUFFER - 1);
+	prog[MAX_INPUT_BUFFER - 1] = '\0';
+	if (sscanf (end + 2, "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %d %*d %llu %lu %ld",
+	            state, ppid, &utime, &stime, threads, &starttime, &vsize, &pages) != 8)
+		return ERROR;
+	state[1] = '\0';
+	*vsz = vsize / 1024;
+	*rss = pages * page_kb;
+
+	elapsed = uptime - (double) starttime / hz;
+	*pcpu = elapsed > 0 ? (utime + stime) * 100.0 / hz / elapsed : 0;
+	seconds = elapsed > 0 ? (int) elapsed : 0;
+	sprintf (etime, "%d-%02d:%02d:%02d", seconds / 86400, seconds / 3600 % 24,
+	         seconds / 60 % 60, seconds % 60);
+
+	snprintf (path, sizeof (path), "/proc/%d/cmdline", (int) pid);
+	n = 0;
+	if ((fp = fopen (path, "r")) != NULL) {
+		n = fread (args, 1, MAX_INPUT_BUFFER - 1, fp);
+		fclose (fp);
+	}
+	for (i = 0; i < n; i++)
+		if (args[i] == '\0')
+			args[i] = ' ';
+	args[n] = '\0';
+	strip (args);
+	if (args[0] == '\0')
+		snprintf (args, MAX_INPUT_BUFFER, "[%s]", prog);
+
+	return OK;
+}
+
+
 /* convert the elapsed time to seconds */
 int
 convert_to_seconds(char *etime) {
@@ -683,6 +1044,136 @@ convert_to_seconds(char *etime) {
 }
 
 
+
+/* threads of a process listed by ps, -1 where /proc has none */
+int
+proc_threads (pid_t pid)
+{
+	char path[64], line[128];
+	FILE *fp;
+	int threads = -1;
+
+	snprintf (path, sizeof (path), "/proc/%d/status", (int) pid);
+	if ((fp = fopen (path, "r")) == NULL)
+		return -1;
+	while (fgets (line, sizeof (line), fp))
+		if (sscanf (line, "Threads: %d", &threads) == 1)
+			break;
+	fclose (fp);
+	return threads;
+}
+
+
+void
+tree_add (pid_t pid, pid_t ppid, int vsz, int rss, float pcpu, int threads,
+          const char *prog, int matched)
+{
+	tree_proc *tp;
+
+	if (tree_count == tree_size) {
+		tree_size = tree_size ? tree_size * 2 : 1024;
+		tree_procs = realloc (tree_procs, tree_size * sizeof (tree_proc));
+		if (tree_procs == NULL)
+			die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	}
+	tp = &tree_procs[tree_count++];
+	tp->pid = pid;
+	tp->ppid = ppid;
+	tp->vsz = vsz;
+	tp->rss = rss;
+	tp->pcpu = pcpu;
+	tp->threads = threads;
+	tp->prog = strdup (prog);
+	tp->matched = matched;
+}
+
+
+/*
+ * Link every process to its parent through an open addressed pid map and
+ * add each subtree up on its topmost matched process, which becomes the
+ * root of that tree; matched processes below a root count towards it.
+ * Linear in the number of processes. Returns the number of trees.
+ */
+int
+tree_build (void)
+{
+	int *slots, *stack, mask, slot, i, parent, top, node, child, trees = 0;
+	unsigned int size;
+	tree_proc *tp, *root;
+
+	for (size = 2; size < 2 * (unsigned int) tree_count; size *= 2)
+		;
+	mask = size - 1;
+	slots = malloc (size * sizeof (int));
+	stack = malloc ((tree_count + 1) * sizeof (int));
+	if (slots == NULL || stack == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	memset (slots, -1, size * sizeof (int));
+
+	/* pid -> index; a pid listed twice keeps its first entry */
+#define PID_SLOT(pid) (((unsigned int) (pid) * 2654435761U) & mask)
+	for (i = 0; i < tree_count; i++) {
+		tree_procs[i].first_child = tree_procs[i].next_sibling = tree_procs[i].root = -1;
+		for (slot = PID_SLOT (tree_procs[i].pid); slots[slot] != -1; slot = (slot + 1) & mask)
+			if (tree_procs[slots[slot]].pid == tree_procs[i].pid)
+				break;
+		if (slots[slot] == -1)
+			slots[slot] = i;
+	}
+
+	/* children in reverse, tops of the forest pushed on the stack */
+	top = 0;
+	for (i = tree_count - 1; i >= 0; i--) {
+		tp = &tree_procs[i];
+		for (slot = PID_SLOT (tp->ppid), parent = -1; slots[slot] != -1; slot = (slot + 1) & mask)
+			if (tree_procs[slots[slot]].pid == tp->ppid) {
+				parent = slots[slot];
+				break;
+			}
+		if (parent == -1 || parent == i || tp->pid == tp->ppid)
+			stack[top++] = i;
+		else {
+			tp->next_sibling = tree_procs[parent].first_child;
+			tree_procs[parent].first_child = i;
+		}
+	}
+#undef PID_SLOT
+
+	/* parents come before their children, so the root is always known */
+	while (top > 0) {
+		node = stack[--top];
+		tp = &tree_procs[node];
+		if (tp->root == -1 && tp->matched) {
+			tp->root = node;
+			tp->procs = 1;
+			tp->nthreads = 0;
+			trees++;
+		}
+		else if (tp->root != -1) {
+			root = &tree_procs[tp->root];
+			root->procs++;
+			root->vsz += tp->vsz;
+			root->rss += tp->rss;
+			root->pcpu += tp->pcpu;
+		}
+		if (tp->root != -1) {
+			if (metric == METRIC_THREADS && tp->threads < 0)
+				tp->threads = proc_threads (tp->pid);
+			if (tp->threads > 0)
+				tree_procs[tp->root].nthreads += tp->threads;
+		}
+		for (child = tp->first_child; child != -1; child = tree_procs[child].next_sibling) {
+			tree_procs[child].root = tp->root;
+			stack[top++] = child;
+		}
+	}
+
+	free (slots);
+	free (stack);
+	return trees;
+}
+
+
 void
 print_help (void)
 {
@@ -714,7 +1205,12 @@ print_help (void)
 /* only linux etime is support currently */
 #if defined( __linux__ )
 	printf ("  %s\n", _("ELAPSED - time elapsed in seconds"));
+	printf ("  %s\n", _("THREADS - number of threads, with --tree only"));
 #endif /* defined(__linux__) */
+  printf (" %s\n", "--tree");
+  printf ("   %s\n", _("Add the metric up over each matched process and all its descendants,"));
+  printf ("   %s\n", _("matched or not, and check the totals per tree. Matched processes below"));
+  printf ("   %s\n", _("another one count towards its tree. PROCS is then the size of a tree."));
 	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
 	printf (" %s\n", "-v, --verbose");
@@ -747,6 +1243,14 @@ print_help (void)
   printf ("   %s\n", _("Only scan for exact matches of COMMAND (without path)."));
   printf (" %s\n", "-k, --no-kthreads");
   printf ("   %s\n", _("Only scan for non kernel threads (works on Linux only)."));
+  printf (" %s\n", "--cgroup=PATH");
+  printf ("   %s\n", _("Only scan the processes of this cgroup, absolute or relative to"));
+  printf ("   ");
+  printf (_("%s. They are read from /proc instead of running ps (Linux only).\n"), CGROUP_ROOT);
+  printf (" %s\n", "--unit=NAME");
+  printf ("   %s\n", _("Same for the cgroup of a systemd unit, NAME.service if no suffix is given."));
+  printf (" %s\n", "--cgroup-recursive");
+  printf ("   %s\n", _("Include the processes of child cgroups as well."));
 
 	printf(_("\n\
 RANGEs are specified 'min:max' or 'min:' or ':max' (or 'max'). If\n\
@@ -771,6 +1275,10 @@ be the total number of running processes\n\n"));
   printf ("  %s\n\n", _("Alert if VSZ of any processes over 50K or 100K"));
   printf (" %s\n", "check_procs -w 10 -c 20 --metric=CPU");
   printf ("  %s\n", _("Alert if CPU of any processes over 10%% or 20%%"));
+  printf (" %s\n", "check_procs -w 1: -c 1: --unit=sshd -C sshd");
+  printf ("  %s\n", _("Critical if no sshd process runs in the sshd.service cgroup"));
+  printf (" %s\n", "check_procs -w 2000000 --metric=RSS --tree -C php-fpm");
+  printf ("  %s\n", _("Warning if a php-fpm master and its workers use more than 2GB together"));
 
 	printf (UT_SUPPORT);
 }
@@ -782,4 +1290,5 @@ print_usage (void)
 	printf ("%s -w <range> -c <range> [-m metric] [-s state] [-p ppid]\n", progname);
   printf (" [-u user] [-r rss] [-z vsz] [-P %%cpu] [-a argument-array]\n");
   printf (" [-C command] [-k] [-t timeout] [-v]\n");
+  printf (" [--cgroup=path | --unit=name] [--cgroup-recursive] [--tree]\n");
 }
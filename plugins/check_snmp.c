@@ -37,6 +37,11 @@ const char *email = "devel@monitoring-plugins.org";
 #include "utils.h"
 #include "utils_cmd.h"
 
+#include <ctype.h>
+#ifdef USE_OPENSSL
+# include <openssl/evp.h>
+#endif
+
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
 #define DEFAULT_MIBLIST "ALL"
@@ -64,6 +69,14 @@ const char *email = "devel@monitoring-plugins.org";
 #define L_RATE_MULTIPLIER CHAR_MAX+2
 #define L_INVERT_SEARCH CHAR_MAX+3
 #define L_OFFSET CHAR_MAX+4
+#define L_KEYCACHE CHAR_MAX+5
+
+/* SNMPv3 localized key cache */
+#define KEYCACHE_STATE_VERSION 1
+#define OID_SNMP_ENGINE_ID "1.3.6.1.6.3.10.2.1.1.0"
+#define OID_SNMP_ENGINE_BOOTS "1.3.6.1.6.3.10.2.1.2.0"
+#define OID_SNMP_ENGINE_TIME "1.3.6.1.6.3.10.2.1.3.0"
+#define SNMP_ENGINE_ID_MAX 32
 
 /* Gobble to string - stop incrementing c when c[0] match one of the
  * characters in s */
@@ -153,6 +166,14 @@ double *previous_value;
 size_t previous_size = OID_COUNT_STEP;
 int perf_labels = 1;
 char* ip_version = "";
+int use_keycache = FALSE;
+char *keycache_key = NULL;
+int keycache_used = FALSE;
+
+#ifdef USE_OPENSSL
+static void keycache_apply (void);
+static void keycache_drop (void);
+#endif
 
 static char *fix_snmp_range(char *th)
 {
@@ -241,6 +262,11 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+#ifdef USE_OPENSSL
+	if (use_keycache)
+		keycache_apply ();
+#endif
+
 	if(calculate_rate) {
 		if (!strcmp(label, "SNMP"))
 			label = strdup("SNMP RATE");
@@ -358,6 +384,13 @@ main (int argc, char **argv)
 	if (chld_out.lines == 0)
 		external_error=1;
 	if (external_error) {
+#ifdef USE_OPENSSL
+		/* the agent may have a new engine ID or password, start over next time */
+		if (keycache_used) {
+			keycache_drop ();
+			printf (_("Cached SNMPv3 keys dropped. "));
+		}
+#endif
 		if (chld_err.lines > 0) {
 			printf (_("External command error: %s\n"), chld_err.line[0]);
 			for (i = 1; i < chld_err.lines; i++) {
@@ -640,6 +673,255 @@ main (int argc, char **argv)
 
 
 
+#ifdef USE_OPENSSL
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+# define EVP_MD_CTX_new EVP_MD_CTX_create
+# define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+/* net-snmp names of the authentication protocols, NULL if unknown */
+static const EVP_MD *
+keycache_md (const char *name)
+{
+	if (!strcasecmp (name, "MD5"))
+		return EVP_md5 ();
+	if (!strcasecmp (name, "SHA") || !strcasecmp (name, "SHA1"))
+		return EVP_sha1 ();
+	if (!strcasecmp (name, "SHA-224"))
+		return EVP_sha224 ();
+	if (!strcasecmp (name, "SHA-256"))
+		return EVP_sha256 ();
+	if (!strcasecmp (name, "SHA-384"))
+		return EVP_sha384 ();
+	if (!strcasecmp (name, "SHA-512"))
+		return EVP_sha512 ();
+	return NULL;
+}
+
+/* RFC 3414 A.2: hash a megabyte of the repeated password into Ku, then
+ * localize it to the engine as Kul = H(Ku | engineID | Ku) */
+static unsigned int
+keycache_localize (const EVP_MD *md, const char *password,
+                   const unsigned char *engine_id, size_t engine_id_len,
+                   unsigned char *key)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new ();
+	unsigned char buf[64], ku[EVP_MAX_MD_SIZE];
+	size_t password_len = strlen (password), count, i;
+	unsigned int len = 0;
+
+	EVP_DigestInit_ex (ctx, md, NULL);
+	for (count = 0; count < 1048576; count += sizeof (buf)) {
+		for (i = 0; i < sizeof (buf); i++)
+			buf[i] = password[(count + i) % password_len];
+		EVP_DigestUpdate (ctx, buf, sizeof (buf));
+	}
+	EVP_DigestFinal_ex (ctx, ku, &len);
+
+	EVP_DigestInit_ex (ctx, md, NULL);
+	EVP_DigestUpdate (ctx, ku, len);
+	EVP_DigestUpdate (ctx, engine_id, engine_id_len);
+	EVP_DigestUpdate (ctx, ku, len);
+	EVP_DigestFinal_ex (ctx, key, &len);
+	EVP_MD_CTX_free (ctx);
+	return len;
+}
+
+static char *
+keycache_hex (const unsigned char *data, size_t len)
+{
+	char *hex = malloc (2 * len + 3);
+	size_t i;
+
+	if (hex == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	strcpy (hex, "0x");
+	for (i = 0; i < len; i++)
+		sprintf (hex + 2 + 2 * i, "%02x", data[i]);
+	return hex;
+}
+
+/* The state key covers everything the keys are derived from except the
+ * engine ID, which is what the first check finds out */
+static char *
+keycache_state_key (void)
+{
+	struct sha1_ctx ctx;
+	unsigned char digest[20];
+	char *material = NULL, *key;
+
+	xasprintf (&material, "%s:%s\n%s\n%s\n%s\n%s\n%s", server_address, port,
+	           secname, authproto, authpasswd,
+	           privproto ? privproto : "", privpasswd ? privpasswd : "");
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (material, strlen (material) + 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+	memset (material, 0, strlen (material));
+	free (material);
+
+	key = keycache_hex (digest, sizeof (digest));
+	return key + 2;
+}
+
+/* Ask the agent for snmpEngineID, snmpEngineBoots and snmpEngineTime,
+ * authenticating with the passwords one last time */
+static int
+keycache_discover (unsigned char *engine_id, size_t *engine_id_len,
+                   unsigned long *boots, unsigned long *engine_time)
+{
+	char *command_line[14 + 12 + 2 + 3 + 1];
+	output chld_out, chld_err;
+	size_t i, n = 0, line;
+	unsigned int byte;
+	char *p;
+
+	command_line[n++] = PATH_TO_SNMPGET;
+	command_line[n++] = "-Le";
+	command_line[n++] = "-t";
+	xasprintf (&command_line[n++], "%d", timeout_interval);
+	command_line[n++] = "-r";
+	xasprintf (&command_line[n++], "%d", retries);
+	command_line[n++] = "-m";
+	command_line[n++] = "";
+	command_line[n++] = "-v";
+	command_line[n++] = "3";
+	command_line[n++] = "-Oqvx";
+	for (i = 0; i < (size_t)numcontext; i++)
+		command_line[n++] = contextargs[i];
+	for (i = 0; i < (size_t)numauthpriv; i++)
+		command_line[n++] = authpriv[i];
+	xasprintf (&command_line[n++], "%s:%s", server_address, port);
+	command_line[n++] = OID_SNMP_ENGINE_ID;
+	command_line[n++] = OID_SNMP_ENGINE_BOOTS;
+	command_line[n++] = OID_SNMP_ENGINE_TIME;
+	command_line[n] = NULL;
+
+	if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR)
+		usage4 (_("Cannot catch SIGALRM"));
+	alarm (timeout_interval * retries + 5);
+	i = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+	alarm (0);
+	if (i != 0 || chld_out.lines < 3)
+		return ERROR;
+
+	/* the engine ID comes in hex, possibly over several lines, followed
+	 * by the two integers */
+	*engine_id_len = 0;
+	for (line = 0; line < chld_out.lines - 2; line++) {
+		for (p = chld_out.line[line]; *p; ) {
+			if (!isxdigit (*p)) {
+				p++;
+				continue;
+			}
+			if (sscanf (p, "%2x", &byte) != 1 || *engine_id_len == SNMP_ENGINE_ID_MAX)
+				return ERROR;
+			engine_id[(*engine_id_len)++] = byte;
+			p += isxdigit (p[1]) ? 2 : 1;
+		}
+	}
+	*boots = strtoul (chld_out.line[chld_out.lines - 2], NULL, 10);
+	*engine_time = strtoul (chld_out.line[chld_out.lines - 1], NULL, 10);
+	if (verbose)
+		printf ("SNMPv3 engine ID %s, boots %lu, time %lu\n",
+		        keycache_hex (engine_id, *engine_id_len), *boots, *engine_time);
+	return *engine_id_len >= 5 ? OK : ERROR;
+}
+
+/* Replace the passwords in authpriv by keys localized to the agent's
+ * engine, discovering it and filling the cache first if needed. The rate
+ * state is selected again afterwards */
+static void
+keycache_apply (void)
+{
+	const EVP_MD *md;
+	state_data *cached;
+	unsigned char engine_id[SNMP_ENGINE_ID_MAX];
+	unsigned char auth_key[EVP_MAX_MD_SIZE], priv_key[EVP_MAX_MD_SIZE];
+	unsigned int auth_key_len, priv_key_len = 0;
+	unsigned long boots, engine_time;
+	size_t engine_id_len;
+	time_t now;
+	char engine_hex[2 * SNMP_ENGINE_ID_MAX + 3];
+	char auth_hex[2 * EVP_MAX_MD_SIZE + 3], priv_hex[2 * EVP_MAX_MD_SIZE + 3];
+	char *data = NULL;
+	int fields, priv = privpasswd != NULL && !strcmp (seclevel, "authPriv");
+
+	if (strcmp (proto, "3") || authpasswd == NULL || !strcmp (seclevel, "noAuthNoPriv"))
+		return;
+	if ((md = keycache_md (authproto)) == NULL ||
+	    (priv && strcasecmp (privproto, "DES") && strcasecmp (privproto, "AES") &&
+	     strcasecmp (privproto, "AES128"))) {
+		if (verbose)
+			printf ("SNMPv3 key cache not used with %s/%s\n", authproto, priv ? privproto : "-");
+		return;
+	}
+
+	keycache_key = keycache_state_key ();
+	np_enable_state (keycache_key, KEYCACHE_STATE_VERSION);
+	time (&now);
+
+	cached = np_state_read ();
+	if (cached != NULL && cached->data != NULL &&
+	    (fields = sscanf ((char *)cached->data, "%66s %lu %lu %130s %130s", engine_hex,
+	                      &boots, &engine_time, auth_hex, priv_hex)) >= 4 &&
+	    (fields == 5) == priv) {
+		/* the engine's clock kept running since it was cached */
+		engine_time += now - cached->time;
+		if (verbose)
+			printf ("Using cached SNMPv3 keys for engine %s\n", engine_hex);
+	}
+	else {
+		if (keycache_discover (engine_id, &engine_id_len, &boots, &engine_time) != OK) {
+			if (verbose)
+				printf ("SNMPv3 engine discovery failed, using the passwords\n");
+			if (calculate_rate)
+				np_enable_state (NULL, 1);
+			return;
+		}
+		auth_key_len = keycache_localize (md, authpasswd, engine_id, engine_id_len, auth_key);
+		if (priv)
+			priv_key_len = keycache_localize (md, privpasswd, engine_id, engine_id_len, priv_key);
+		strcpy (engine_hex, keycache_hex (engine_id, engine_id_len));
+		strcpy (auth_hex, keycache_hex (auth_key, auth_key_len));
+		strcpy (priv_hex, keycache_hex (priv_key, priv_key_len));
+		xasprintf (&data, "%s %lu %lu %s%s%s", engine_hex, boots, engine_time,
+		           auth_hex, priv ? " " : "", priv ? priv_hex : "");
+		np_state_write_private_string (now, data);
+		memset (data, 0, strlen (data));
+		free (data);
+	}
+
+	/* -l, -a and -u stay, the passwords make way for the keys */
+	numauthpriv = priv ? 16 : 12;
+	authpriv = realloc (authpriv, numauthpriv * sizeof (char *));
+	authpriv[6] = strdup ("-3k");
+	authpriv[7] = strdup (auth_hex);
+	if (priv) {
+		authpriv[8] = strdup ("-x");
+		authpriv[9] = strdup (privproto);
+		authpriv[10] = strdup ("-3K");
+		authpriv[11] = strdup (priv_hex);
+	}
+	authpriv[numauthpriv - 4] = strdup ("-e");
+	authpriv[numauthpriv - 3] = strdup (engine_hex);
+	authpriv[numauthpriv - 2] = strdup ("-Z");
+	xasprintf (&authpriv[numauthpriv - 1], "%lu,%lu", boots, engine_time);
+	keycache_used = TRUE;
+
+	if (calculate_rate)
+		np_enable_state (NULL, 1);
+}
+
+static void
+keycache_drop (void)
+{
+	np_enable_state (keycache_key, KEYCACHE_STATE_VERSION);
+	np_state_write_private_string (0, "");
+}
+#endif /* USE_OPENSSL */
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -680,6 +962,7 @@ process_arguments (int argc, char **argv)
 		{"offset", required_argument, 0, L_OFFSET},
 		{"invert-search", no_argument, 0, L_INVERT_SEARCH},
 		{"perf-oids", no_argument, 0, 'O'},
+		{"keycache", no_argument, 0, L_KEYCACHE},
 		{"ipv4", no_argument, 0, '4'},
 		{"ipv6", no_argument, 0, '6'},
 		{0, 0, 0, 0}
@@ -921,6 +1204,13 @@ process_arguments (int argc, char **argv)
 		case L_INVERT_SEARCH:
 			invert_search=1;
 			break;
+		case L_KEYCACHE:
+#ifdef USE_OPENSSL
+			use_keycache = TRUE;
+#else
+			usage4 (_("The SNMPv3 key cache needs OpenSSL"));
+#endif
+			break;
 		case 'O':
 			perf_labels=0;
 			break;
@@ -1164,6 +1454,12 @@ print_help (void)
 	printf ("    %s\n", _("SNMPv3 authentication password"));
 	printf (" %s\n", "-X, --privpasswd=PASSWORD");
 	printf ("    %s\n", _("SNMPv3 privacy password"));
+#ifdef USE_OPENSSL
+	printf (" %s\n", "--keycache");
+	printf ("    %s\n", _("Keep the SNMPv3 localized keys and the agent's engine ID, boots and time in"));
+	printf ("    %s\n", _("the state directory, so later checks skip the password to key expansion"));
+	printf ("    %s\n", _("and the engine ID discovery. See 'SNMPv3 Key Cache' below"));
+#endif
 
 	/* OID Stuff */
 	printf (" %s\n", "-o, --oid=OID(s)");
@@ -1242,6 +1538,17 @@ print_help (void)
 	printf(" %s\n", _("The state is uniquely determined by the arguments to the plugin, so"));
 	printf(" %s\n", _("changing the arguments will create a new state file."));
 
+#ifdef USE_OPENSSL
+	printf("\n");
+	printf("%s\n", _("SNMPv3 Key Cache:"));
+	printf(" %s\n", _("With --keycache the first check asks the agent for its engine ID and stores"));
+	printf(" %s\n", _("the keys localized to it in a file only the user can read. Later checks pass"));
+	printf(" %s\n", _("them to snmpget with -3k/-3K instead of the passwords. If a check with"));
+	printf(" %s\n", _("cached keys fails, the cache is dropped and rebuilt by the next check. Only"));
+	printf(" %s\n", _("DES and AES (128 bit) privacy keys are cached; other privacy protocols use"));
+	printf(" %s\n", _("the passwords as before."));
+#endif
+
 	printf (UT_SUPPORT);
 }
 
@@ -1256,4 +1563,5 @@ print_usage (void)
 	printf ("[-l label] [-u units] [-p port-number] [-d delimiter] [-D output-delimiter]\n");
 	printf ("[-m miblist] [-P snmp version] [-N context] [-L seclevel] [-U secname]\n");
 	printf ("[-a authproto] [-A authpasswd] [-x privproto] [-X privpasswd] [-4|6]\n");
+	printf ("[--keycache]\n");
 }
@@ -39,6 +39,7 @@ const char *email = "devel@monitoring-plugins.org";
 
 #include <ctype.h>
 #include <sys/select.h>
+#include <netinet/tcp.h>
 
 #ifdef HAVE_SSL
 static int check_cert = FALSE;
@@ -52,6 +53,8 @@ static int days_till_exp_warn, days_till_exp_crit;
 
 /* int my_recv(char *, size_t); */
 static int process_arguments (int, char **);
+static int get_tcp_info (double *, int *);
+static size_t udp_exchange (char **, int *);
 void print_help (void);
 void print_usage (void);
 
@@ -85,6 +88,28 @@ static int sd = 0;
 static char buffer[MAXBUF];
 static int expect_mismatch_state = STATE_WARNING;
 static int match_flags = NP_MATCH_EXACT;
+static int fast_open = FALSE;
+
+/* Kernel TCP_INFO metrics, each of which can carry its own thresholds */
+enum { TCPI_RTT, TCPI_RTTVAR, TCPI_RETRANS, TCPI_CWND, TCPI_MSS, TCPI_METRICS };
+static const char *tcpi_name[TCPI_METRICS] = { "rtt", "rttvar", "retrans", "cwnd", "mss" };
+static const char *tcpi_uom[TCPI_METRICS] = { "ms", "ms", "", "", "B" };
+static char *tcpi_warn[TCPI_METRICS];
+static char *tcpi_crit[TCPI_METRICS];
+
+/* check_udp datagram exchange: retransmits, several probes and tokens */
+#define UDP_MAX_ATTEMPTS 100
+#define UDP_GRACE_INTERVALS 3           /* wait after the last probe, in intervals */
+#define UDP_GRACE_RTTS 4                /* or in the largest round trip seen */
+static int udp_mode = FALSE;
+static int udp_retransmit = 0;          /* ms until the first retransmit */
+static int udp_probes = 1;
+static int udp_interval = 200;          /* ms between probes */
+static char *udp_token = NULL;
+static char *loss_warn = NULL;
+static char *loss_crit = NULL;
+static int udp_sent = 0, udp_received = 0;
+static double udp_rtt_min, udp_rtt_avg, udp_rtt_max;
 
 #define FLAG_SSL 0x01
 #define FLAG_VERBOSE 0x02
@@ -104,6 +129,12 @@ main (int argc, char **argv)
 	size_t len;
 	int match = -1;
 	fd_set rfds;
+	double tcpi_value[TCPI_METRICS];
+	int tcpi_state[TCPI_METRICS];
+	int have_tcp_info = FALSE;
+	int syn_data = FALSE;
+	int udp_loss = 0;
+	thresholds *tcpi_thresholds;
 
 	FD_ZERO(&rfds);
 
@@ -236,6 +267,7 @@ main (int argc, char **argv)
 	/* try to connect to the host at the given port number */
 	gettimeofday (&tv, NULL);
 
+	tcp_fast_open = fast_open;
 	result = np_net_connect (server_address, server_port, &sd, PROTOCOL);
 	if (result == STATE_CRITICAL) return econn_refuse_state;
 
@@ -253,8 +285,13 @@ main (int argc, char **argv)
 	}
 #endif /* HAVE_SSL */
 
-	if (server_send != NULL) {		/* Something to send? */
-		my_send(server_send, strlen(server_send));
+	if (server_send != NULL && !udp_mode) {		/* Something to send? */
+		/* with TCP Fast Open the handshake only happens on the first write */
+		if (my_send(server_send, strlen(server_send)) < 0 && fast_open) {
+			printf("connect to address %s and port %d: %s\n",
+			       server_address, server_port, strerror(errno));
+			return errno == ECONNREFUSED ? econn_refuse_state : STATE_CRITICAL;
+		}
 	}
 
 	if (delay > 0) {
@@ -276,7 +313,12 @@ main (int argc, char **argv)
 
 	/* if(len) later on, we know we have a non-NULL response */
 	len = 0;
-	if (server_expect_count) {
+	if (udp_mode) {
+		len = udp_exchange (&status, &match);
+		if (udp_received == 0 && len == 0)
+			die (STATE_CRITICAL, _("No data received from host (%d datagrams sent)\n"), udp_sent);
+	}
+	else if (server_expect_count) {
 
 		/* watch for the expect string */
 		while ((i = my_recv(buffer, sizeof(buffer))) > 0) {
@@ -318,6 +360,9 @@ main (int argc, char **argv)
 			status[len] = '\0';
 	}
 
+	if (PROTOCOL == IPPROTO_TCP && server_address[0] != '/')
+		have_tcp_info = get_tcp_info (tcpi_value, &syn_data);
+
 	if (server_quit != NULL) {
 		my_send(server_quit, strlen(server_quit));
 	}
@@ -329,6 +374,10 @@ main (int argc, char **argv)
 	microsec = deltime (tv);
 	elapsed_time = (double)microsec / 1.0e6;
 
+	/* time the answered attempts rather than the wait for them */
+	if (udp_mode && udp_received)
+		elapsed_time = udp_rtt_avg;
+
 	if (flags & FLAG_TIME_CRIT && elapsed_time > critical_time)
 		result = STATE_CRITICAL;
 	else if (flags & FLAG_TIME_WARN && elapsed_time > warning_time)
@@ -338,6 +387,25 @@ main (int argc, char **argv)
 	if(match == NP_MATCH_FAILURE && result != STATE_CRITICAL)
 		result = expect_mismatch_state;
 
+	for (i = 0; i < TCPI_METRICS; i++) {
+		tcpi_state[i] = STATE_OK;
+		if (!have_tcp_info || (tcpi_warn[i] == NULL && tcpi_crit[i] == NULL))
+			continue;
+		set_thresholds (&tcpi_thresholds, tcpi_warn[i], tcpi_crit[i]);
+		tcpi_state[i] = get_status (tcpi_value[i], tcpi_thresholds);
+		free (tcpi_thresholds);
+		result = max_state (result, tcpi_state[i]);
+	}
+
+	if (udp_mode) {
+		udp_loss = udp_sent ? (udp_sent - udp_received) * 100 / udp_sent : 100;
+		if (loss_warn || loss_crit) {
+			set_thresholds (&tcpi_thresholds, loss_warn, loss_crit);
+			result = max_state (result, get_status (udp_loss, tcpi_thresholds));
+			free (tcpi_thresholds);
+		}
+	}
+
 	/* reset the alarm */
 	alarm (0);
 
@@ -364,6 +432,26 @@ main (int argc, char **argv)
 			printf("socket %s", server_address);
 	}
 
+	for (i = 0; i < TCPI_METRICS; i++)
+		if (tcpi_state[i] != STATE_OK)
+			printf(", %s %g%s", tcpi_name[i], tcpi_value[i], tcpi_uom[i]);
+
+	if (udp_mode && udp_probes > 1)
+		printf(", %d%% loss (%d/%d), rtt min/avg/max %.3f/%.3f/%.3f ms",
+		       udp_loss, udp_received, udp_sent,
+		       udp_rtt_min * 1000, udp_rtt_avg * 1000, udp_rtt_max * 1000);
+	else if (udp_mode && udp_sent > 1)
+		printf(", %d attempts", udp_sent);
+
+	if (fast_open) {
+		if (!tcp_fast_open)
+			printf(", %s", _("TCP Fast Open not supported by the kernel"));
+		else if (syn_data)
+			printf(", %s", _("data sent in the SYN (TCP Fast Open)"));
+		else
+			printf(", %s", _("TCP Fast Open not used (no cookie yet or not supported by the server)"));
+	}
+
 	if (match != NP_MATCH_FAILURE && !(flags & FLAG_HIDE_OUTPUT) && len)
 		printf (" [%s]", status);
 
@@ -387,12 +475,238 @@ main (int argc, char **argv)
 				TRUE, socket_timeout)
 			);
 
+	if (have_tcp_info)
+		for (i = 0; i < TCPI_METRICS; i++)
+			printf (" %s", sperfdata (tcpi_name[i], tcpi_value[i], tcpi_uom[i],
+			                          tcpi_warn[i], tcpi_crit[i], TRUE, 0, FALSE, 0));
+	if (fast_open && have_tcp_info)
+		printf (" %s", perfdata ("fastopen", syn_data, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 1));
+	if (udp_mode) {
+		printf (" %s", perfdata ("attempts", udp_sent, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		printf (" %s", sperfdata ("loss", udp_loss, "%", loss_warn, loss_crit, TRUE, 0, TRUE, 100));
+		if (udp_received)
+			printf (" %s %s",
+			        fperfdata ("rtmin", udp_rtt_min, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+			        fperfdata ("rtmax", udp_rtt_max, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+	}
+
 	putchar('\n');
 	return result;
 }
 
 
 
+/* Read the kernel's view of the connection: smoothed RTT and its variance
+ * in milliseconds, retransmitted segments, congestion window in segments and
+ * the send MSS. syn_data tells whether the server acknowledged data carried
+ * in our SYN, i.e. whether TCP Fast Open was used */
+static int
+get_tcp_info (double *value, int *syn_data)
+{
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_TOTAL_RETRANS
+	struct tcp_info info;
+	socklen_t info_len = sizeof (info);
+
+	memset (&info, 0, sizeof (info));
+	if (getsockopt (sd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0) {
+		if (flags & FLAG_VERBOSE)
+			printf ("TCP_INFO: %s\n", strerror (errno));
+		return FALSE;
+	}
+
+	value[TCPI_RTT] = info.tcpi_rtt / 1000.0;
+	value[TCPI_RTTVAR] = info.tcpi_rttvar / 1000.0;
+	value[TCPI_RETRANS] = info.tcpi_total_retrans;
+	value[TCPI_CWND] = info.tcpi_snd_cwnd;
+	value[TCPI_MSS] = info.tcpi_snd_mss;
+#ifdef TCPI_OPT_SYN_DATA
+	*syn_data = (info.tcpi_options & TCPI_OPT_SYN_DATA) ? TRUE : FALSE;
+#endif
+
+	if (flags & FLAG_VERBOSE)
+		printf ("TCP_INFO: rtt %u us, rttvar %u us, retrans %u, cwnd %u, mss %u, options 0x%x\n",
+		        info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_total_retrans,
+		        info.tcpi_snd_cwnd, info.tcpi_snd_mss, info.tcpi_options);
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+
+/* Send one datagram per attempt and collect the replies until every attempt
+ * is answered or the timeout is nearly used up. With --retransmit a single
+ * probe is resent after the given time, doubling it each round, and the
+ * first matching reply ends the exchange. With --probes they are sent
+ * udp_interval apart, and after the last one the replies still missing are
+ * only waited for a few intervals or round trips. A reply is matched to the
+ * attempt whose token it carries. Without --token it goes to the newest
+ * unanswered attempt, so lost probes and retransmit waits do not count
+ * towards the round trip, which is taken from that attempt. Returns the
+ * length of the reply kept for the output, the last matching one if any */
+static size_t
+udp_exchange (char **reply, int *match)
+{
+	struct timeval start, now;
+	long sent_at[UDP_MAX_ATTEMPTS];
+	char *payload[UDP_MAX_ATTEMPTS];
+	char *token[UDP_MAX_ATTEMPTS];
+	int answered[UDP_MAX_ATTEMPTS];
+	int attempts = udp_probes > 1 ? udp_probes : UDP_MAX_ATTEMPTS;
+	long budget = (socket_timeout - (long)delay) * 1000000L - 100000;
+	long limit = budget, grace;
+	long elapsed, next_send = 0, wait = udp_retransmit * 1000L, rtt;
+	double rtt_sum = 0;
+	char *p, *q;
+	fd_set rfds;
+	struct timeval timeout;
+	ssize_t n;
+	size_t len = 0;
+	int i, k, m;
+
+	*match = NP_MATCH_FAILURE;
+	gettimeofday (&start, NULL);
+	memset (answered, 0, sizeof (answered));
+
+	while (1) {
+		gettimeofday (&now, NULL);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000L + now.tv_usec - start.tv_usec;
+
+		if ((udp_probes > 1 && udp_received == udp_probes) ||
+		    (udp_probes == 1 && udp_received) || elapsed >= limit)
+			break;
+
+		/* retransmit only while nothing came back, or send the next probe */
+		if (udp_sent < attempts && elapsed >= next_send &&
+		    (udp_sent == 0 || udp_probes > 1 || wait)) {
+			k = udp_sent++;
+			token[k] = NULL;
+			payload[k] = server_send;
+			if (udp_token) {
+				xasprintf (&token[k], "%x-%d", (unsigned int)getpid (), k + 1);
+				payload[k] = strdup ("");
+				for (p = server_send; (q = strstr (p, udp_token)); p = q + strlen (udp_token))
+					xasprintf (&payload[k], "%s%.*s%s", payload[k], (int)(q - p), p, token[k]);
+				xasprintf (&payload[k], "%s%s", payload[k], p);
+			}
+			if (send (sd, payload[k], strlen (payload[k]), 0) < 0 && flags & FLAG_VERBOSE)
+				printf ("attempt %d: send: %s\n", k + 1, strerror (errno));
+			else if (flags & FLAG_VERBOSE)
+				printf ("attempt %d sent at %.3f ms: %s\n", k + 1, elapsed / 1000.0, payload[k]);
+			sent_at[k] = elapsed;
+			if (udp_probes > 1) {
+				next_send = elapsed + udp_interval * 1000L;
+				/* a lost probe need not hold the check until the timeout */
+				if (udp_sent == attempts) {
+					grace = UDP_GRACE_INTERVALS * udp_interval * 1000L;
+					if (udp_received && UDP_GRACE_RTTS * udp_rtt_max * 1.0e6 > grace)
+						grace = UDP_GRACE_RTTS * udp_rtt_max * 1.0e6;
+					if (elapsed + grace < limit)
+						limit = elapsed + grace;
+				}
+			}
+			else {
+				next_send = elapsed + wait;
+				wait *= 2;
+			}
+		}
+
+		/* sleep until a reply arrives, the next send is due or time is up */
+		n = limit - elapsed;
+		if (udp_sent < attempts && (udp_probes > 1 || wait) && next_send - elapsed < n)
+			n = next_send - elapsed;
+		if (n < 0)
+			n = 0;
+		timeout.tv_sec = n / 1000000;
+		timeout.tv_usec = n % 1000000;
+		FD_ZERO (&rfds);
+		FD_SET (sd, &rfds);
+		if (select (sd + 1, &rfds, NULL, NULL, &timeout) <= 0)
+			continue;
+
+		/* a port unreachable shows up as ECONNREFUSED on the connected socket */
+		if ((n = recv (sd, buffer, sizeof (buffer) - 1, 0)) < 0) {
+			if (flags & FLAG_VERBOSE)
+				printf ("recv: %s\n", strerror (errno));
+			continue;
+		}
+		buffer[n] = '\0';
+		gettimeofday (&now, NULL);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000L + now.tv_usec - start.tv_usec;
+
+		/* without tokens, the newest attempt still open, so a lost one
+		 * does not add its wait to the round trip */
+		for (k = -1, i = udp_sent - 1; i >= 0 && k < 0; i--)
+			if (!answered[i] && (!udp_token || strstr (buffer, token[i])))
+				k = i;
+		if (k < 0) {
+			if (flags & FLAG_VERBOSE)
+				printf ("ignoring %d bytes not matching an open attempt\n", (int)n);
+			continue;
+		}
+
+		m = np_expect_match (buffer, server_expect, server_expect_count, match_flags);
+		if (flags & FLAG_VERBOSE)
+			printf ("reply to attempt %d after %.3f ms (%s):\n%s\n", k + 1,
+			        (elapsed - sent_at[k]) / 1000.0,
+			        m == NP_MATCH_SUCCESS ? "match" : "no match", buffer);
+		if (m != NP_MATCH_SUCCESS && *match == NP_MATCH_SUCCESS)
+			continue;
+
+		free (*reply);
+		*reply = strndup (buffer, n);
+		len = n;
+		if (m != NP_MATCH_SUCCESS)
+			continue;
+
+		*match = NP_MATCH_SUCCESS;
+		answered[k] = TRUE;
+		rtt = elapsed - sent_at[k];
+		if (!udp_received || rtt < udp_rtt_min * 1.0e6)
+			udp_rtt_min = rtt / 1.0e6;
+		if (rtt > udp_rtt_max * 1.0e6)
+			udp_rtt_max = rtt / 1.0e6;
+		rtt_sum += rtt / 1.0e6;
+		udp_received++;
+	}
+
+	if (udp_received)
+		udp_rtt_avg = rtt_sum / udp_received;
+	for (i = 0; i < udp_sent; i++) {
+		if (udp_token) {
+			free (payload[i]);
+			free (token[i]);
+		}
+	}
+
+	/* strip whitespace from end of output */
+	while (len > 0 && isspace ((*reply)[len - 1]))
+		(*reply)[--len] = '\0';
+	return len;
+}
+
+
+/* Parse METRIC,WARN[,CRIT] for --tcp-threshold, e.g. rtt,50,200 */
+static void
+set_tcp_threshold (const char *arg)
+{
+	char *ranges = strdup (arg);
+	char *label = strsep (&ranges, ",");
+	int i;
+
+	for (i = 0; i < TCPI_METRICS; i++) {
+		if (ranges && !strcmp (label, tcpi_name[i])) {
+			label = strsep (&ranges, ",");
+			tcpi_warn[i] = *label ? label : NULL;
+			tcpi_crit[i] = ranges && *ranges ? ranges : NULL;
+			return;
+		}
+	}
+
+	usage2 (_("Invalid TCP threshold, expected METRIC,WARN[,CRIT] such as rtt,50,200"), arg);
+}
+
+
 /* process command-line arguments */
 static int
 process_arguments (int argc, char **argv)
@@ -401,6 +715,16 @@ process_arguments (int argc, char **argv)
 	int escape = 0;
 	char *temp;
 
+	enum {
+		TCP_THRESHOLD_OPTION = CHAR_MAX + 1,
+		FAST_OPEN_OPTION,
+		RETRANSMIT_OPTION,
+		PROBES_OPTION,
+		PROBE_INTERVAL_OPTION,
+		TOKEN_OPTION,
+		LOSS_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
@@ -428,6 +752,13 @@ process_arguments (int argc, char **argv)
 		{"help", no_argument, 0, 'h'},
 		{"ssl", no_argument, 0, 'S'},
 		{"certificate", required_argument, 0, 'D'},
+		{"tcp-threshold", required_argument, 0, TCP_THRESHOLD_OPTION},
+		{"fast-open", no_argument, 0, FAST_OPEN_OPTION},
+		{"retransmit", required_argument, 0, RETRANSMIT_OPTION},
+		{"probes", required_argument, 0, PROBES_OPTION},
+		{"probe-interval", required_argument, 0, PROBE_INTERVAL_OPTION},
+		{"token", required_argument, 0, TOKEN_OPTION},
+		{"loss", required_argument, 0, LOSS_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -607,6 +938,51 @@ process_arguments (int argc, char **argv)
 		case 'A':
 			match_flags |= NP_MATCH_ALL;
 			break;
+		case TCP_THRESHOLD_OPTION:
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_TOTAL_RETRANS
+			set_tcp_threshold (optarg);
+#else
+			usage4 (_("TCP_INFO support not available"));
+#endif
+			break;
+		case FAST_OPEN_OPTION:
+#ifdef TCP_FASTOPEN_CONNECT
+			fast_open = TRUE;
+#else
+			usage4 (_("TCP Fast Open support not available"));
+#endif
+			break;
+		case RETRANSMIT_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Retransmit time must be a positive number of milliseconds"), optarg);
+			udp_retransmit = atoi (optarg);
+			udp_mode = TRUE;
+			break;
+		case PROBES_OPTION:
+			if (!is_intpos (optarg) || atoi (optarg) > UDP_MAX_ATTEMPTS)
+				usage2 (_("Number of probes must be between 1 and 100"), optarg);
+			udp_probes = atoi (optarg);
+			udp_mode = TRUE;
+			break;
+		case PROBE_INTERVAL_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Probe interval must be a positive number of milliseconds"), optarg);
+			udp_interval = atoi (optarg);
+			break;
+		case TOKEN_OPTION:
+			udp_token = optarg;
+			udp_mode = TRUE;
+			break;
+		case LOSS_OPTION:
+			loss_warn = strdup (optarg);
+			if ((temp = strchr (loss_warn, ','))) {
+				*temp++ = '\0';
+				loss_crit = *temp ? temp : NULL;
+			}
+			if (!*loss_warn)
+				loss_warn = NULL;
+			udp_mode = TRUE;
+			break;
 		}
 	}
 
@@ -616,6 +992,16 @@ process_arguments (int argc, char **argv)
 
 	if (server_address == NULL)
 		usage4 (_("You must provide a server address"));
+	else if (fast_open && (PROTOCOL != IPPROTO_TCP || server_address[0] == '/'))
+		usage4 (_("TCP Fast Open needs a TCP connection"));
+	else if (fast_open && server_send == NULL && !(flags & FLAG_SSL))
+		usage4 (_("TCP Fast Open needs a send string (-s) to put in the SYN"));
+	else if (udp_mode && PROTOCOL != IPPROTO_UDP)
+		usage4 (_("Retransmits, probes, tokens and loss thresholds are only available for UDP checks"));
+	else if (udp_retransmit && udp_probes > 1)
+		usage4 (_("Use either --retransmit or --probes"));
+	else if (udp_token && (server_send == NULL || !strstr (server_send, udp_token)))
+		usage2 (_("The token does not occur in the send string"), udp_token);
 	else if (server_address[0] != '/' && is_host (server_address) == FALSE)
 		die (STATE_CRITICAL, "%s %s - %s: %s\n", SERVICE, state_text(STATE_CRITICAL), _("Invalid hostname, address or socket"), server_address);
 
@@ -675,6 +1061,38 @@ print_help (void)
 
 	printf (UT_WARN_CRIT);
 
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_TOTAL_RETRANS
+	printf (" %s\n", "--tcp-threshold=METRIC,WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds on the kernel's TCP_INFO for the connection, read after the exchange."));
+  printf ("    %s\n", _("METRIC is rtt or rttvar (milliseconds), retrans (segments), cwnd (segments)"));
+  printf ("    %s\n", _("or mss (bytes), e.g. rtt,50,200 or mss,1400:. May be repeated."));
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+	printf (" %s\n", "--fast-open");
+  printf ("    %s\n", _("Send the send string (or the TLS ClientHello) in the SYN with TCP Fast Open"));
+  printf ("    %s\n", _("and report whether the server accepted it. The first connection to a server"));
+  printf ("    %s\n", _("only fetches its cookie."));
+#endif
+
+	if (PROTOCOL == IPPROTO_UDP) {
+		printf (" %s\n", "--retransmit=MSEC");
+  printf ("    %s\n", _("Resend the datagram if no reply came after MSEC, doubling the wait each"));
+  printf ("    %s\n", _("time, until the timeout. The response time is counted from the attempt the"));
+  printf ("    %s\n", _("reply echoes the token of, or without --token from the latest attempt."));
+		printf (" %s\n", "--probes=INTEGER");
+  printf ("    %s\n", _("Send this many datagrams and report loss and min/avg/max round trip time."));
+  printf ("    %s\n", _("-w and -c then apply to the average round trip time. After the last probe"));
+  printf ("    %s\n", _("missing replies are waited for 3 intervals or 4 times the largest round trip."));
+		printf (" %s\n", "--probe-interval=MSEC");
+  printf ("    %s\n", _("Time between probes (default: 200)"));
+		printf (" %s\n", "--token=STRING");
+  printf ("    %s\n", _("Replace STRING in the send string with a token unique to each attempt and"));
+  printf ("    %s\n", _("match replies to attempts by the token they echo. Without it a reply is"));
+  printf ("    %s\n", _("timed from the latest attempt not yet answered."));
+		printf (" %s\n", "--loss=WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds on the percentage of unanswered attempts, e.g. 20,50"));
+	}
+
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
 	printf (UT_VERBOSE);
@@ -691,4 +1109,7 @@ print_usage (void)
   printf ("[-e <expect string>] [-q <quit string>][-m <maximum bytes>] [-d <delay>]\n");
   printf ("[-t <timeout seconds>] [-r <refuse state>] [-M <mismatch state>] [-v] [-4|-6] [-j]\n");
   printf ("[-D <warn days cert expire>[,<crit days cert expire>]] [-S <use SSL>] [-E]\n");
+  printf ("[--tcp-threshold <metric>,<warn>[,<crit>]] [--fast-open]\n");
+  printf ("[--retransmit <msec> | --probes <count> [--probe-interval <msec>]]\n");
+  printf ("[--token <string>] [--loss <warn>[,<crit>]]\n");
 }
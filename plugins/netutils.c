@@ -29,12 +29,14 @@
 
 #include "common.h"
 #include "netutils.h"
+#include <netinet/tcp.h>
 
 unsigned int socket_timeout = DEFAULT_SOCKET_TIMEOUT;
 unsigned int socket_timeout_state = STATE_CRITICAL;
 
 int econn_refuse_state = STATE_CRITICAL;
 int was_refused = FALSE;
+int tcp_fast_open = FALSE;
 #if USE_IPV6
 int address_family = AF_UNSPEC;
 #else
@@ -171,6 +173,9 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 	char port_str[6], host[MAX_HOST_ADDRESS_LENGTH];
 	size_t len;
 	int socktype, result;
+#ifdef TCP_FASTOPEN_CONNECT
+	int one = 1;
+#endif
 	short is_socket = (host_name[0] == '/');
 
 	socktype = (proto == IPPROTO_UDP) ? SOCK_DGRAM : SOCK_STREAM;
@@ -211,6 +216,14 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 				return STATE_UNKNOWN;
 			}
 
+#ifdef TCP_FASTOPEN_CONNECT
+			/* the first write goes out in the SYN once the kernel holds a
+			   cookie for the server, otherwise it asks for one */
+			if (tcp_fast_open && proto == IPPROTO_TCP &&
+			    setsockopt (*sd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof (one)) < 0)
+				tcp_fast_open = FALSE;
+#endif
+
 			/* attempt to open a connection */
 			result = connect (*sd, r->ai_addr, r->ai_addrlen);
 
@@ -90,6 +90,7 @@ extern unsigned int socket_timeout;
 extern unsigned int socket_timeout_state;
 extern int econn_refuse_state;
 extern int was_refused;
+extern int tcp_fast_open;
 extern int address_family;
 
 RETSIGTYPE socket_timeout_alarm_handler (int) __attribute__((noreturn));
@@ -112,6 +113,10 @@ int np_net_ssl_init_with_hostname(int sd, char *host_name);
 int np_net_ssl_init_with_hostname_and_version(int sd, char *host_name, int version);
 int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey);
 void np_net_ssl_cleanup();
+void np_net_ssl_set_alpn(const unsigned char *protos, unsigned int len);
+const char *np_net_ssl_get_alpn();
+void np_net_ssl_set_ktls(int enable);
+const char *np_net_ssl_get_ktls();
 int np_net_ssl_write(const void *buf, int num);
 int np_net_ssl_read(void *buf, int num);
 int np_net_ssl_check_cert(int days_till_exp_warn, int days_till_exp_crit);
@@ -34,6 +34,35 @@
 static SSL_CTX *c=NULL;
 static SSL *s=NULL;
 static int initialized=0;
+static const unsigned char *alpn_protos=NULL;
+static unsigned int alpn_protos_len=0;
+static int use_ktls=0;
+
+#if defined(USE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x10002000L
+#  define HAVE_ALPN 1
+#endif
+
+#if defined(USE_OPENSSL) && defined(SSL_OP_ENABLE_KTLS)
+#  define HAVE_KTLS 1
+#endif
+
+#ifdef HAVE_KTLS
+/* The kernel lists the tls upper layer protocol once the module is loaded */
+static int ktls_available() {
+	char ulp[256], *name, *saveptr;
+	FILE *fp;
+	int found=0;
+
+	if ((fp=fopen("/proc/sys/net/ipv4/tcp_available_ulp", "r")) == NULL)
+		return 0;
+	if (fgets(ulp, sizeof(ulp), fp) != NULL) {
+		for (name=strtok_r(ulp, " \n", &saveptr); name && !found; name=strtok_r(NULL, " \n", &saveptr))
+			found=!strcmp(name, "tls");
+	}
+	fclose(fp);
+	return found;
+}
+#endif
 
 int np_net_ssl_init(int sd) {
 	return np_net_ssl_init_with_hostname(sd, NULL);
@@ -145,6 +174,12 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 	}
 #ifdef SSL_OP_NO_TICKET
 	options |= SSL_OP_NO_TICKET;
+#endif
+#ifdef HAVE_KTLS
+	/* when asked for, let the kernel do the record crypto once the handshake
+	 * is done, so SSL_read() and SSL_write() become plain socket calls */
+	if (use_ktls && ktls_available())
+		options |= SSL_OP_ENABLE_KTLS;
 #endif
 	SSL_CTX_set_options(c, options);
 	SSL_CTX_set_mode(c, SSL_MODE_AUTO_RETRY);
@@ -152,6 +187,10 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #ifdef SSL_set_tlsext_host_name
 		if (host_name != NULL)
 			SSL_set_tlsext_host_name(s, host_name);
+#endif
+#ifdef HAVE_ALPN
+		if (alpn_protos != NULL)
+			SSL_set_alpn_protos(s, alpn_protos, alpn_protos_len);
 #endif
 		SSL_set_fd(s, sd);
 		if (SSL_connect(s) == 1) {
@@ -183,6 +222,52 @@ void np_net_ssl_cleanup() {
 	}
 }
 
+/* Offer the protocols in protos (ALPN wire format) on the next connection */
+void np_net_ssl_set_alpn(const unsigned char *protos, unsigned int len) {
+	alpn_protos=protos;
+	alpn_protos_len=len;
+}
+
+/* Ask for kTLS on the next connection if the kernel offers the tls ULP */
+void np_net_ssl_set_ktls(int enable) {
+	use_ktls=enable;
+}
+
+/* Returns the protocol selected by the server through ALPN, or NULL */
+const char *np_net_ssl_get_alpn() {
+#ifdef HAVE_ALPN
+	static char proto[256];
+	const unsigned char *data=NULL;
+	unsigned int len=0;
+
+	if (s != NULL)
+		SSL_get0_alpn_selected(s, &data, &len);
+	if (len > 0) {
+		memcpy(proto, data, len);
+		proto[len]='\0';
+		return proto;
+	}
+#endif
+	return NULL;
+}
+
+/* Returns which directions the kernel handles through kTLS, or NULL if none */
+const char *np_net_ssl_get_ktls() {
+#ifdef HAVE_KTLS
+	int send=0, recv=0;
+
+	if (s != NULL) {
+		send=BIO_get_ktls_send(SSL_get_wbio(s));
+		recv=BIO_get_ktls_recv(SSL_get_rbio(s));
+	}
+	if (send && recv)
+		return "send and receive";
+	if (send || recv)
+		return send ? "send" : "receive";
+#endif
+	return NULL;
+}
+
 int np_net_ssl_write(const void *buf, int num) {
 	return SSL_write(s, buf, num);
 }
@@ -10,6 +10,7 @@ use strict;
 use Test::More;
 use NPTest;
 use POSIX qw(ceil floor);
+use File::Temp qw(tempdir);
 
 my $successOutput = '/^DISK OK/';
 my $failureOutput = '/^DISK CRITICAL/';
@@ -23,7 +24,7 @@ my $mountpoint2_valid = getTestParameter( "NP_MOUNTPOINT2_VALID", "Path to anoth
 if ($mountpoint_valid eq "" or $mountpoint2_valid eq "") {
 	plan skip_all => "Need 2 mountpoints to test";
 } else {
-	plan tests => 78;
+	plan tests => 85;
 }
 
 $result = NPTest->testCmd( 
@@ -350,3 +351,35 @@ unlike( $result->output, qr/$mountpoint2_valid/, "output data does not have $mou
 $result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid -p $mountpoint2_valid -i '^barbazJodsf\$'");
 like( $result->output, qr/$mountpoint_valid/, "ignore: output data does have $mountpoint_valid when regex doesn't match");
 like( $result->output, qr/$mountpoint2_valid/,"ignore: output data does have $mountpoint2_valid when regex doesn't match");
+
+# directory usage mode
+my $du_dir = tempdir( CLEANUP => 1 );
+$ENV{MP_STATE_PATH} = "$du_dir/state";
+mkdir "$du_dir/tree";
+mkdir "$du_dir/tree/$_" for qw(small large large/deep);
+for my $file (["small/f", 4096], ["large/deep/f", 409600]) {
+	open(my $fh, ">", "$du_dir/tree/$file->[0]") or die "Cannot create $file->[0]: $!";
+	print $fh "x" x $file->[1];
+	close($fh);
+}
+link "$du_dir/tree/large/deep/f", "$du_dir/tree/large/link";
+
+$result = NPTest->testCmd( "./check_disk --du -u kB -p $du_dir/tree" );
+cmp_ok( $result->return_code, '==', 0, "du: measures without thresholds");
+like( $result->output, qr{$du_dir/tree \d+ kB \(\d+%\) 6 inodes;}, "du: hard link counted once");
+
+$result = NPTest->testCmd( "./check_disk --du -u kB -w 100 -p $du_dir/tree" );
+cmp_ok( $result->return_code, '==', 1, "du: used space over warning");
+
+$result = NPTest->testCmd( "./check_disk --du -W 4 -K 5 -p $du_dir/tree" );
+cmp_ok( $result->return_code, '==', 2, "du: inode count over critical");
+
+$result = NPTest->testCmd( "./check_disk --du -u kB -c 100 --du-top 1 --du-threads 2 -p $du_dir/tree" );
+like( $result->output, qr{ \[large \d+ kB CRITICAL\];}, "du: largest subdirectory listed and checked");
+
+$result = NPTest->testCmd( "./check_disk -w 10 --du -p $du_dir/tree" );
+cmp_ok( $result->return_code, '==', 3, "du: must precede thresholds");
+
+NPTest->testCmd( "./check_disk --du --du-cache 600 -p $du_dir/tree" );
+$result = NPTest->testCmd( "./check_disk --du --du-cache 600 -p $du_dir/tree" );
+like( $result->output, qr{ 6 inodes;}, "du: same result with the cache");
@@ -0,0 +1,83 @@
+#! /usr/bin/perl -w -I ..
+#
+# File age, size and count tests via check_files
+#
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+plan tests => 20;
+
+my $dir = tempdir( CLEANUP => 1 );
+my $now = time;
+
+sub make_file {
+	my ($name, $size, $age) = @_;
+	open(my $fh, ">", "$dir/$name") or die "Cannot create $dir/$name: $!";
+	print $fh "x" x $size;
+	close($fh);
+	utime($now - $age, $now - $age, "$dir/$name");
+}
+
+mkdir "$dir/spool";
+mkdir "$dir/spool/a";
+mkdir "$dir/spool/a/b";
+mkdir "$dir/spool/.hidden";
+mkdir "$dir/spool/dir.msg";
+make_file("heartbeat", 2, 10);
+make_file("spool/1.msg", 10, 600);
+make_file("spool/a/2.msg", 20, 60);
+make_file("spool/a/b/3.msg", 30, 5);
+make_file("spool/a/b/4.txt", 40, 5000);
+make_file("spool/.hidden/5.msg", 50, 9000);
+
+my $res;
+
+$res = NPTest->testCmd("./check_files");
+is( $res->return_code, 3, "No args" );
+
+$res = NPTest->testCmd("./check_files -w 60 -c 120 -f $dir/heartbeat");
+is( $res->return_code, 0, "Fresh file" );
+like( $res->output, "/^FILES OK - $dir\\/heartbeat: 1 files, .*\\|count=1;;;0 oldest=1[0-9]s;60;120; newest=1[0-9]s;;; size=2B;;;0/", "Output and perfdata for one file" );
+
+$res = NPTest->testCmd("./check_files -w 5 -c 120 $dir/heartbeat");
+is( $res->return_code, 1, "Age warning, file given without -f" );
+
+$res = NPTest->testCmd("./check_files -f $dir/nothere");
+is( $res->return_code, 2, "Missing file is critical" );
+like( $res->output, "/File not found/", "Says not found" );
+
+$res = NPTest->testCmd("./check_files -i -f $dir/nothere");
+is( $res->return_code, 0, "Missing file ignored with -i" );
+
+$res = NPTest->testCmd("./check_files -f '$dir/spool/*.msg'");
+is( $res->return_code, 0, "Glob" );
+like( $res->output, "/: 1 files, oldest $dir\\/spool\\/1.msg/", "Glob skips directories and hidden files" );
+
+$res = NPTest->testCmd("./check_files -f '$dir/spool/**/*.msg'");
+is( $res->return_code, 0, "Recursive pattern" );
+like( $res->output, "/: 3 files, oldest $dir\\/spool\\/1.msg \\(6[0-9][0-9]s\\), newest $dir\\/spool\\/a\\/b\\/3.msg/", "Oldest and newest over the tree" );
+like( $res->output, "/size=60B/", "Sizes summed" );
+
+$res = NPTest->testCmd("./check_files -f '$dir/spool/**'");
+like( $res->output, "/: 4 files/", "Trailing ** matches every file below" );
+
+$res = NPTest->testCmd("./check_files -c 300 -f '$dir/spool/**/*.msg'");
+is( $res->return_code, 2, "Critical age" );
+like( $res->output, "/CRITICAL: $dir\\/spool\\/1.msg is 6[0-9][0-9] seconds old and 10 bytes/", "Names the offending file" );
+
+$res = NPTest->testCmd("./check_files -W 25: -f '$dir/spool/**/*.msg'");
+is( $res->return_code, 1, "Size range" );
+
+$res = NPTest->testCmd("./check_files --warning-count 1:2 -f '$dir/spool/**/*.msg'");
+is( $res->return_code, 1, "Count range" );
+
+$res = NPTest->testCmd("./check_files --critical-count 1: -f '$dir/spool/*.none'");
+is( $res->return_code, 2, "No match below count range" );
+
+$res = NPTest->testCmd("./check_files -c 120 -f $dir/heartbeat -c 9000 -f '$dir/spool/**/*.msg'");
+is( $res->return_code, 0, "Thresholds apply to the patterns that follow" );
+like( $res->output, "/^FILES OK - 4 files in 2 groups, .*'$dir\\/heartbeat count'=1;;;0 .*'$dir\\/spool\\/\\*\\*\\/\\*.msg oldest'=6[0-9][0-9]s;;9000;/", "Per group perfdata" );
@@ -0,0 +1,73 @@
+#! /usr/bin/perl -w -I ..
+#
+# Log file pattern tests via check_logfile
+#
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+plan tests => 18;
+
+my $dir = tempdir( CLEANUP => 1 );
+$ENV{MP_STATE_PATH} = "$dir/state";
+my $log = "$dir/app.log";
+
+sub append {
+	my ($file, $text) = @_;
+	open(my $fh, ">>", $file) or die "Cannot open $file: $!";
+	print $fh $text;
+	close($fh);
+}
+
+my $res;
+my $args = "-F $log -e ERROR -e 'disk full' -i";
+
+$res = NPTest->testCmd("./check_logfile -F $log");
+is( $res->return_code, 3, "Pattern required" );
+
+$res = NPTest->testCmd("./check_logfile $args");
+is( $res->return_code, 3, "Missing log file is unknown" );
+
+append($log, "old error\nboot\n");
+$res = NPTest->testCmd("./check_logfile $args");
+is( $res->return_code, 0, "First run initializes" );
+like( $res->output, "/initialized at offset 15/", "Starts at the end of the file" );
+
+append($log, "x ERROR y\nfine\nDisk Full and error\npartial");
+$res = NPTest->testCmd("./check_logfile $args");
+is( $res->return_code, 2, "New matches are critical by default" );
+like( $res->output, "/^LOG CRITICAL - 2 of 3 new lines matched, last: Disk Full and error\\|matches=2;;0;0 ERROR=2;;;0 'disk full'=1;;;0 lines=3;;;0/", "Counts per pattern, incomplete line left for later" );
+
+append($log, " line\n");
+$res = NPTest->testCmd("./check_logfile $args -w 0 -c 5 -v");
+is( $res->return_code, 0, "Completed line without match" );
+like( $res->output, "/offset 50/", "Position kept when thresholds change" );
+like( $res->output, "/0 of 1 new lines matched/", "Partial line read once complete" );
+
+$res = NPTest->testCmd("./check_logfile $args -w 0");
+is( $res->return_code, 0, "Nothing new" );
+like( $res->output, "/0 of 0 new lines matched/", "No lines read" );
+
+append($log, "late error\n");
+rename($log, "$log.1");
+append($log, "new ERROR\nok\n");
+$res = NPTest->testCmd("./check_logfile $args -w 0");
+is( $res->return_code, 1, "Warning threshold" );
+like( $res->output, "/2 of 3 new lines matched \\(log rotated\\), last: new ERROR/", "Rotated log finished before the new one" );
+
+open(my $fh, ">", $log);
+close($fh);
+append($log, "truncated and rewritten with an error\n");
+$res = NPTest->testCmd("./check_logfile $args");
+is( $res->return_code, 2, "Rewritten log is read again" );
+like( $res->output, "/1 of 1 new lines matched \\(log truncated\\)/", "Truncation detected" );
+
+$res = NPTest->testCmd("./check_logfile -F $log -e ERROR");
+is( $res->return_code, 0, "Other pattern list has its own position" );
+like( $res->output, "/initialized/", "New position initialized" );
+
+$res = NPTest->testCmd("./check_logfile -F $log -e x -e x");
+is( $res->return_code, 3, "Duplicate patterns rejected" );
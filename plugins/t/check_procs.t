@@ -13,7 +13,7 @@ my $t;
 if (`uname -s` eq "SunOS\n" && ! -x "/usr/local/nagios/libexec/pst3") {
 	plan skip_all => "Ignoring tests on solaris because of pst3";
 } else {
-	plan tests => 14;
+	plan tests => 20;
 }
 
 my $result;
@@ -31,6 +31,36 @@ $result = NPTest->testCmd( "./check_procs -a 'sleep 7'" );
 is( $result->return_code, 0, "Parent process is ignored" );
 like( $result->output, '/^PROCS OK: 1 process?/', "Output correct" );
 
+# our own cgroup, if this host has any
+my $cgroup;
+if (open(my $fh, "<", "/proc/self/cgroup")) {
+	while (<$fh>) {
+		my (undef, $controllers, $path) = /^(\d+):([^:]*):(.*)$/ or next;
+		for my $dir ("/sys/fs/cgroup$path", "/sys/fs/cgroup/$controllers$path", "/sys/fs/cgroup/unified$path") {
+			$dir =~ s,/+$,,;
+			if (-r "$dir/cgroup.procs") { $cgroup = $dir; last; }
+		}
+		last if $cgroup;
+	}
+	close($fh);
+}
+
+SKIP: {
+	skip "No cgroup to test with", 4 unless $cgroup;
+
+	$result = NPTest->testCmd( "./check_procs --cgroup=$cgroup -a 'sleep 7'" );
+	is( $result->return_code, 0, "Process found in its cgroup" );
+	like( $result->output, '/^PROCS OK: 1 process with args \'sleep 7\', cgroup /', "Output correct" );
+
+	$result = NPTest->testCmd( "./check_procs --cgroup=$cgroup -w 100000 -c 100000" );
+	is( $result->return_code, 0, "Members of the cgroup" );
+	like( $result->output, '/^PROCS OK: [1-9][0-9]* process(es)? with cgroup /', "Output correct" );
+}
+
+$result = NPTest->testCmd( "./check_procs --unit=no-such-unit-here" );
+is( $result->return_code, 3, "Unknown unit" );
+like( $result->output, "/^PROCS UNKNOWN: Could not find unit 'no-such-unit-here.service'/", "Output correct" );
+
 $result = NPTest->testCmd( "./check_procs -w 0 -c 100000" );
 is( $result->return_code, 1, "Checking warning if processes > 0" );
 like( $result->output, '/^PROCS WARNING: [0-9]+ process(es)? | procs=[0-9]+;0;100000;0;$/', "Output correct" );
@@ -12,7 +12,7 @@ my $res;
 
 alarm(120); # make sure tests don't hang
 
-plan tests => 14;
+plan tests => 18;
 
 $res = NPTest->testCmd( "./check_udp -H localhost -p 3333" );
 cmp_ok( $res->return_code, '==', 3, "Need send/expect string");
@@ -30,6 +30,14 @@ $res = NPTest->testCmd( "./check_udp -H localhost -p 3333 -s foo -e bar" );
 cmp_ok( $res->return_code, '==', 2, "Errors correctly because no udp service running" );
 like  ( $res->output, '/No data received from host/', "Output OK");
 
+$res = NPTest->testCmd( "./check_udp -H localhost -p 3333 -s foo -e bar --probes 3 --probe-interval 100 -t 2" );
+cmp_ok( $res->return_code, '==', 2, "All probes lost" );
+like  ( $res->output, '/No data received from host \(3 datagrams sent\)/', "Output OK");
+
+$res = NPTest->testCmd( "./check_udp -H localhost -p 3333 -s foo -e bar --token TOKEN" );
+cmp_ok( $res->return_code, '==', 3, "Token must be in the send string" );
+like  ( $res->output, '/The token does not occur in the send string/', "Output OK");
+
 my $nc;
 if(system("which nc.traditional >/dev/null 2>&1") == 0) {
 	$nc = 'nc.traditional -w 3 -l -u -p 3333';
@@ -16,12 +16,17 @@ use strict;
 use Test::More;
 use NPTest;
 use FindBin qw($Bin);
+use File::Temp qw(tempdir);
 
 $ENV{'LC_TIME'} = "C";
 
-my $common_tests = 70;
+my $common_tests = 72;
 my $virtual_port_tests = 8;
 my $ssl_only_tests = 8;
+my $conditional_tests = 10;
+my $range_tests = 8;
+my $sample_tests = 4;
+my $http2_tests = 2;
 # Check that all dependent modules are available
 eval "use HTTP::Daemon 6.01;";
 plan skip_all => 'HTTP::Daemon >= 6.01 required' if $@;
@@ -34,7 +39,7 @@ if ($@) {
 	plan skip_all => "Missing required module for test: $@";
 } else {
 	if (-x "./check_http") {
-		plan tests => $common_tests * 2 + $ssl_only_tests + $virtual_port_tests;
+		plan tests => $common_tests * 2 + $ssl_only_tests + $virtual_port_tests + $conditional_tests + $range_tests + $sample_tests + $http2_tests;
 	} else {
 		plan skip_all => "No check_http compiled";
 	}
@@ -142,6 +147,10 @@ sub run_server {
 				$c->send_response($r->method.":".$r->content);
 			} elsif ($r->url->path eq "/redirect") {
 				$c->send_redirect( "/redirect2" );
+			} elsif ($r->url->path eq "/redirect_folded") {
+				$c->send_basic_header(302);
+				print $c "Location:\r\n  /redirect2\r\n";
+				$c->send_crlf;
 			} elsif ($r->url->path eq "/redir_external") {
 				$c->send_redirect(($d->isa('HTTP::Daemon::SSL') ? "https" : "http") . "://169.254.169.254/redirect2" );
 			} elsif ($r->url->path eq "/redirect2") {
@@ -159,6 +168,31 @@ sub run_server {
 				$c->send_basic_header;
 				$c->send_header('foo');
 				$c->send_crlf;
+			} elsif ($r->url->path eq "/conditional_long") {
+				my $etag = '"' . ('e' x 2000) . '"';
+				if (($r->header('If-None-Match') || '') eq $etag) {
+					$c->send_basic_header(304);
+					$c->send_crlf;
+				} else {
+					$c->send_response(HTTP::Response->new( 200, 'OK', [ 'ETag' => $etag ], 'long validator' ));
+				}
+			} elsif ($r->url->path eq "/conditional") {
+				if (($r->header('If-None-Match') || '') eq '"v1"') {
+					$c->send_basic_header(304);
+					$c->send_crlf;
+				} else {
+					$c->send_response(HTTP::Response->new( 200, 'OK', [ 'ETag' => '"v1"' ], 'unchanged document' ));
+				}
+			} elsif ($r->url->path eq "/range") {
+				if (($r->header('Range') || '') eq 'bytes=0-9') {
+					$c->send_response(HTTP::Response->new( 206, 'Partial Content', [ 'Content-Range' => 'bytes 0-9/1000000' ], 'range body' ));
+				} else {
+					$c->send_response(HTTP::Response->new( 200, 'OK', undef, 'x' x 1000000 ));
+				}
+			} elsif ($r->url->path eq "/range_chunked") {
+				$c->send_basic_header(206);
+				print $c "Content-Range: bytes 0-9/1000\r\nTransfer-Encoding: chunked\r\n\r\n";
+				print $c "5\r\nrange\r\n5\r\n body\r\n0\r\n\r\n";
 			} elsif ($r->url->path eq "/virtual_port") {
 				# return sent Host header
 				$c->send_basic_header;
@@ -243,6 +277,72 @@ SKIP: {
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
 }
 
+# conditional requests reuse the stored verdict on 304
+# a state directory of our own, the real one is left alone
+$ENV{'MP_STATE_PATH'} = tempdir( CLEANUP => 1 );
+$cmd = "$command -p $port_http -u /conditional --conditional -s missing";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 2, $cmd);
+like( $result->output, qr%^HTTP CRITICAL: HTTP/1\.1 200 OK - string 'missing' not found%, "Output correct: ".$result->output );
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 2, "Stored verdict reused");
+like( $result->output, qr%^HTTP CRITICAL: HTTP/1\.1 304 Not Modified \(unchanged\) - string 'missing' not found%, "Output correct: ".$result->output );
+
+# validators longer than a line of old state files are kept in full
+$cmd = "$command -p $port_http -u /conditional_long --conditional";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 0, $cmd);
+like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK/', "Output correct: ".$result->output );
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 0, $cmd);
+like( $result->output, '/^HTTP OK: HTTP/1.1 304 Not Modified \(unchanged\)/', "Long ETag revalidated: ".$result->output );
+
+$result = NPTest->testCmd( "$command -p $port_http -u /conditional --conditional -P data" );
+is( $result->return_code, 3, "Conditional requests need GET or HEAD");
+like( $result->output, '/only supported with the GET and HEAD methods/', "Output correct: ".$result->output );
+
+# byte range requests only transfer the requested part
+$cmd = "$command -p $port_http -u /range --range=0-9 -s 'range body' -m 500000:2000000";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 0, $cmd);
+like( $result->output, '/^HTTP OK: HTTP/1.1 206 Partial Content - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
+
+$cmd = "$command -p $port_http -u /range --range=0-99";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 1, $cmd);
+like( $result->output, '/server ignored the range request/', "Output correct: ".$result->output );
+
+# an open ended range would fetch the rest of the object
+$cmd = "$command -p $port_http -u /range --range=500-";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 3, $cmd);
+like( $result->output, '/The byte range needs a last byte/', "Output correct: ".$result->output );
+
+# the chunk framing does not count towards the range
+$cmd = "$command -p $port_http -u /range_chunked --range=0-9";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 0, $cmd);
+like( $result->output, '/^HTTP OK: HTTP/1.1 206 Partial Content/', "Output correct: ".$result->output );
+
+# latency sampling, the test server closes the connection after each request
+$cmd = "$command -p $port_http -u /statuscode/200 --samples=3";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 0, $cmd);
+like( $result->output, '/^HTTP OK: 3 requests over 3 connection\(s\), connect [\d\.\/]+, ttfb [\d\.\/]+, time [\d\.\/]+ \(min\/p50\/p95\/max seconds\)\|connect_min=/', "Output correct: ".$result->output );
+
+$cmd = "$command -p $port_http -u /statuscode/500 --samples=2";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 2, $cmd);
+like( $result->output, '/^HTTP CRITICAL - All 2 requests failed \(HTTP\/1.1 500 Internal Server Error\)/', "Output correct: ".$result->output );
+
+# certificate checks are not done over HTTP/2
+SKIP: {
+	$result = NPTest->testCmd( "$command -p $port_http --http2 -C 1" );
+	skip "check_http built without nghttp2", $http2_tests if $result->output =~ /HTTP\/2 support not available/;
+	is( $result->return_code, 3, "--http2 with -C" );
+	like( $result->output, '/--http2 cannot be combined with certificate checks/', "Output correct: ".$result->output );
+}
+
 
 sub run_common_tests {
 	my ($opts) = @_;
@@ -384,6 +484,11 @@ sub run_common_tests {
 	is( $result->return_code, 0, $cmd);
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
 
+	$cmd = "$command -f follow -u /redirect_folded";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Location on a continuation line: ".$result->output );
+
 	$cmd = "$command -u /redirect -k 'follow: me'";
 	$result = NPTest->testCmd( $cmd );
 	is( $result->return_code, 0, $cmd);
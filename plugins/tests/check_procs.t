@@ -8,7 +8,7 @@ use Test::More;
 use NPTest;
 
 if (-x "./check_procs") {
-	plan tests => 50;
+	plan tests => 58;
 } else {
 	plan skip_all => "No check_procs compiled";
 }
@@ -130,3 +130,19 @@ $result = NPTest->testCmd( "$command --ereg-argument-array='(nosuchname|nosuch2n
 is( $result->return_code, 0, "Checking no pipe symbol in output" );
 is( $result->output, "PROCS OK: 0 processes with regex args '(nosuchname,nosuch2name)' | procs=0;;;0;", "Output correct" );
 
+$result = NPTest->testCmd( "$command --tree -C launchd" );
+is( $result->return_code, 0, "Matched processes below a matched one join its tree" );
+is( $result->output, "PROCS OK: 1 process tree with command name 'launchd' | trees=1;;;0; trees_warn=0;;;0; trees_crit=0;;;0; 'launchd_1'=95;;;0;", "Output correct" );
+
+$result = NPTest->testCmd( "$command --tree -C Terminal --metric=RSS -w 50000 -v" );
+is( $result->return_code, 1, "Checking RSS of a whole process tree" );
+is( $result->output, "RSS WARNING: 1 warn out of 1 process tree with command name 'Terminal' [Terminal] | trees=1;;;0; trees_warn=1;;;0; trees_crit=0;;;0; 'Terminal_175'=55684KB;50000;;0;", "Output correct" );
+
+$result = NPTest->testCmd( "$command --tree -C bash -c 1" );
+is( $result->return_code, 2, "Checking size of each tree" );
+is( $result->output, "PROCS CRITICAL: 2 crit, 0 warn out of 2 process trees with command name 'bash' | trees=2;;;0; trees_warn=0;;;0; trees_crit=2;;;0; 'bash_4559'=2;;1;0; 'bash_7302'=2;;1;0;", "Output correct" );
+
+$result = NPTest->testCmd( "$command --metric=THREADS" );
+is( $result->return_code, 3, "THREADS only with --tree" );
+like( $result->output, '/THREADS needs --tree/', "Output correct" );
+